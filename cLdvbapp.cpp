@@ -32,6 +32,7 @@
 #include <cLdvbasi.h>
 #endif
 #include <cLdvbudp.h>
+#include <cLdvbreplay.h>
 
 #include <cLdvbcomm.h>
 #include <cLdvbapp.h>
@@ -68,7 +69,7 @@ void cLdvbapp::sighandler(void *loop, void *p, int revents)
          break;
       case SIGHUP:
          cLbug(cL::dbg_dvb, "Configuration reload was requested.\n");
-         pobj->pdemux->config_ReadFile();
+         pobj->pdemux->config_Reload();
          break;
    }
 }
@@ -110,6 +111,8 @@ int cLdvbapp::cliusage()
    cLbug(cL::dbg_dvb, "  -b --bandwidth        frontend bandwidth\n");
 #endif
    cLbug(cL::dbg_dvb, "  -D --rtp-input        read packets from a multicast address instead of a DVB card\n");
+   cLbug(cL::dbg_dvb, "  --replay <file>       benchmark: feed a TS capture to the demux as fast as possible and report timings\n");
+   cLbug(cL::dbg_dvb, "  --replay-loops <n>    number of passes over the replayed file (default: 1)\n");
 #ifdef HAVE_CLDVBHW
    cLbug(cL::dbg_dvb, "  -5 --delsys           delivery system\n");
    cLbug(cL::dbg_dvb, "    DVBS|DVBS2|DVBC_ANNEX_A|DVBT|DVBT2|ATSC|ISDBT|DVBC_ANNEX_B(ATSC-C/QAMB) (default guessed)\n");
@@ -168,8 +171,17 @@ int cLdvbapp::cliusage()
    cLbug(cL::dbg_dvb, "  -U --udp              use raw UDP rather than RTP (required by some IPTV set top boxes)\n");
    cLbug(cL::dbg_dvb, "  -z --any-type         pass through all ESs from the PMT, of any type\n");
    cLbug(cL::dbg_dvb, "  -0 --pidmap <pmt_pid,audio_pid,video_pid,spu_pid>\n");
+#ifdef HAVE_CLLINUX
+   cLbug(cL::dbg_dvb, "  --sendmmsg            send the due datagrams of an output with one sendmmsg() call\n");
+#endif
+   cLbug(cL::dbg_dvb, "  --null-outputs        build the output datagrams but don't send them\n");
+   cLbug(cL::dbg_dvb, "  --pcr-timing          date input packets from the stream PCR instead of assuming CBR between reads\n");
+   cLbug(cL::dbg_dvb, "  --eit-memory <MiB>    bound the EIT schedule store, least recently refreshed segments are evicted\n");
+   cLbug(cL::dbg_dvb, "  --stats-shm <name>    publish binary counters in a shared memory segment (/dev/shm/<name>)\n");
+   cLbug(cL::dbg_dvb, "  --metrics [<host>:]<port>  serve OpenMetrics on http://<host>:<port>/metrics (default host 127.0.0.1)\n");
    cLbug(cL::dbg_dvb, "Misc:\n");
    cLbug(cL::dbg_dvb, "  -h --help             display this full help\n");
+   cLbug(cL::dbg_dvb, "  --crc-bench           compare the PSI CRC32 implementations and exit\n");
    cLbug(cL::dbg_dvb, "  -i --priority <RT priority>\n");
    cLbug(cL::dbg_dvb, "  -j --system-charset   character set used for printing messages (default UTF-8//IGNORE)\n");
    cLbug(cL::dbg_dvb, "  -J --dvb-charset      character set used in output DVB tables (default UTF-8//IGNORE)\n");
@@ -178,6 +190,9 @@ int cLdvbapp::cliusage()
 #endif
    cLbug(cL::dbg_dvb, "  -6 --print-period     periodicity at which we print bitrate and errors (in ms)\n");
    cLbug(cL::dbg_dvb, "  -7 --es-timeout       time of inactivy before which a PID is reported down (in ms)\n");
+   cLbugf(cL::dbg_dvb, "  --block-pool <n>      number of TS blocks kept in the slab pool before using the heap (default: %d)\n", CLDVB_MAX_BLOCKS);
+   cLbugf(cL::dbg_dvb, "  --output-threads <n>  send outputs from n worker threads (max %d, default 0: main loop)\n", CLDVB_OUTPUT_MAX_THREADS);
+   cLbug(cL::dbg_dvb, "  --batch-ingest <bytes> read DVR, ASI and raw TS stdin input into contiguous buffers of that size\n");
    cLbug(cL::dbg_dvb, "  -Z --mrtg-file <file> Log input packets and errors into mrtg-file\n");
    cLbug(cL::dbg_dvb, "  -V --version          only display the version\n");
 
@@ -263,12 +278,25 @@ int cLdvbapp::cli(int i_argc, char **pp_argv)
          { "ca-number",       required_argument, NULL, 'y' },
          { "pidmap",          required_argument, NULL, '0' },
          { "dvr-buf-size",    required_argument, NULL, '2' },
+         { "sendmmsg",        no_argument,       NULL, 0x100010 },
+         { "block-pool",      required_argument, NULL, 0x100011 },
+         { "output-threads",  required_argument, NULL, 0x100012 },
+         { "batch-ingest",    required_argument, NULL, 0x100013 },
+         { "replay",          required_argument, NULL, 0x100014 },
+         { "replay-loops",    required_argument, NULL, 0x100015 },
+         { "null-outputs",    no_argument,       NULL, 0x100016 },
+         { "pcr-timing",      no_argument,       NULL, 0x100017 },
+         { "eit-memory",      required_argument, NULL, 0x100018 },
+         { "crc-bench",       no_argument,       NULL, 0x100019 },
+         { "stats-shm",       required_argument, NULL, 0x10001a },
+         { "metrics",         required_argument, NULL, 0x10001b },
          { 0, 0, 0, 0 }
    };
 
 #ifdef HAVE_CLDVBHW
    cLdvbdev *pdev = (cLdvbdev *) 0;
 #endif
+   cLdvbreplay *preplay = (cLdvbreplay *) 0;
 
    const char *ostr = "q::c:r:t:o:i:a:n:5:f:F:R:s:S:k:v:pb:I:m:P:K:G:H:X:O:uwUTL:E:d:3D:A:lg:zCWYeM:N:j:J:B:x:Q:6:7:hVZ:y:0:1:2:9:";
 
@@ -282,6 +310,17 @@ int cLdvbapp::cli(int i_argc, char **pp_argv)
             this->pdemux = (cLdvbdemux *) pudp;
             break;
          }
+         case 0x100014: { // --replay
+            if (this->pdemux != (cLdvbdemux *) 0)
+               return cliusage();
+            preplay = new cLdvbreplay();
+            preplay->set_replay_file(optarg);
+            this->pdemux = (cLdvbdemux *) preplay;
+            break;
+         }
+         case 0x100019: // --crc-bench
+            cLdvbcrc::Bench();
+            return 1;
          case 'A': {
 #ifdef HAVE_CLASIHW
             if (strncmp(optarg, "deltacast:", 10) == 0) {
@@ -426,6 +465,21 @@ int cLdvbapp::cli(int i_argc, char **pp_argv)
    }
 #endif
 
+   if (preplay != (cLdvbreplay *) 0) {
+      optind = 1;
+      while ((c = getopt_long(i_argc, pp_argv, ostr, long_options, (int *) 0)) != -1) {
+         switch (c) {
+            case 0x100015: { // --replay-loops
+               int i = strtol(optarg, (char **) 0, 0);
+               if (i < 1)
+                  return this->cliusage();
+               preplay->set_replay_loops(i);
+               break;
+            }
+         }
+      }
+   }
+
    optind = 1;
    while ((c = getopt_long(i_argc, pp_argv, ostr, long_options, (int *) 0)) != -1) {
       switch (c) {
@@ -531,6 +585,39 @@ int cLdvbapp::cli(int i_argc, char **pp_argv)
          case '0':
             this->pdemux->set_pid_map(optarg);
             break;
+         case 0x100010: // --sendmmsg
+            this->pdemux->set_send_mmsg();
+            break;
+         case 0x100011: // --block-pool
+            this->pdemux->set_block_pool(strtoul(optarg, (char **) 0, 0));
+            break;
+         case 0x100012: { // --output-threads
+            int i_threads = strtol(optarg, (char **) 0, 0);
+            if (i_threads < 0 || i_threads > CLDVB_OUTPUT_MAX_THREADS) {
+               cLbugf(cL::dbg_dvb, "invalid number of output threads (max %d)\n", CLDVB_OUTPUT_MAX_THREADS);
+               return this->cliusage();
+            }
+            this->pdemux->set_output_threads(i_threads);
+            break;
+         }
+         case 0x100013: // --batch-ingest
+            this->pdemux->set_batch_ingest(strtoul(optarg, (char **) 0, 0));
+            break;
+         case 0x100016: // --null-outputs
+            this->pdemux->set_null_outputs();
+            break;
+         case 0x100017: // --pcr-timing
+            this->pdemux->set_pcr_timing();
+            break;
+         case 0x100018: // --eit-memory
+            this->pdemux->set_eit_memory((size_t)strtoul(optarg, (char **) 0, 0) << 20);
+            break;
+         case 0x10001a: // --stats-shm
+            this->pdemux->set_stats_shm(optarg);
+            break;
+         case 0x10001b: // --metrics
+            this->pdemux->set_metrics(optarg);
+            break;
          case 'h':
             return this->cliusage();
          default:
@@ -178,6 +178,20 @@ void cLdvbasi::asi_Read(void *loop, void *p, int revents)
    block_t *p_ts, **pp_current = &p_ts;
    int i, i_len;
 
+   if (pobj->i_batch_size) {
+      if (pobj->block_ReadBatch(pobj->i_handle, &p_ts) < 0)
+         cLbugf(cL::dbg_dvb, "couldn't read from device " ASI_DEVICE " (%s)\n", pobj->i_asi_adapter, strerror(errno));
+      if (p_ts != (block_t *) 0) {
+         if (!pobj->b_sync) {
+            cLbug(cL::dbg_dvb, "frontend has acquired lock\n");
+            pobj->b_sync = true;
+         }
+         cLev_timer_again(loop, &pobj->mute_watcher);
+      }
+      pobj->demux_Run(p_ts);
+      return;
+   }
+
    for (i = 0; i < pobj->i_bufsize / TS_SIZE; i++) {
       *pp_current = pobj->block_New();
       p_iov[i].iov_base = (*pp_current)->p_ts;
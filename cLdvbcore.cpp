@@ -74,6 +74,19 @@ cLdvbobj::mtime_t cLdvbobj::mdate(void)
    return rc;
 }
 
+/* nanosecond clock for profiling */
+uint64_t cLdvbobj::ndate(void)
+{
+#ifdef HAVE_CLOCK_NANOSLEEP
+   struct timespec ts;
+   if( clock_gettime(CLOCK_MONOTONIC, &ts ) == EINVAL)
+      (void)clock_gettime( CLOCK_REALTIME, &ts);
+   return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+   return (uint64_t)cLdvbobj::mdate() * 1000;
+#endif
+}
+
 void cLdvbobj::msleep(mtime_t delay)
 {
    struct timespec ts;
@@ -74,10 +74,43 @@
 #define CLDVB_COMM_BUFFER_SIZE      (CLDVB_COMM_HEADER_SIZE + ((PSI_PRIVATE_MAX_SIZE + PSI_HEADER_SIZE) * PSI_TABLE_MAX_SECTIONS))
 #define CLDVB_COMM_HEADER_MAGIC     0x49
 #define CLDVB_COMM_MAX_MSG_CHUNK    4096
-#define CLDVB_MAX_BLOCKS            500
+#define CLDVB_MAX_BLOCKS            8192 /* default block pool high-water mark */
+#define CLDVB_BLOCK_SLAB_SIZE       256 /* blocks per slab */
+#define CLDVB_CACHE_LINE            64
+#define CLDVB_OUTPUT_MAX_THREADS    32
+#define CLDVB_TS_SCAN_BATCH         256 /* headers decoded at once */
+#define CLDVB_BATCH_MAX_SIZE        (4 << 20) /* bytes, largest --batch-ingest buffer */
+#define CLDVB_REPLAY_CHUNK          1024 /* packets per replay iteration */
+#define CLDVB_PCR_WRAP              (((int64_t)1 << 33) * 300) /* 27 MHz */
+#define CLDVB_PCR_MAX_GAP           27000000 /* 1 s, larger PCR gaps are discontinuities */
+#define CLDVB_OUTPUT_QUEUE_SIZE     65536 /* blocks per shard queue, power of two */
 #define CLDVB_N_MAP_PIDS            4
 
 #define CLDVB_OUTPUT_MAX_PACKETS    100
+#define CLDVB_OUTPUT_MAX_MMSG       64 /* datagrams per sendmmsg() call */
+#define CLDVB_OUTPUT_HASH_MIN       64 /* buckets of the output index, power of two */
+#define CLDVB_CONFIG_SLICE          64 /* outputs changed per event loop iteration on reload */
+#define CLDVB_SID_INDEX_SIZE        0x10000 /* one entry per program_number */
+#define CLDVB_PACE_BURST            2 /* default datagrams a paced output may burst */
+#define CLDVB_PACE_WINDOW           1000000 /* 1 s, paced output bitrate measurement */
+#define CLDVB_LATENCY_SUB_BITS      2 /* log-linear histogram: 2^n buckets per power of two */
+#define CLDVB_LATENCY_MAX_BITS      24 /* us, longer delays land in the last bucket */
+#define CLDVB_LATENCY_BUCKETS       ((CLDVB_LATENCY_MAX_BITS - CLDVB_LATENCY_SUB_BITS + 1) << CLDVB_LATENCY_SUB_BITS)
+#define CLDVB_OUTPUT_LATE_SLACK     5000 /* us past the output latency before a datagram counts as late */
+#define CLDVB_PSI_KEY_MAX           1024 /* bytes of output config identifying a shared section */
+#define CLDVB_EIT_SEGMENT_SECTIONS  8 /* sections per EIT schedule segment (3 hours) */
+#define CLDVB_EIT_ARENA_MIN         4096 /* smallest per-service EIT arena */
+#define CLDVB_SECTION_PRINT_BITS    14 /* 2^n accepted section fingerprints */
+#define CLDVB_STATS_MAX_OUTPUTS     1024 /* output records in --stats-shm */
+#define CLDVB_STATS_PERIOD          100000 /* us between --stats-shm updates */
+#define CLDVB_METRICS_MAX_CLIENTS   8 /* concurrent /metrics connections */
+#define CLDVB_METRICS_REQUEST_SIZE  4096 /* bytes of HTTP request headers */
+#define CLDVB_METRICS_TIMEOUT       10 /* s before an idle scraper is dropped */
+#define CLDVB_UDP_MAX_MMSG          64 /* datagrams per recvmmsg() call */
+#define CLDVB_UDP_RING_BLOCK_SIZE   (1 << 20) /* TPACKET_V3 ring geometry */
+#define CLDVB_UDP_RING_BLOCKS       64
+#define CLDVB_UDP_RING_FRAME_SIZE   2048
+#define CLDVB_UDP_RING_TIMEOUT      10 /* ms before a partly filled block is retired */
 
 // Define the dump period in seconds
 #define CLDVB_MRTG_INTERVAL   1
@@ -135,6 +168,7 @@ class cLdvbobj {
       }
 
       static mtime_t mdate(void);
+      static uint64_t ndate(void);
       static void msleep(mtime_t delay);
       cLdvbobj();
       ~cLdvbobj();
@@ -0,0 +1,242 @@
+/*
+ * cLdvbcrc.cpp
+ * Gokhan Poyraz <gokhan@kylone.com>
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include <cLdvbcrc.h>
+
+#include <bitstream/mpeg/psi.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+#define CRC32_POLY 0x04c11db7
+
+uint32_t cLdvbcrc::pi_table[8][256];
+uint64_t cLdvbcrc::pi_fold[4];
+cLdvbcrc::crc_func_t cLdvbcrc::pf_crc = (cLdvbcrc::crc_func_t) 0;
+
+/* x^n mod P */
+static uint32_t crc_xpow(int n)
+{
+   uint32_t i_rem = 1;
+
+   while (n--)
+      i_rem = (i_rem << 1) ^ ((i_rem & 0x80000000) ? CRC32_POLY : 0);
+   return i_rem;
+}
+
+void cLdvbcrc::Init(void)
+{
+   for (int i = 0; i < 256; i++) {
+      uint32_t i_crc = (uint32_t)i << 24;
+      for (int j = 0; j < 8; j++)
+         i_crc = (i_crc << 1) ^ ((i_crc & 0x80000000) ? CRC32_POLY : 0);
+      cLdvbcrc::pi_table[0][i] = i_crc;
+   }
+   /* table k advances a byte k positions further */
+   for (int k = 1; k < 8; k++) {
+      for (int i = 0; i < 256; i++) {
+         uint32_t i_crc = cLdvbcrc::pi_table[k - 1][i];
+         cLdvbcrc::pi_table[k][i] = (i_crc << 8) ^ cLdvbcrc::pi_table[0][i_crc >> 24];
+      }
+   }
+
+   /* folding a 128-bit remainder forward by 512 and by 128 bits */
+   cLdvbcrc::pi_fold[0] = crc_xpow(512 + 64);
+   cLdvbcrc::pi_fold[1] = crc_xpow(512);
+   cLdvbcrc::pi_fold[2] = crc_xpow(128 + 64);
+   cLdvbcrc::pi_fold[3] = crc_xpow(128);
+
+#ifdef __x86_64__
+   if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3")) {
+      cLdvbcrc::pf_crc = cLdvbcrc::CrcPCLMUL;
+      return;
+   }
+#endif
+   cLdvbcrc::pf_crc = cLdvbcrc::CrcSlice8;
+}
+
+uint32_t cLdvbcrc::CrcBytewise(uint32_t i_crc, const uint8_t *p, unsigned int i_len)
+{
+   while (i_len--)
+      i_crc = (i_crc << 8) ^ cLdvbcrc::pi_table[0][(i_crc >> 24) ^ *p++];
+   return i_crc;
+}
+
+uint32_t cLdvbcrc::CrcSlice8(uint32_t i_crc, const uint8_t *p, unsigned int i_len)
+{
+   for (; i_len >= 8; i_len -= 8, p += 8) {
+      uint32_t a = i_crc ^ ((uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3]);
+      uint32_t b = (uint32_t)p[4] << 24 | p[5] << 16 | p[6] << 8 | p[7];
+      i_crc = cLdvbcrc::pi_table[7][a >> 24] ^ cLdvbcrc::pi_table[6][(a >> 16) & 0xff]
+            ^ cLdvbcrc::pi_table[5][(a >> 8) & 0xff] ^ cLdvbcrc::pi_table[4][a & 0xff]
+            ^ cLdvbcrc::pi_table[3][b >> 24] ^ cLdvbcrc::pi_table[2][(b >> 16) & 0xff]
+            ^ cLdvbcrc::pi_table[1][(b >> 8) & 0xff] ^ cLdvbcrc::pi_table[0][b & 0xff];
+   }
+   return cLdvbcrc::CrcBytewise(i_crc, p, i_len);
+}
+
+#ifdef __x86_64__
+/* carry-less multiply folding: the message is loaded byte-swapped so
+ * that bit 127 is the first bit, H * x^64 + L advanced by n bits is
+ * H * (x^(n+64) mod P) + L * (x^n mod P), the last 128 bits of
+ * remainder then go through the table */
+__attribute__((target("pclmul,ssse3")))
+uint32_t cLdvbcrc::CrcPCLMUL(uint32_t i_crc, const uint8_t *p, unsigned int i_len)
+{
+   if (i_len < 64)
+      return cLdvbcrc::CrcSlice8(i_crc, p, i_len);
+
+   const __m128i swap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+   const __m128i k4 = _mm_set_epi64x(cLdvbcrc::pi_fold[0], cLdvbcrc::pi_fold[1]);
+   const __m128i k1 = _mm_set_epi64x(cLdvbcrc::pi_fold[2], cLdvbcrc::pi_fold[3]);
+   __m128i x0, x1, x2, x3;
+   uint8_t p_rem[16];
+
+   x0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), swap);
+   x1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), swap);
+   x2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 32)), swap);
+   x3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 48)), swap);
+   x0 = _mm_xor_si128(x0, _mm_set_epi32(i_crc, 0, 0, 0));
+   p += 64;
+   i_len -= 64;
+
+#define CRC_FOLD(x, k) _mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11), _mm_clmulepi64_si128(x, k, 0x00))
+   for (; i_len >= 64; i_len -= 64, p += 64) {
+      x0 = _mm_xor_si128(CRC_FOLD(x0, k4), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), swap));
+      x1 = _mm_xor_si128(CRC_FOLD(x1, k4), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 16)), swap));
+      x2 = _mm_xor_si128(CRC_FOLD(x2, k4), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 32)), swap));
+      x3 = _mm_xor_si128(CRC_FOLD(x3, k4), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p + 48)), swap));
+   }
+
+   x1 = _mm_xor_si128(x1, CRC_FOLD(x0, k1));
+   x2 = _mm_xor_si128(x2, CRC_FOLD(x1, k1));
+   x3 = _mm_xor_si128(x3, CRC_FOLD(x2, k1));
+   for (; i_len >= 16; i_len -= 16, p += 16)
+      x3 = _mm_xor_si128(CRC_FOLD(x3, k1), _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)p), swap));
+#undef CRC_FOLD
+
+   _mm_storeu_si128((__m128i *)p_rem, _mm_shuffle_epi8(x3, swap));
+   i_crc = cLdvbcrc::CrcSlice8(0, p_rem, 16);
+   return cLdvbcrc::CrcSlice8(i_crc, p, i_len);
+}
+#endif
+
+uint32_t cLdvbcrc::Crc(const uint8_t *p, unsigned int i_len)
+{
+   if (cLdvbcrc::pf_crc == (crc_func_t) 0)
+      cLdvbcrc::Init();
+   return cLdvbcrc::pf_crc(0xffffffff, p, i_len);
+}
+
+void cLdvbcrc::SetCRC(uint8_t *p_section)
+{
+   uint16_t i_end = psi_get_length(p_section) + PSI_HEADER_SIZE - PSI_CRC_SIZE;
+   uint32_t i_crc = cLdvbcrc::Crc(p_section, i_end);
+
+   p_section[i_end] = i_crc >> 24;
+   p_section[i_end + 1] = (i_crc >> 16) & 0xff;
+   p_section[i_end + 2] = (i_crc >> 8) & 0xff;
+   p_section[i_end + 3] = i_crc & 0xff;
+}
+
+bool cLdvbcrc::CheckCRC(const uint8_t *p_section)
+{
+   uint16_t i_end = psi_get_length(p_section) + PSI_HEADER_SIZE - PSI_CRC_SIZE;
+   uint32_t i_crc = cLdvbcrc::Crc(p_section, i_end);
+
+   return p_section[i_end] == i_crc >> 24 && p_section[i_end + 1] == ((i_crc >> 16) & 0xff)
+         && p_section[i_end + 2] == ((i_crc >> 8) & 0xff) && p_section[i_end + 3] == (i_crc & 0xff);
+}
+
+bool cLdvbcrc::Validate(const uint8_t *p_section)
+{
+   if (!psi_get_syntax(p_section))
+      return true;
+   return psi_get_length(p_section) >= PSI_HEADER_SIZE_SYNTAX1 - PSI_HEADER_SIZE + PSI_CRC_SIZE && cLdvbcrc::CheckCRC(p_section);
+}
+
+const char *cLdvbcrc::Implementation(void)
+{
+   if (cLdvbcrc::pf_crc == (crc_func_t) 0)
+      cLdvbcrc::Init();
+#ifdef __x86_64__
+   if (cLdvbcrc::pf_crc == cLdvbcrc::CrcPCLMUL)
+      return "pclmul";
+#endif
+   return "slice-by-8";
+}
+
+/* --crc-bench: every implementation against the bytewise table on
+ * typical section sizes */
+void cLdvbcrc::Bench(void)
+{
+   static const unsigned int pi_sizes[] = { TS_SIZE - 4, 1024, PSI_PRIVATE_MAX_SIZE + PSI_HEADER_SIZE };
+   struct {
+      const char *psz_name;
+      crc_func_t pf;
+   } p_impls[3];
+   int i_nb_impls = 0;
+   uint8_t *p_data = cLmalloc(uint8_t, PSI_PRIVATE_MAX_SIZE + PSI_HEADER_SIZE);
+
+   if (cLdvbcrc::pf_crc == (crc_func_t) 0)
+      cLdvbcrc::Init();
+   p_impls[i_nb_impls].psz_name = "bytewise";
+   p_impls[i_nb_impls++].pf = cLdvbcrc::CrcBytewise;
+   p_impls[i_nb_impls].psz_name = "slice-by-8";
+   p_impls[i_nb_impls++].pf = cLdvbcrc::CrcSlice8;
+#ifdef __x86_64__
+   if (cLdvbcrc::pf_crc == cLdvbcrc::CrcPCLMUL) {
+      p_impls[i_nb_impls].psz_name = "pclmul";
+      p_impls[i_nb_impls++].pf = cLdvbcrc::CrcPCLMUL;
+   }
+#endif
+
+   for (unsigned int i = 0; i < PSI_PRIVATE_MAX_SIZE + PSI_HEADER_SIZE; i++)
+      p_data[i] = rand() & 0xff;
+
+   cLbugf(cL::dbg_dvb, "crc: using %s\n", cLdvbcrc::Implementation());
+   for (unsigned int s = 0; s < sizeof(pi_sizes) / sizeof(pi_sizes[0]); s++) {
+      unsigned int i_size = pi_sizes[s];
+      unsigned int i_loops = (64 << 20) / i_size;
+      uint32_t i_ref = cLdvbcrc::CrcBytewise(0xffffffff, p_data, i_size);
+      uint64_t i_ref_ns = 0;
+
+      for (int k = 0; k < i_nb_impls; k++) {
+         uint32_t i_crc = 0;
+
+         if (p_impls[k].pf(0xffffffff, p_data, i_size) != i_ref) {
+            cLbugf(cL::dbg_dvb, "crc: %s mismatch on %u bytes\n", p_impls[k].psz_name, i_size);
+            continue;
+         }
+
+         uint64_t i_start = cLdvbobj::ndate();
+         for (unsigned int l = 0; l < i_loops; l++)
+            i_crc ^= p_impls[k].pf(i_crc, p_data, i_size);
+         uint64_t i_ns = cLdvbobj::ndate() - i_start;
+         if (!i_ns)
+            i_ns = 1;
+         if (!k)
+            i_ref_ns = i_ns;
+
+         cLbugf(cL::dbg_dvb, "crc: %-10s %4u bytes: %6"PRIu64" ns/section, %6"PRIu64" MB/s, x%"PRIu64".%02"PRIu64" (%08x)\n", p_impls[k].psz_name, i_size, i_ns / i_loops, (uint64_t)i_loops * i_size * 1000 / i_ns, i_ref_ns / i_ns, i_ref_ns * 100 / i_ns % 100, i_crc);
+      }
+   }
+   ::free(p_data);
+}
@@ -0,0 +1,53 @@
+/*
+ * cLdvbcrc.h
+ * Gokhan Poyraz <gokhan@kylone.com>
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef CLDVB_CRC_H_
+#define CLDVB_CRC_H_
+
+#include <cLdvbcore.h>
+
+/* MPEG-2 CRC32 (polynomial 0x04c11db7, MSB first, no final xor) of PSI
+ * sections, the implementation is picked at runtime */
+class cLdvbcrc {
+   private:
+      typedef uint32_t (*crc_func_t)(uint32_t i_crc, const uint8_t *p, unsigned int i_len);
+
+      static uint32_t pi_table[8][256];
+      static uint64_t pi_fold[4];      /* x^576, x^512, x^192, x^128 mod P */
+      static crc_func_t pf_crc;
+
+      static void Init(void);
+      static uint32_t CrcBytewise(uint32_t i_crc, const uint8_t *p, unsigned int i_len);
+      static uint32_t CrcSlice8(uint32_t i_crc, const uint8_t *p, unsigned int i_len);
+#ifdef __x86_64__
+      static uint32_t CrcPCLMUL(uint32_t i_crc, const uint8_t *p, unsigned int i_len);
+#endif
+
+   public:
+      static uint32_t Crc(const uint8_t *p, unsigned int i_len);
+      /* replacements for psi_set_crc(), psi_check_crc() and psi_validate(),
+       * the latter also checking the CRC of long sections */
+      static void SetCRC(uint8_t *p_section);
+      static bool CheckCRC(const uint8_t *p_section);
+      static bool Validate(const uint8_t *p_section);
+      static const char *Implementation(void);
+      static void Bench(void);
+};
+
+#endif /*CLDVB_CRC_H_*/
@@ -35,6 +35,8 @@
 #include <bitstream/dvb/si_print.h>
 #include <signal.h>
 #include <pthread.h>
+#include <sys/time.h>
+#include <limits.h>
 
 #ifdef HAVE_CLMACOS
 #include <stdarg.h>
@@ -62,17 +64,61 @@ cLdvbdemux::cLdvbdemux()
    this->i_wallclock = 0;
    this->pp_sids = (sid_t **) 0;
    this->i_nb_sids = 0;
+   this->p_sid_index = (sid_index_t *) 0;
    this->i_quit_timeout_duration = 0;
 
    this->i_last_dts = -1;
+   this->b_pcr_timing = false;
+   memset(this->pi_psi_generation, 0, sizeof(this->pi_psi_generation));
+   this->i_pcr_ref_pid = UNUSED_PID;
+   this->i_pcr_pos = 0;
+   this->i_pcr_ref_pos = 0;
+   this->i_pcr_ref = 0;
+   this->i_pcr_rate = 0;
+   this->i_pcr_ref_date = 0;
+   this->i_pcr_offset = 0;
+   this->i_pcr_lock_offset = 0;
+   this->i_pcr_lock_date = 0;
+   this->i_pcr_last_dts = 0;
+   this->p_eit_lru_first = this->p_eit_lru_last = (eit_segment_t *) 0;
+   this->i_eit_memory_max = 0;
+   this->i_eit_memory = 0;
+   this->i_eit_live = 0;
+   this->i_eit_segments = 0;
+   this->i_eit_stored = 0;
+   this->i_eit_unchanged = 0;
+   this->i_eit_evicted = 0;
+   this->p_section_prints = (section_print_t *) 0;
+   this->i_nb_section_prints = 0;
+   this->i_sections_skipped = 0;
    this->i_demux_fd = -1;
    this->i_nb_packets = 0;
    this->i_nb_invalids = 0;
    this->i_nb_discontinuities = 0;
    this->i_nb_errors = 0;
+   this->i_total_packets = 0;
+   this->i_total_invalids = 0;
+   this->i_total_discontinuities = 0;
+   this->i_total_errors = 0;
+   this->pstats = (cLdvbstats *) 0;
+   this->psz_stats_file = (const char *) 0;
+   this->pmetrics = (cLdvbmetrics *) 0;
+   this->psz_metrics_addr = (const char *) 0;
+   this->i_stats_last_packets = 0;
+   this->i_stats_last_date = 0;
    this->i_tuner_errors = 0;
    this->i_last_error = 0;
    this->i_last_reset = 0;
+   this->pp_passthrough = (output_t **) 0;
+   this->i_nb_passthrough = 0;
+   this->b_config_parsing = false;
+   this->b_config_pending = false;
+   this->p_config_parsed = (config_file_t *) 0;
+   memset(&this->config_reload, 0, sizeof(config_reload_t));
+   this->p_pids_hot = (ts_pid_hot_t *) 0;
+   this->i_demux_ns = 0;
+   this->i_scan_ns = 0;
+   this->i_demux_packets = 0;
 
    cLbug(cL::dbg_high, "cLdvbdemux created\n");
 
@@ -207,18 +253,21 @@ uint16_t cLdvbdemux::map_es_pid(output_t *p_output, uint8_t *p_es, uint16_t i_pi
 
    /* Got the new base for the mapped pid. Find the next free one
        we do this to ensure that multiple audios get unique pids */
-   while (p_output->pi_freepids[i_newpid] != UNUSED_PID)
+   while (cLdvboutput::output_RemapUsed(p_output, i_newpid))
       i_newpid++;
-   p_output->pi_freepids[i_newpid] = i_pid;  /* Mark as in use */
-   p_output->pi_newpids[i_pid] = i_newpid;   /* Save the new pid */
+   cLdvboutput::output_RemapAdd(p_output, i_pid, i_newpid);
 
    cLbugf(cL::dbg_dvb, "REMAP: => Elementary stream is remapped to PID 0x%x (%u)\n", i_newpid, i_newpid);
 
    return i_newpid;
 }
 
+/* 0 finds a free entry of pp_sids */
 cLdvbdemux::sid_t *cLdvbdemux::FindSID(uint16_t i_sid)
 {
+   if (i_sid)
+      return this->p_sid_index[i_sid].p_sid;
+
    for (int i = 0; i < this->i_nb_sids; i++) {
       sid_t *p_sid = this->pp_sids[i];
       if (p_sid->i_sid == i_sid)
@@ -227,6 +276,35 @@ cLdvbdemux::sid_t *cLdvbdemux::FindSID(uint16_t i_sid)
    return (sid_t *) 0;
 }
 
+/* move an output to the list of its new SID, outputs without a SID
+ * (passthrough, PIDs only or closed) aren't listed */
+void cLdvbdemux::output_SetSID(output_t *p_output, uint16_t i_sid)
+{
+   uint16_t i_old_sid = p_output->config.i_sid;
+
+   if (i_sid == i_old_sid)
+      return;
+
+   if (i_old_sid) {
+      if (p_output->p_sid_prev != (output_t *) 0)
+         p_output->p_sid_prev->p_sid_next = p_output->p_sid_next;
+      else
+         this->p_sid_index[i_old_sid].p_outputs = p_output->p_sid_next;
+      if (p_output->p_sid_next != (output_t *) 0)
+         p_output->p_sid_next->p_sid_prev = p_output->p_sid_prev;
+      p_output->p_sid_prev = p_output->p_sid_next = (output_t *) 0;
+   }
+
+   p_output->config.i_sid = i_sid;
+
+   if (i_sid) {
+      p_output->p_sid_next = this->p_sid_index[i_sid].p_outputs;
+      if (p_output->p_sid_next != (output_t *) 0)
+         p_output->p_sid_next->p_sid_prev = p_output;
+      this->p_sid_index[i_sid].p_outputs = p_output;
+   }
+}
+
 void cLdvbdemux::cLdvbdemux::PrintCb(void *loop, void *p, int revents)
 {
    struct cLev_timer *w = (struct cLev_timer *)p;
@@ -234,6 +312,10 @@ void cLdvbdemux::cLdvbdemux::PrintCb(void *loop, void *p, int revents)
 
    uint64_t i_bitrate = pobj->i_nb_packets * TS_SIZE * 8 * 1000000 / pobj->i_print_period;
    cLbugf(cL::dbg_dvb, "bitrate: %"PRIu64"\n", i_bitrate);
+   pobj->i_total_packets += pobj->i_nb_packets;
+   pobj->i_total_invalids += pobj->i_nb_invalids;
+   pobj->i_total_discontinuities += pobj->i_nb_discontinuities;
+   pobj->i_total_errors += pobj->i_nb_errors;
    pobj->i_nb_packets = 0;
    if (pobj->i_nb_invalids) {
       cLbugf(cL::dbg_dvb, "invalids: %"PRIu64"\n", pobj->i_nb_invalids);
@@ -247,6 +329,242 @@ void cLdvbdemux::cLdvbdemux::PrintCb(void *loop, void *p, int revents)
       cLbugf(cL::dbg_dvb, "errors: %"PRIu64"\n", pobj->i_nb_errors);
       pobj->i_nb_errors = 0;
    }
+   if (pobj->i_demux_packets) {
+      cLbugf(cL::dbg_dvb, "demux: %"PRIu64" ns/packet (header scan %"PRIu64") over %"PRIu64" packets\n", pobj->i_demux_ns / pobj->i_demux_packets, pobj->i_scan_ns / pobj->i_demux_packets, pobj->i_demux_packets);
+      pobj->i_demux_ns = 0;
+      pobj->i_scan_ns = 0;
+      pobj->i_demux_packets = 0;
+   }
+   cLbugf(cL::dbg_dvb, "blocks: %"PRIu64" allocs, %"PRIu64" hits, %"PRIu64" misses, %u pooled, %u in flight (peak %u)\n", pobj->block_stats.i_allocs, pobj->block_stats.i_hits, pobj->block_stats.i_misses, pobj->block_stats.i_pooled, pobj->block_stats.i_inflight, pobj->block_stats.i_peak);
+   if (pobj->i_batch_size) {
+      cLbugf(cL::dbg_dvb, "batches: %u of %u bytes allocated\n", pobj->block_stats.i_batches, pobj->i_batch_size);
+   }
+   uint64_t i_datagrams, i_send_calls, i_drops;
+   pobj->outputs_Stats(&i_datagrams, &i_send_calls, &i_drops);
+   if (pobj->b_send_mmsg && i_datagrams) {
+      cLbugf(cL::dbg_dvb, "sendmmsg: %"PRIu64" datagrams in %"PRIu64" calls (%"PRIu64" syscalls saved)\n", i_datagrams, i_send_calls, i_datagrams - i_send_calls);
+   }
+   if (i_drops) {
+      cLbugf(cL::dbg_dvb, "output threads: %"PRIu64" blocks dropped\n", i_drops);
+   }
+   pobj->outputs_PrintPacing();
+   pobj->outputs_PrintLatency();
+   if (pobj->i_sections_skipped) {
+      cLbugf(cL::dbg_dvb, "sections: %"PRIu64" repetitions skipped, %d fingerprints\n", pobj->i_sections_skipped, pobj->i_nb_section_prints);
+      pobj->i_sections_skipped = 0;
+   }
+   if (pobj->i_eit_stored || pobj->i_eit_unchanged) {
+      cLbugf(cL::dbg_dvb, "eit store: %zu KiB for %zu KiB of sections in %d segments, %"PRIu64" stored, %"PRIu64" unchanged, %"PRIu64" segments evicted\n", pobj->i_eit_memory / 1024, pobj->i_eit_live / 1024, pobj->i_eit_segments, pobj->i_eit_stored, pobj->i_eit_unchanged, pobj->i_eit_evicted);
+      pobj->i_eit_stored = 0;
+      pobj->i_eit_unchanged = 0;
+      pobj->i_eit_evicted = 0;
+   }
+   if (pobj->i_psi_built || pobj->i_psi_shared) {
+      cLbugf(cL::dbg_dvb, "psi cache: %"PRIu64" sections built, %"PRIu64" shared, %d live\n", pobj->i_psi_built, pobj->i_psi_shared, pobj->i_nb_psi_cache);
+      pobj->i_psi_built = 0;
+      pobj->i_psi_shared = 0;
+   }
+   if (pobj->i_pcr_ref_pid != UNUSED_PID && pobj->i_pcr_rate) {
+      mtime_t i_locked = pobj->i_wallclock - pobj->i_pcr_lock_date;
+      cLbugf(cL::dbg_dvb, "pcr timing: PID %hu, %"PRId64" bits/s, drift %"PRId64" ppm\n", pobj->i_pcr_ref_pid, (int64_t)TS_SIZE * 8 * 27000000 * 65536 / pobj->i_pcr_rate, i_locked > 1000000 ? (pobj->i_pcr_offset - pobj->i_pcr_lock_offset) * 1000000 / i_locked : (int64_t)0);
+   }
+}
+
+void cLdvbdemux::StatsCb(void *loop, void *p, int revents)
+{
+   struct cLev_timer *w = (struct cLev_timer *)p;
+   cLdvbdemux *pobj = (cLdvbdemux *)w->data;
+
+   pobj->stats_Publish();
+}
+
+/* runs from the event loop, the data path only bumps its own counters */
+void cLdvbdemux::stats_Publish(void)
+{
+   cLdvbstats::header_t *p_header = this->pstats->header();
+   uint64_t i_packets = this->i_total_packets + this->i_nb_packets;
+   mtime_t i_now = this->mdate();
+   struct timeval tv;
+   int i, i_nb = 0;
+
+   this->pstats->statsBegin();
+
+   for (i = 0; i < MAX_PIDS; i++) {
+      const ts_pid_t *p_pid = &this->p_pids[i];
+      const ts_pid_hot_t *p_hot = &this->p_pids_hot[i];
+      cLdvbstats::stats_pid_t *p_stats = &this->pstats->p_pids[i];
+
+      /* copied even when idle: a stopped PID drops its byte rate and
+       * error counters move without new packets */
+      p_stats->i_packets = p_hot->i_packets;
+      p_stats->i_cc_errors = p_pid->info.i_cc_errors;
+      p_stats->i_transport_errors = p_pid->info.i_transport_errors;
+      /* the rate is measured on packet arrival, over 1 s windows */
+      p_stats->i_bytes_per_sec = i_now - p_hot->i_last_packet_ts > 2000000 ? 0 : p_pid->info.i_bytes_per_sec;
+      p_stats->i_first_packet_ts = p_pid->info.i_first_packet_ts;
+      p_stats->i_last_packet_ts = p_hot->i_last_packet_ts;
+      p_stats->i_scrambling = p_hot->i_scrambling;
+      p_stats->b_pes = p_pid->b_pes;
+      p_stats->i_nb_outputs = p_pid->i_nb_outputs;
+   }
+
+   /* over every output, not only those given a slot below */
+   uint64_t i_drops = 0;
+   for (i = 0; i < this->i_nb_outputs; i++)
+      i_drops += this->pp_outputs[i]->i_stat_drops;
+
+   for (i = 0; i < this->i_nb_outputs && i_nb < CLDVB_STATS_MAX_OUTPUTS; i++) {
+      output_t *p_output = this->pp_outputs[i];
+      cLdvbstats::stats_output_t *p_stats = &this->pstats->p_outputs[i_nb];
+
+      if (!(p_output->config.i_config & OUTPUT_VALID))
+         continue;
+      strncpy(p_stats->psz_name, p_output->config.psz_displayname, sizeof(p_stats->psz_name) - 1);
+      p_stats->psz_name[sizeof(p_stats->psz_name) - 1] = '\0';
+      p_stats->i_config = p_output->config.i_config;
+      p_stats->i_sid = p_output->config.i_sid;
+      p_stats->i_datagrams = p_output->i_stat_datagrams;
+      p_stats->i_bytes = p_output->i_stat_bytes;
+      p_stats->i_send_errors = p_output->i_stat_send_errors;
+      p_stats->i_drops = p_output->i_stat_drops;
+      p_stats->i_queue_depth = p_output->i_stat_queued;
+      p_stats->i_latency = p_output->i_stat_latency;
+      p_stats->i_latency_max = cLdvboutput::period_Next(&p_output->stats_latency_max);
+      p_stats->i_queue_max = p_output->i_stat_queued_max;
+      p_stats->i_late = p_output->i_stat_late;
+      p_stats->i_latency_sum = p_output->i_stat_latency_sum;
+      memcpy(p_stats->pi_latency, p_output->pi_stat_latency, sizeof(p_stats->pi_latency));
+      i_nb++;
+   }
+   p_header->i_nb_outputs = i_nb;
+
+   p_header->i_packets = i_packets;
+   p_header->i_invalids = this->i_total_invalids + this->i_nb_invalids;
+   p_header->i_discontinuities = this->i_total_discontinuities + this->i_nb_discontinuities;
+   p_header->i_errors = this->i_total_errors + this->i_nb_errors;
+   if (this->i_stats_last_date && i_now > this->i_stats_last_date)
+      p_header->i_bitrate = (i_packets - this->i_stats_last_packets) * TS_SIZE * 8 * 1000000 / (i_now - this->i_stats_last_date);
+   p_header->i_drops = i_drops;
+   p_header->i_blocks_inflight = this->block_stats.i_inflight;
+   p_header->i_eit_memory = this->i_eit_memory;
+   gettimeofday(&tv, (struct timezone *) 0);
+   p_header->i_update_time = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+   p_header->i_updates++;
+
+   this->pstats->statsEnd();
+
+   this->i_stats_last_packets = i_packets;
+   this->i_stats_last_date = i_now;
+}
+
+void cLdvbdemux::MetricsCb(cLdvbmetrics *pm, void *opaque)
+{
+   cLdvbdemux *pobj = (cLdvbdemux *)opaque;
+
+   pobj->metrics_Render(pm);
+}
+
+/* OpenMetrics wants the samples of a family together, hence a loop per
+ * family; counters are cumulative, Prometheus derives the rates */
+void cLdvbdemux::metrics_Render(cLdvbmetrics *pm)
+{
+   uint64_t i_bitrate = 0;
+   int i;
+
+   for (i = 0; i < MAX_PIDS; i++) {
+      if (this->p_pids_hot[i].i_packets)
+         i_bitrate += this->p_pids[i].info.i_bytes_per_sec * 8;
+   }
+   pm->family("cldvb_input_bitrate_bits", "gauge", "Input bitrate over the last second, all PIDs");
+   pm->metricsf("cldvb_input_bitrate_bits %"PRIu64"\n", i_bitrate);
+   pm->family("cldvb_input_packets", "counter", "TS packets read");
+   pm->metricsf("cldvb_input_packets_total %"PRIu64"\n", this->i_total_packets + this->i_nb_packets);
+   pm->family("cldvb_input_invalid_packets", "counter", "TS packets without sync byte");
+   pm->metricsf("cldvb_input_invalid_packets_total %"PRIu64"\n", this->i_total_invalids + this->i_nb_invalids);
+
+   pm->family("cldvb_pid_packets", "counter", "TS packets per PID");
+   for (i = 0; i < MAX_PIDS; i++) {
+      if (this->p_pids_hot[i].i_packets)
+         pm->metricsf("cldvb_pid_packets_total{pid=\"%d\"} %"PRIu64"\n", i, this->p_pids_hot[i].i_packets);
+   }
+   pm->family("cldvb_pid_bitrate_bits", "gauge", "PID bitrate over the last second");
+   for (i = 0; i < MAX_PIDS; i++) {
+      if (this->p_pids_hot[i].i_packets)
+         pm->metricsf("cldvb_pid_bitrate_bits{pid=\"%d\"} %lu\n", i, this->p_pids[i].info.i_bytes_per_sec * 8);
+   }
+   pm->family("cldvb_pid_cc_errors", "counter", "Continuity counter discontinuities per PID");
+   for (i = 0; i < MAX_PIDS; i++) {
+      if (this->p_pids_hot[i].i_packets)
+         pm->metricsf("cldvb_pid_cc_errors_total{pid=\"%d\"} %lu\n", i, this->p_pids[i].info.i_cc_errors);
+   }
+   pm->family("cldvb_pid_transport_errors", "counter", "Packets with transport_error_indicator per PID");
+   for (i = 0; i < MAX_PIDS; i++) {
+      if (this->p_pids_hot[i].i_packets)
+         pm->metricsf("cldvb_pid_transport_errors_total{pid=\"%d\"} %lu\n", i, this->p_pids[i].info.i_transport_errors);
+   }
+
+   /* display names come from the config file */
+   char **ppsz_labels = cLmalloc(char *, this->i_nb_outputs);
+   for (i = 0; i < this->i_nb_outputs; i++) {
+      const output_t *p_output = this->pp_outputs[i];
+      ppsz_labels[i] = (p_output->config.i_config & OUTPUT_VALID) ? cLdvbmetrics::label(p_output->config.psz_displayname) : (char *) 0;
+   }
+
+#define OUTPUT_FAMILY(name, type, help, fmt, value) \
+   pm->family(name, type, help); \
+   for (i = 0; i < this->i_nb_outputs; i++) { \
+      const output_t *p_output = this->pp_outputs[i]; \
+      if (ppsz_labels[i] != (char *) 0) \
+         pm->metricsf("%s%s{output=\"%s\",sid=\"%hu\"} " fmt "\n", name, strcmp(type, "counter") ? "" : "_total", ppsz_labels[i], p_output->config.i_sid, value); \
+   }
+   OUTPUT_FAMILY("cldvb_output_packets", "counter", "Datagrams sent", "%"PRIu64, p_output->i_stat_datagrams)
+   OUTPUT_FAMILY("cldvb_output_bytes", "counter", "TS bytes sent, without IP/UDP/RTP headers", "%"PRIu64, p_output->i_stat_bytes)
+   OUTPUT_FAMILY("cldvb_output_drops", "counter", "Blocks dropped before the output thread", "%"PRIu64, p_output->i_stat_drops)
+   OUTPUT_FAMILY("cldvb_output_send_errors", "counter", "Datagrams lost to send errors", "%"PRIu64, p_output->i_stat_send_errors)
+   OUTPUT_FAMILY("cldvb_output_queue_depth", "gauge", "Datagrams waiting to be sent", "%u", p_output->i_stat_queued)
+   OUTPUT_FAMILY("cldvb_output_queue_depth_max", "gauge", "Deepest queue since start", "%u", p_output->i_stat_queued_max)
+   OUTPUT_FAMILY("cldvb_output_late", "counter", "Datagrams sent past the output latency", "%"PRIu64, p_output->i_stat_late)
+   OUTPUT_FAMILY("cldvb_output_latency_seconds", "gauge", "Input to send delay of the last datagram", "%.6f", p_output->i_stat_latency / 1000000.)
+#undef OUTPUT_FAMILY
+
+   /* the histogram is only exposed at powers of two, which are bucket
+    * boundaries; the last bucket also holds the overflow, hence +Inf */
+   pm->family("cldvb_output_send_delay_seconds", "histogram", "Input to send delay");
+   for (i = 0; i < this->i_nb_outputs; i++) {
+      const output_t *p_output = this->pp_outputs[i];
+      uint64_t i_count = 0;
+      int i_bucket = 0;
+
+      if (ppsz_labels[i] == (char *) 0)
+         continue;
+      for (int i_bits = CLDVB_LATENCY_SUB_BITS; i_bits < CLDVB_LATENCY_MAX_BITS; i_bits++) {
+         for (; i_bucket < (i_bits - CLDVB_LATENCY_SUB_BITS + 1) << CLDVB_LATENCY_SUB_BITS; i_bucket++)
+            i_count += p_output->pi_stat_latency[i_bucket];
+         pm->metricsf("cldvb_output_send_delay_seconds_bucket{output=\"%s\",sid=\"%hu\",le=\"%.6f\"} %"PRIu64"\n", ppsz_labels[i], p_output->config.i_sid, (((mtime_t)1 << i_bits) - 1) / 1000000., i_count);
+      }
+      for (; i_bucket < CLDVB_LATENCY_BUCKETS; i_bucket++)
+         i_count += p_output->pi_stat_latency[i_bucket];
+      pm->metricsf("cldvb_output_send_delay_seconds_bucket{output=\"%s\",sid=\"%hu\",le=\"+Inf\"} %"PRIu64"\n", ppsz_labels[i], p_output->config.i_sid, i_count);
+      pm->metricsf("cldvb_output_send_delay_seconds_count{output=\"%s\",sid=\"%hu\"} %"PRIu64"\n", ppsz_labels[i], p_output->config.i_sid, i_count);
+      pm->metricsf("cldvb_output_send_delay_seconds_sum{output=\"%s\",sid=\"%hu\"} %.6f\n", ppsz_labels[i], p_output->config.i_sid, p_output->i_stat_latency_sum / 1000000.);
+   }
+   for (i = 0; i < this->i_nb_outputs; i++)
+      ::free(ppsz_labels[i]);
+   ::free(ppsz_labels);
+
+   pm->family("cldvb_blocks_allocated", "counter", "TS blocks handed out by the pool");
+   pm->metricsf("cldvb_blocks_allocated_total %"PRIu64"\n", this->block_stats.i_allocs);
+   pm->family("cldvb_blocks_pool_misses", "counter", "Block allocations that missed the pool");
+   pm->metricsf("cldvb_blocks_pool_misses_total %"PRIu64"\n", this->block_stats.i_misses);
+   pm->family("cldvb_blocks_pooled", "gauge", "Free blocks in the pool");
+   pm->metricsf("cldvb_blocks_pooled %u\n", this->block_stats.i_pooled);
+   pm->family("cldvb_blocks_inflight", "gauge", "Blocks referenced by the demux and the outputs");
+   pm->metricsf("cldvb_blocks_inflight %u\n", this->block_stats.i_inflight);
+   pm->family("cldvb_eit_memory_bytes", "gauge", "EIT store arenas and segments");
+   pm->metricsf("cldvb_eit_memory_bytes %zu\n", this->i_eit_memory);
+
+   this->en50221_Metrics(pm);
+   this->dev_Metrics(pm);
 }
 
 void cLdvbdemux::cLdvbdemux::PrintESCb(void *loop, void *p, int revents)
@@ -270,14 +588,22 @@ void cLdvbdemux::PrintES(uint16_t i_pid)
 void cLdvbdemux::demux_Open()
 {
    memset(this->p_pids, 0, sizeof(this->p_pids));
+   if (posix_memalign((void **)&this->p_pids_hot, CLDVB_CACHE_LINE, MAX_PIDS * sizeof(ts_pid_hot_t)))
+      this->p_pids_hot = cLmalloc(ts_pid_hot_t, MAX_PIDS);
+   memset(this->p_pids_hot, 0, MAX_PIDS * sizeof(ts_pid_hot_t));
+   this->p_section_prints = cLmalloc(section_print_t, 1 << CLDVB_SECTION_PRINT_BITS);
+   memset(this->p_section_prints, 0, sizeof(section_print_t) << CLDVB_SECTION_PRINT_BITS);
+   this->p_sid_index = cLmalloc(sid_index_t, CLDVB_SID_INDEX_SIZE);
+   memset(this->p_sid_index, 0, CLDVB_SID_INDEX_SIZE * sizeof(sid_index_t));
 
    this->dev_Open();
 
    for (int i = 0; i < MAX_PIDS; i++) {
-      this->p_pids[i].i_last_cc = -1;
+      this->p_pids_hot[i].i_last_cc = -1;
       this->p_pids[i].i_demux_fd = -1;
       psi_assemble_init(&this->p_pids[i].p_psi_buffer, &this->p_pids[i].i_psi_buffer_used);
       this->p_pids[i].i_pes_status = -1;
+      this->p_pids[i].i_pcr = -1;
    }
 
    if (this->b_budget_mode)
@@ -310,6 +636,8 @@ void cLdvbdemux::demux_Open()
 
    this->SetPID(TDT_PID);
 
+   cLbugf(cL::dbg_dvb, "ts scan: using %s\n", cLdvbtsscan::Implementation());
+
    if (this->i_print_period) {
       this->print_watcher.data = this;
       cLev_timer_init(&this->print_watcher, cLdvbdemux::PrintCb, this->i_print_period / 1000000., this->i_print_period / 1000000.);
@@ -319,6 +647,26 @@ void cLdvbdemux::demux_Open()
    if (this->psz_mrtg_file != (char *) 0)
       this->pmrtg->mrtgInit(this->psz_mrtg_file);
 
+   if (this->psz_stats_file != (const char *) 0) {
+      this->pstats = new cLdvbstats();
+      if (this->pstats->statsOpen(this->psz_stats_file, CLDVB_STATS_MAX_OUTPUTS)) {
+         this->stats_watcher.data = this;
+         cLev_timer_init(&this->stats_watcher, cLdvbdemux::StatsCb, CLDVB_STATS_PERIOD / 1000000., CLDVB_STATS_PERIOD / 1000000.);
+         cLev_timer_start(this->event_loop, &this->stats_watcher);
+      } else {
+         delete(this->pstats);
+         this->pstats = (cLdvbstats *) 0;
+      }
+   }
+
+   if (this->psz_metrics_addr != (const char *) 0) {
+      this->pmetrics = new cLdvbmetrics();
+      if (!this->pmetrics->metricsOpen(this->event_loop, this->psz_metrics_addr, cLdvbdemux::MetricsCb, this)) {
+         delete(this->pmetrics);
+         this->pmetrics = (cLdvbmetrics *) 0;
+      }
+   }
+
    if (this->i_priority > 0) {
       struct sched_param param;
       memset(&param, 0, sizeof(struct sched_param));
@@ -330,6 +678,7 @@ void cLdvbdemux::demux_Open()
    }
 
    this->config_ReadFile();
+   this->UpdatePassthrough();
 
    if (this->i_quit_timeout_duration) {
       quit_watcher.data = this;
@@ -343,6 +692,25 @@ void cLdvbdemux::demux_Open()
 void cLdvbdemux::demux_Close(void)
 {
    this->pmrtg->mrtgClose();
+   if (this->pstats != (cLdvbstats *) 0) {
+      cLev_timer_stop(this->event_loop, &this->stats_watcher);
+      delete(this->pstats);
+      this->pstats = (cLdvbstats *) 0;
+   }
+   delete(this->pmetrics);
+   this->pmetrics = (cLdvbmetrics *) 0;
+   if (this->b_config_parsing) {
+      pthread_join(this->config_thread, (void **) 0);
+      cLev_async_stop(this->event_loop, &this->config_watcher);
+      this->config_FileDelete(this->p_config_parsed);
+      this->p_config_parsed = (config_file_t *) 0;
+      this->b_config_parsing = false;
+   }
+   if (this->config_reload.p_file != (config_file_t *) 0) {
+      cLev_timer_stop(this->event_loop, &this->config_apply_watcher);
+      this->config_FileDelete(this->config_reload.p_file);
+      this->config_reload.p_file = (config_file_t *) 0;
+   }
    this->outputs_Close(this->i_nb_outputs);
 
    psi_table_free(this->pp_current_pat_sections);
@@ -363,13 +731,21 @@ void cLdvbdemux::demux_Close(void)
 
    for (i = 0; i < this->i_nb_sids; i++) {
       sid_t *p_sid = this->pp_sids[i];
-      for (int r = 0; r < MAX_EIT_TABLES; r++) {
-         psi_table_free(p_sid->eit_table[r].data);
-      }
+      this->eit_Clear(&p_sid->eit);
       ::free(p_sid->p_current_pmt);
       ::free(p_sid);
    }
    ::free(this->pp_sids);
+   ::free(this->p_sid_index);
+   this->p_sid_index = (sid_index_t *) 0;
+   ::free(this->pp_passthrough);
+   this->pp_passthrough = (output_t **) 0;
+   this->i_nb_passthrough = 0;
+   ::free(this->p_pids_hot);
+   this->p_pids_hot = (ts_pid_hot_t *) 0;
+   ::free(this->p_section_prints);
+   this->p_section_prints = (section_print_t *) 0;
+   this->i_nb_section_prints = 0;
 
    if (this->i_print_period)
       cLev_timer_stop(this->event_loop, &this->print_watcher);
@@ -380,27 +756,51 @@ void cLdvbdemux::demux_Close(void)
 void cLdvbdemux::demux_Run(block_t *p_ts)
 {
    this->i_wallclock = this->mdate();
-   this->pmrtg->mrtgAnalyse(p_ts);
+   this->outputs_Reclaim();
    this->SetDTS(p_ts);
 
+   uint64_t i_start = this->ndate();
    while (p_ts != (block_t *) 0) {
-      block_t *p_next = p_ts->p_next;
-      p_ts->p_next = NULL;
-      this->demux_Handle(p_ts);
-      p_ts = p_next;
+      block_t *pp_blocks[CLDVB_TS_SCAN_BATCH];
+      uint8_t *pp_ts[CLDVB_TS_SCAN_BATCH];
+      cLdvbtsscan::ts_header_t p_hdrs[CLDVB_TS_SCAN_BATCH];
+      int i_nb = 0;
+
+      while (p_ts != (block_t *) 0 && i_nb < CLDVB_TS_SCAN_BATCH) {
+         pp_blocks[i_nb] = p_ts;
+         pp_ts[i_nb++] = p_ts->p_ts;
+         p_ts = p_ts->p_next;
+      }
+
+      /* decode all headers at once, shared by MRTG and the demux */
+      uint64_t i_scan = this->ndate();
+      cLdvbtsscan::Decode(pp_ts, p_hdrs, i_nb);
+      this->pmrtg->mrtgAnalyse(p_hdrs, i_nb);
+      this->i_scan_ns += this->ndate() - i_scan;
+
+      for (int i = 0; i < i_nb; i++) {
+         pp_blocks[i]->p_next = NULL;
+         this->demux_Handle(pp_blocks[i], &p_hdrs[i]);
+      }
+      this->i_demux_packets += i_nb;
    }
+   this->i_demux_ns += this->ndate() - i_start;
+   /* one wakeup per output thread for the whole chain */
+   this->outputs_Publish();
 }
 
-void cLdvbdemux::demux_Handle(block_t *p_ts)
+void cLdvbdemux::demux_Handle(block_t *p_ts, const cLdvbtsscan::ts_header_t *p_hdr)
 {
-   uint16_t i_pid = ts_get_pid(p_ts->p_ts);
+   uint16_t i_pid = p_hdr->i_pid;
    ts_pid_t *p_pid = &this->p_pids[i_pid];
-   uint8_t i_cc = ts_get_cc(p_ts->p_ts);
+   ts_pid_hot_t *p_hot = &this->p_pids_hot[i_pid];
+   uint8_t i_cc = p_hdr->i_cc;
+   uint8_t i_flags = p_hdr->i_flags;
    int i;
 
    this->i_nb_packets++;
 
-   if (!ts_validate(p_ts->p_ts)) {
+   if (!(i_flags & TS_HDR_SYNC)) {
       cLbug(cL::dbg_dvb, "lost TS sync\n");
       this->block_Delete(p_ts);
       this->i_nb_invalids++;
@@ -408,28 +808,25 @@ void cLdvbdemux::demux_Handle(block_t *p_ts)
    }
 
    if (i_pid != PADDING_PID)
-      p_pid->info.i_scrambling = ts_get_scrambling(p_ts->p_ts);
+      p_hot->i_scrambling = TS_HDR_SCRAMBLING(i_flags);
 
-   p_pid->info.i_last_packet_ts = this->i_wallclock;
-   p_pid->info.i_packets++;
-
-   p_pid->i_packets_passed++;
+   if (!p_hot->i_packets++)
+      p_pid->info.i_first_packet_ts = this->i_wallclock;
+   p_hot->i_last_packet_ts = this->i_wallclock;
+   p_hot->i_packets_passed++;
 
    /* Calculate bytes_per_sec */
-   if (this->i_wallclock > p_pid->i_bytes_ts + 1000000) {
-      p_pid->info.i_bytes_per_sec = p_pid->i_packets_passed * TS_SIZE;
-      p_pid->i_packets_passed = 0;
-      p_pid->i_bytes_ts = this->i_wallclock;
+   if (this->i_wallclock > p_hot->i_bytes_ts + 1000000) {
+      p_pid->info.i_bytes_per_sec = p_hot->i_packets_passed * TS_SIZE;
+      p_hot->i_packets_passed = 0;
+      p_hot->i_bytes_ts = this->i_wallclock;
    }
 
-   if (p_pid->info.i_first_packet_ts == 0)
-      p_pid->info.i_first_packet_ts = this->i_wallclock;
-
-   if (i_pid != PADDING_PID && p_pid->i_last_cc != -1
-         && !ts_check_duplicate(i_cc, p_pid->i_last_cc)
-         && ts_check_discontinuity(i_cc, p_pid->i_last_cc))
+   if (i_pid != PADDING_PID && p_hot->i_last_cc != -1
+         && !ts_check_duplicate(i_cc, p_hot->i_last_cc)
+         && ts_check_discontinuity(i_cc, p_hot->i_last_cc))
    {
-      unsigned int expected_cc = (p_pid->i_last_cc + 1) & 0x0f;
+      unsigned int expected_cc = (p_hot->i_last_cc + 1) & 0x0f;
       uint16_t i_sid = 0;
       const char *pid_desc = this->get_pid_desc(i_pid, &i_sid);
 
@@ -439,7 +836,7 @@ void cLdvbdemux::demux_Handle(block_t *p_ts)
       cLbugf(cL::dbg_dvb, "TS discontinuity on pid %4hu expected_cc %2u got %2u (%s, sid %d)\n", i_pid, expected_cc, i_cc, pid_desc, i_sid);
    }
 
-   if (ts_get_transporterror(p_ts->p_ts)) {
+   if (i_flags & TS_HDR_TRANSPORTERROR) {
       uint16_t i_sid = 0;
       const char *pid_desc = this->get_pid_desc(i_pid, &i_sid);
 
@@ -463,10 +860,10 @@ void cLdvbdemux::demux_Handle(block_t *p_ts)
 
    if (this->i_es_timeout) {
       int i_pes_status = -1;
-      if (ts_get_scrambling(p_ts->p_ts)) {
+      if (TS_HDR_SCRAMBLING(i_flags)) {
          i_pes_status = 0;
       } else
-      if (ts_get_unitstart(p_ts->p_ts)) {
+      if (i_flags & TS_HDR_UNITSTART) {
          uint8_t *p_payload = ts_payload(p_ts->p_ts);
          if (p_payload + 3 < p_ts->p_ts + TS_SIZE)
             i_pes_status = pes_validate(p_payload) ? 1 : 0;
@@ -496,7 +893,7 @@ void cLdvbdemux::demux_Handle(block_t *p_ts)
       }
    }
 
-   if (!ts_get_transporterror(p_ts->p_ts)) {
+   if (!(i_flags & TS_HDR_TRANSPORTERROR)) {
       /* PSI parsing */
       if (i_pid == TDT_PID || i_pid == RST_PID) {
          this->SendTDT(p_ts);
@@ -513,56 +910,44 @@ void cLdvbdemux::demux_Handle(block_t *p_ts)
          this->SendEMM(p_ts);
    }
 
-   p_pid->i_last_cc = i_cc;
+   p_hot->i_last_cc = i_cc;
 
    /* Output */
    for (i = 0; i < p_pid->i_nb_outputs; i++) {
       output_t *p_output = p_pid->pp_outputs[i];
-      if (p_output != (output_t *) 0) {
-         if (this->i_ca_handle && (p_output->config.i_config & OUTPUT_WATCH) && ts_get_unitstart(p_ts->p_ts)) {
-            uint8_t *p_payload;
-            if (ts_get_scrambling(p_ts->p_ts) || (p_pid->b_pes && (p_payload = ts_payload(p_ts->p_ts)) + 3 < p_ts->p_ts + TS_SIZE && !pes_validate(p_payload))) {
-               if (this->i_wallclock > this->i_last_reset + WATCHDOG_REFRACTORY_PERIOD) {
-                  p_output->i_nb_errors++;
-                  p_output->i_last_error = this->i_wallclock;
-               }
-            } else
-            if (this->i_wallclock > p_output->i_last_error + WATCHDOG_WAIT) {
-               p_output->i_nb_errors = 0;
-            }
-
-            if (p_output->i_nb_errors > MAX_ERRORS) {
-               for (int j = 0; j < this->i_nb_outputs; j++)
-                  this->pp_outputs[j]->i_nb_errors = 0;
-
-               cLbugf(cL::dbg_dvb, "too many errors for stream %s, resetting\n", p_output->config.psz_displayname);
-               this->i_last_reset = this->i_wallclock;
-               this->en50221_Reset();
+      if (this->i_ca_handle && (p_output->config.i_config & OUTPUT_WATCH) && (i_flags & TS_HDR_UNITSTART)) {
+         uint8_t *p_payload;
+         if (TS_HDR_SCRAMBLING(i_flags) || (p_pid->b_pes && (p_payload = ts_payload(p_ts->p_ts)) + 3 < p_ts->p_ts + TS_SIZE && !pes_validate(p_payload))) {
+            if (this->i_wallclock > this->i_last_reset + WATCHDOG_REFRACTORY_PERIOD) {
+               p_output->i_nb_errors++;
+               p_output->i_last_error = this->i_wallclock;
             }
+         } else
+         if (this->i_wallclock > p_output->i_last_error + WATCHDOG_WAIT) {
+            p_output->i_nb_errors = 0;
          }
 
-         if (p_output->i_pcr_pid != i_pid || (ts_has_adaptation(p_ts->p_ts) && ts_get_adaptation(p_ts->p_ts) && tsaf_has_pcr(p_ts->p_ts)))
-            output_Put(p_output, p_ts);
+         if (p_output->i_nb_errors > MAX_ERRORS) {
+            for (int j = 0; j < this->i_nb_outputs; j++)
+               this->pp_outputs[j]->i_nb_errors = 0;
 
-         if (p_output->p_eit_ts_buffer != (block_t *) 0 && p_ts->i_dts > p_output->p_eit_ts_buffer->i_dts + MAX_EIT_RETENTION)
-            this->FlushEIT(p_output, p_ts->i_dts);
+            cLbugf(cL::dbg_dvb, "too many errors for stream %s, resetting\n", p_output->config.psz_displayname);
+            this->i_last_reset = this->i_wallclock;
+            this->en50221_Reset();
+         }
       }
-   }
 
-   for (i = 0; i < this->i_nb_outputs; i++) {
-      output_t *p_output = this->pp_outputs[i];
-
-      if (!(p_output->config.i_config & OUTPUT_VALID) || !p_output->config.b_passthrough)
-         continue;
+      if (p_output->i_pcr_pid != i_pid || (ts_has_adaptation(p_ts->p_ts) && ts_get_adaptation(p_ts->p_ts) && tsaf_has_pcr(p_ts->p_ts)))
+         output_Put(p_output, p_ts);
 
-      this->output_Put(p_output, p_ts);
+      if (p_output->p_eit_ts_buffer != (block_t *) 0 && p_ts->i_dts > p_output->p_eit_ts_buffer->i_dts + MAX_EIT_RETENTION)
+         this->FlushEIT(p_output, p_ts->i_dts);
    }
 
-   if (this->output_dup->config.i_config & OUTPUT_VALID)
-      this->output_Put(this->output_dup, p_ts);
+   for (i = 0; i < this->i_nb_passthrough; i++)
+      this->output_Put(this->pp_passthrough[i], p_ts);
 
-   p_ts->i_refcount--;
-   if (!p_ts->i_refcount)
+   if (!__sync_sub_and_fetch(&p_ts->i_refcount, 1))
       this->block_Delete(p_ts);
 }
 
@@ -639,7 +1024,7 @@ void cLdvbdemux::demux_Change(output_t *p_output, const output_config_t *p_confi
 
    if (b_sid_change && i_old_sid) {
       sid_t *p_old_sid = this->FindSID(i_old_sid);
-      p_output->config.i_sid = p_config->i_sid;
+      this->output_SetSID(p_output, p_config->i_sid);
 
       if (p_old_sid != (sid_t *) 0) {
          if (i_sid != i_old_sid)
@@ -676,7 +1061,7 @@ void cLdvbdemux::demux_Change(output_t *p_output, const output_config_t *p_confi
 
    if (b_sid_change && i_sid) {
       sid_t *p_sid = this->FindSID(i_sid);
-      p_output->config.i_sid = i_old_sid;
+      this->output_SetSID(p_output, i_old_sid);
 
       if (p_sid != (sid_t *) 0) {
          if (i_sid != i_old_sid)
@@ -694,7 +1079,7 @@ void cLdvbdemux::demux_Change(output_t *p_output, const output_config_t *p_confi
    }
 
    p_output->config.b_passthrough = p_config->b_passthrough;
-   p_output->config.i_sid = i_sid;
+   this->output_SetSID(p_output, i_sid);
    ::free(p_output->config.pi_pids);
    p_output->config.pi_pids = cLmalloc(uint16_t, i_nb_pids);
    memcpy(p_output->config.pi_pids, pi_pids, sizeof(uint16_t) * i_nb_pids);
@@ -737,12 +1122,97 @@ void cLdvbdemux::demux_Change(output_t *p_output, const output_config_t *p_confi
    }
 }
 
+/* PCR timing: packets are dated from the PCR clock of a reference PID,
+ * extrapolated at the bitrate measured between its PCRs. Returns false
+ * until a reference is locked. */
+bool cLdvbdemux::SetDTS_PCR(block_t *p_list)
+{
+   uint64_t i_first = this->i_pcr_pos;
+   block_t *p_ts;
+
+   if (this->i_pcr_ref_pid != UNUSED_PID && this->i_wallclock > this->i_pcr_ref_date + 1000000) {
+      cLbugf(cL::dbg_dvb, "no PCR on PID %hu for 1 s, unlocking\n", this->i_pcr_ref_pid);
+      this->i_pcr_ref_pid = UNUSED_PID;
+   }
+
+   for (p_ts = p_list; p_ts != (block_t *) 0; p_ts = p_ts->p_next, this->i_pcr_pos++) {
+      uint8_t *p = p_ts->p_ts;
+      if (p[0] != 0x47 || !ts_has_adaptation(p) || !ts_get_adaptation(p) || !tsaf_has_pcr(p))
+         continue;
+
+      uint16_t i_pid = ts_get_pid(p);
+      ts_pid_t *p_pid = &this->p_pids[i_pid];
+      int64_t i_pcr = (int64_t)tsaf_get_pcr(p) * 300 + tsaf_get_pcrext(p);
+      int64_t i_delta = (i_pcr - p_pid->i_pcr + CLDVB_PCR_WRAP) % CLDVB_PCR_WRAP;
+      uint64_t i_packets = this->i_pcr_pos - p_pid->i_pcr_pos;
+      bool b_valid = p_pid->i_pcr != -1 && i_delta > 0 && i_delta < CLDVB_PCR_MAX_GAP && i_packets && !tsaf_has_discontinuity(p);
+
+      p_pid->i_pcr = i_pcr;
+      p_pid->i_pcr_pos = this->i_pcr_pos;
+
+      if (i_pid != this->i_pcr_ref_pid) {
+         if (this->i_pcr_ref_pid != UNUSED_PID || !b_valid)
+            continue;
+         /* lock on the first PID giving a usable pair of PCRs */
+         cLbugf(cL::dbg_dvb, "pcr timing: locked on PID %hu\n", i_pid);
+         this->i_pcr_ref_pid = i_pid;
+         this->i_pcr_ref = 0;
+         this->i_pcr_ref_pos = this->i_pcr_pos;
+         this->i_pcr_rate = (i_delta << 16) / i_packets;
+         this->i_pcr_ref_date = this->i_wallclock;
+         this->i_pcr_offset = this->i_pcr_lock_offset = this->i_wallclock;
+         this->i_pcr_lock_date = this->i_wallclock;
+         continue;
+      }
+
+      if (!b_valid) {
+         cLbugf(cL::dbg_dvb, "pcr timing: discontinuity on PID %hu\n", i_pid);
+         this->i_pcr_ref_pid = UNUSED_PID;
+         continue;
+      }
+      this->i_pcr_ref += i_delta;
+      this->i_pcr_ref_pos = this->i_pcr_pos;
+      this->i_pcr_ref_date = this->i_wallclock;
+      this->i_pcr_rate += ((i_delta << 16) / (int64_t)i_packets - this->i_pcr_rate) / 8;
+   }
+
+   if (this->i_pcr_ref_pid == UNUSED_PID || p_list == (block_t *) 0)
+      return false;
+
+   /* The last packet arrived at i_wallclock and a packet can't arrive
+    * before its PCR date: follow the smallest offset at once, and leak
+    * upwards slowly to absorb the drift between the two clocks. */
+   int64_t i_last = this->i_pcr_ref + (((int64_t)(this->i_pcr_pos - 1 - this->i_pcr_ref_pos) * this->i_pcr_rate) >> 16);
+   mtime_t i_offset = this->i_wallclock - i_last / 27;
+   if (i_offset < this->i_pcr_offset)
+      this->i_pcr_offset = i_offset;
+   else
+      this->i_pcr_offset += (i_offset - this->i_pcr_offset) / 256;
+
+   uint64_t i_pos = i_first;
+   for (p_ts = p_list; p_ts != (block_t *) 0; p_ts = p_ts->p_next, i_pos++) {
+      int64_t i_ticks = this->i_pcr_ref + (((int64_t)(i_pos - this->i_pcr_ref_pos) * this->i_pcr_rate) >> 16);
+      mtime_t i_dts = i_ticks / 27 + this->i_pcr_offset;
+      if (i_dts > this->i_wallclock)
+         i_dts = this->i_wallclock;
+      if (i_dts < this->i_pcr_last_dts)
+         i_dts = this->i_pcr_last_dts;
+      p_ts->i_dts = this->i_pcr_last_dts = i_dts;
+   }
+
+   this->i_last_dts = this->i_wallclock;
+   return true;
+}
+
 void cLdvbdemux::SetDTS(block_t *p_list)
 {
    int i_nb_ts = 0, i;
    mtime_t i_duration;
    block_t *p_ts = p_list;
 
+   if (this->b_pcr_timing && this->SetDTS_PCR(p_list))
+      return;
+
    while (p_ts != (block_t *) 0) {
       i_nb_ts++;
       p_ts = p_ts->p_next;
@@ -794,67 +1264,71 @@ void cLdvbdemux::UnsetPID(uint16_t i_pid)
 
 void cLdvbdemux::StartPID(output_t *p_output, uint16_t i_pid)
 {
+   ts_pid_t *p_pid = &this->p_pids[i_pid];
    int j;
 
-   for (j = 0; j < this->p_pids[i_pid].i_nb_outputs; j++)
-      if (this->p_pids[i_pid].pp_outputs[j] == p_output)
-         break;
-
-   if (j == this->p_pids[i_pid].i_nb_outputs) {
-      for (j = 0; j < this->p_pids[i_pid].i_nb_outputs; j++) {
-         if (this->p_pids[i_pid].pp_outputs[j] == (output_t *) 0)
-            break;
-      }
-
-      if (j == this->p_pids[i_pid].i_nb_outputs) {
-         this->p_pids[i_pid].i_nb_outputs++;
-         this->p_pids[i_pid].pp_outputs = (output_t **)realloc(this->p_pids[i_pid].pp_outputs, sizeof(output_t *) * this->p_pids[i_pid].i_nb_outputs);
-      }
+   for (j = 0; j < p_pid->i_nb_outputs; j++)
+      if (p_pid->pp_outputs[j] == p_output)
+         return;
 
-      this->p_pids[i_pid].pp_outputs[j] = p_output;
-      this->SetPID(i_pid);
-   }
+   p_pid->pp_outputs = (output_t **)realloc(p_pid->pp_outputs, sizeof(output_t *) * (p_pid->i_nb_outputs + 1));
+   p_pid->pp_outputs[p_pid->i_nb_outputs++] = p_output;
+   this->SetPID(i_pid);
 }
 
 void cLdvbdemux::StopPID(output_t *p_output, uint16_t i_pid)
 {
+   ts_pid_t *p_pid = &this->p_pids[i_pid];
    int j;
 
-   for (j = 0; j < this->p_pids[i_pid].i_nb_outputs; j++) {
-      if (this->p_pids[i_pid].pp_outputs[j] != (output_t *) 0) {
-         if (this->p_pids[i_pid].pp_outputs[j] == p_output)
-            break;
-      }
-   }
+   for (j = 0; j < p_pid->i_nb_outputs; j++)
+      if (p_pid->pp_outputs[j] == p_output)
+         break;
 
-   if (j != this->p_pids[i_pid].i_nb_outputs) {
-      this->p_pids[i_pid].pp_outputs[j] = (output_t *) 0;
+   if (j != p_pid->i_nb_outputs) {
+      /* keep the dispatch table compact, order doesn't matter */
+      p_pid->pp_outputs[j] = p_pid->pp_outputs[--p_pid->i_nb_outputs];
       this->UnsetPID(i_pid);
    }
 }
 
-void cLdvbdemux::SelectPID(uint16_t i_sid, uint16_t i_pid, bool b_pcr)
+/* rebuild the list of outputs fed with every packet */
+void cLdvbdemux::UpdatePassthrough(void)
 {
+   this->i_nb_passthrough = 0;
+   this->pp_passthrough = (output_t **)realloc(this->pp_passthrough, sizeof(output_t *) * (this->i_nb_outputs + 1));
+
    for (int i = 0; i < this->i_nb_outputs; i++) {
-      if ((this->pp_outputs[i]->config.i_config & OUTPUT_VALID) && pp_outputs[i]->config.i_sid == i_sid) {
+      output_t *p_output = this->pp_outputs[i];
+      if ((p_output->config.i_config & OUTPUT_VALID) && p_output->config.b_passthrough)
+         this->pp_passthrough[this->i_nb_passthrough++] = p_output;
+   }
+   if (this->output_dup->config.i_config & OUTPUT_VALID)
+      this->pp_passthrough[this->i_nb_passthrough++] = this->output_dup;
+}
 
-         if (pp_outputs[i]->config.i_nb_pids && !this->IsIn(pp_outputs[i]->config.pi_pids, pp_outputs[i]->config.i_nb_pids, i_pid)) {
+void cLdvbdemux::SelectPID(uint16_t i_sid, uint16_t i_pid, bool b_pcr)
+{
+   for (output_t *p_output = this->p_sid_index[i_sid].p_outputs; p_output != (output_t *) 0; p_output = p_output->p_sid_next) {
+      if (p_output->config.i_config & OUTPUT_VALID) {
+
+         if (p_output->config.i_nb_pids && !this->IsIn(p_output->config.pi_pids, p_output->config.i_nb_pids, i_pid)) {
             if (b_pcr) {
-               pp_outputs[i]->i_pcr_pid = i_pid;
+               p_output->i_pcr_pid = i_pid;
             } else {
                continue;
             }
          }
-         this->StartPID(this->pp_outputs[i], i_pid);
+         this->StartPID(p_output, i_pid);
       }
    }
 }
 
 void cLdvbdemux::UnselectPID(uint16_t i_sid, uint16_t i_pid)
 {
-   for (int i = 0; i < this->i_nb_outputs; i++) {
-      if ((this->pp_outputs[i]->config.i_config & OUTPUT_VALID) && this->pp_outputs[i]->config.i_sid == i_sid && !this->pp_outputs[i]->config.i_nb_pids)
-         this->StopPID(this->pp_outputs[i], i_pid);
+   for (output_t *p_output = this->p_sid_index[i_sid].p_outputs; p_output != (output_t *) 0; p_output = p_output->p_sid_next) {
+      if ((p_output->config.i_config & OUTPUT_VALID) && !p_output->config.i_nb_pids)
+         this->StopPID(p_output, i_pid);
    }
 }
 
@@ -866,8 +1340,8 @@ void cLdvbdemux::SelectPMT(uint16_t i_sid, uint16_t i_pid)
    if (this->b_select_pmts) {
       this->SetPID(i_pid);
    } else {
-      for (int i = 0; i < this->i_nb_outputs; i++) {
-         if ((this->pp_outputs[i]->config.i_config & OUTPUT_VALID) && this->pp_outputs[i]->config.i_sid == i_sid)
+      for (output_t *p_output = this->p_sid_index[i_sid].p_outputs; p_output != (output_t *) 0; p_output = p_output->p_sid_next) {
+         if (p_output->config.i_config & OUTPUT_VALID)
             this->SetPID(i_pid);
       }
    }
@@ -882,8 +1356,8 @@ void cLdvbdemux::UnselectPMT(uint16_t i_sid, uint16_t i_pid)
    if (this->b_select_pmts) {
       this->UnsetPID(i_pid);
    } else {
-      for (int i = 0; i < this->i_nb_outputs; i++) {
-         if ((this->pp_outputs[i]->config.i_config & OUTPUT_VALID) && this->pp_outputs[i]->config.i_sid == i_sid)
+      for (output_t *p_output = this->p_sid_index[i_sid].p_outputs; p_output != (output_t *) 0; p_output = p_output->p_sid_next) {
+         if (p_output->config.i_config & OUTPUT_VALID)
             this->UnsetPID(i_pid);
       }
    }
@@ -1018,6 +1492,25 @@ void cLdvbdemux::OutputPSISection(output_t *p_output, uint8_t *p_section, uint16
    } while (i_section_offset < i_section_length);
 }
 
+/* copy the ready-made packets of a section, only the CC is patched */
+void cLdvbdemux::OutputPSICache(output_t *p_output, psi_cache_t *p_cache, uint16_t i_pid, uint8_t *pi_cc, mtime_t i_dts)
+{
+   int i_nb_packets;
+   const uint8_t *p_packets = this->psi_CachePackets(p_cache, i_pid, &i_nb_packets);
+
+   for (int i = 0; i < i_nb_packets; i++) {
+      block_t *p_block = this->block_New();
+      memcpy(p_block->p_ts, p_packets + i * TS_SIZE, TS_SIZE);
+      ts_set_cc(p_block->p_ts, *pi_cc);
+      (*pi_cc)++;
+      *pi_cc &= 0xf;
+
+      p_block->i_dts = i_dts;
+      p_block->i_refcount--;
+      this->output_Put(p_output, p_block);
+   }
+}
+
 void cLdvbdemux::SendPAT(mtime_t i_dts)
 {
    for (int i = 0; i < this->i_nb_outputs; i++) {
@@ -1038,11 +1531,12 @@ void cLdvbdemux::SendPAT(mtime_t i_dts)
          psi_set_current(p);
          psi_set_section(p, 0);
          psi_set_lastsection(p, 0);
-         psi_set_crc(p_output->p_pat_section);
+         cLdvbcrc::SetCRC(p_output->p_pat_section);
+         p_output->p_pat_cache = this->psi_CachePut(p, PSI_CACHE_PAT, 0, (const uint8_t *) 0, 0);
       }
 
-      if (p_output->p_pat_section != (uint8_t *) 0)
-         this->OutputPSISection(p_output, p_output->p_pat_section, PAT_PID, &p_output->i_pat_cc, i_dts, (block_t **) 0, (uint8_t *) 0);
+      if (p_output->p_pat_cache != (psi_cache_t *) 0)
+         this->OutputPSICache(p_output, p_output->p_pat_cache, PAT_PID, &p_output->i_pat_cc, i_dts);
    }
 }
 
@@ -1053,13 +1547,11 @@ void cLdvbdemux::SendPMT(sid_t *p_sid, mtime_t i_dts)
    if (this->b_do_remap)
       i_pmt_pid = this->pi_newpids[ cLdvbdemux::I_PMTPID ];
 
-   for (int i = 0; i < this->i_nb_outputs; i++) {
-      output_t *p_output = this->pp_outputs[i];
-
-      if ((p_output->config.i_config & OUTPUT_VALID) && p_output->config.i_sid == p_sid->i_sid && p_output->p_pmt_section != (uint8_t *) 0) {
+   for (output_t *p_output = this->p_sid_index[p_sid->i_sid].p_outputs; p_output != (output_t *) 0; p_output = p_output->p_sid_next) {
+      if ((p_output->config.i_config & OUTPUT_VALID) && p_output->p_pmt_cache != (psi_cache_t *) 0) {
          if (p_output->config.b_do_remap && p_output->config.pi_confpids[cLdvbdemux::I_PMTPID])
             i_pmt_pid = p_output->config.pi_confpids[cLdvbdemux::I_PMTPID];
-         this->OutputPSISection(p_output, p_output->p_pmt_section, i_pmt_pid, &p_output->i_pmt_cc, i_dts, (block_t **) 0, (uint8_t *) 0);
+         this->OutputPSICache(p_output, p_output->p_pmt_cache, i_pmt_pid, &p_output->i_pmt_cc, i_dts);
       }
    }
 }
@@ -1069,8 +1561,8 @@ void cLdvbdemux::SendNIT(mtime_t i_dts)
    for (int i = 0; i < this->i_nb_outputs; i++) {
       output_t *p_output = this->pp_outputs[i];
 
-      if ((p_output->config.i_config & OUTPUT_VALID) && !p_output->config.b_passthrough && (p_output->config.i_config & OUTPUT_DVB) && p_output->p_nit_section != (uint8_t *) 0)
-         this->OutputPSISection(p_output, p_output->p_nit_section, NIT_PID, &p_output->i_nit_cc, i_dts, (block_t **) 0, (uint8_t *) 0);
+      if ((p_output->config.i_config & OUTPUT_VALID) && !p_output->config.b_passthrough && (p_output->config.i_config & OUTPUT_DVB) && p_output->p_nit_cache != (psi_cache_t *) 0)
+         this->OutputPSICache(p_output, p_output->p_nit_cache, NIT_PID, &p_output->i_nit_cc, i_dts);
    }
 }
 
@@ -1079,8 +1571,8 @@ void cLdvbdemux::SendSDT(mtime_t i_dts)
    for (int i = 0; i < this->i_nb_outputs; i++) {
       output_t *p_output = this->pp_outputs[i];
 
-      if ((p_output->config.i_config & OUTPUT_VALID) && !p_output->config.b_passthrough && (p_output->config.i_config & OUTPUT_DVB) && p_output->p_sdt_section != NULL)
-         this->OutputPSISection(p_output, p_output->p_sdt_section, SDT_PID, &p_output->i_sdt_cc, i_dts, (block_t **) 0, (uint8_t *) 0);
+      if ((p_output->config.i_config & OUTPUT_VALID) && !p_output->config.b_passthrough && (p_output->config.i_config & OUTPUT_DVB) && p_output->p_sdt_cache != (psi_cache_t *) 0)
+         this->OutputPSICache(p_output, p_output->p_sdt_cache, SDT_PID, &p_output->i_sdt_cc, i_dts);
    }
 }
 
@@ -1095,10 +1587,8 @@ void cLdvbdemux::SendEIT(sid_t *p_sid, mtime_t i_dts, uint8_t *p_eit)
    bool b_epg = handle_epg(i_table_id);
    uint16_t i_onid = eit_get_onid(p_eit);
 
-   for (int i = 0; i < this->i_nb_outputs; i++) {
-      output_t *p_output = this->pp_outputs[i];
-
-      if ((p_output->config.i_config & OUTPUT_VALID) && !p_output->config.b_passthrough && (p_output->config.i_config & OUTPUT_DVB) && (!b_epg || (p_output->config.i_config & OUTPUT_EPG)) && p_output->config.i_sid == p_sid->i_sid) {
+   for (output_t *p_output = this->p_sid_index[p_sid->i_sid].p_outputs; p_output != (output_t *) 0; p_output = p_output->p_sid_next) {
+      if ((p_output->config.i_config & OUTPUT_VALID) && !p_output->config.b_passthrough && (p_output->config.i_config & OUTPUT_DVB) && (!b_epg || (p_output->config.i_config & OUTPUT_EPG))) {
          eit_set_tsid(p_eit, p_output->i_tsid);
 
          if (p_output->config.i_new_sid) {
@@ -1110,7 +1600,7 @@ void cLdvbdemux::SendEIT(sid_t *p_sid, mtime_t i_dts, uint8_t *p_eit)
          if (p_output->config.i_onid)
              eit_set_onid(p_eit, p_output->config.i_onid);
 
-         psi_set_crc(p_eit);
+         cLdvbcrc::SetCRC(p_eit);
 
         this->OutputPSISection(p_output, p_eit, EIT_PID, &p_output->i_eit_cc, i_dts, &p_output->p_eit_ts_buffer, &p_output->i_eit_ts_buffer_offset);
 
@@ -1155,13 +1645,65 @@ void cLdvbdemux::SendEMM(block_t *p_ts)
    }
 }
 
+/* Serialize what a generated section depends on in the output config,
+ * outputs with the same key share the section. Returns 0 when the
+ * section must stay private (PID remapping keeps per-output state). */
+unsigned int cLdvbdemux::psi_Key(int i_kind, output_t *p_output, uint8_t *p_key)
+{
+   output_config_t *p_config = &p_output->config;
+   unsigned int i = 0;
+
+   if (this->b_do_remap || p_config->b_do_remap)
+      return 0;
+
+#define KEY_PUT(p_data, i_size) \
+   do { \
+      if (i + (i_size) > CLDVB_PSI_KEY_MAX) \
+         return 0; \
+      memcpy(p_key + i, p_data, i_size); \
+      i += (i_size); \
+   } while (0)
+
+   KEY_PUT(&p_config->i_sid, sizeof(p_config->i_sid));
+   KEY_PUT(&p_config->i_new_sid, sizeof(p_config->i_new_sid));
+   switch (i_kind) {
+      case PSI_CACHE_PAT: {
+         bool b_dvb = (p_config->i_config & OUTPUT_DVB) != 0;
+         KEY_PUT(&b_dvb, sizeof(b_dvb));
+         KEY_PUT(&p_output->i_tsid, sizeof(p_output->i_tsid));
+         break;
+      }
+      case PSI_CACHE_PMT:
+         KEY_PUT(&p_config->i_nb_pids, sizeof(p_config->i_nb_pids));
+         KEY_PUT(p_config->pi_pids, p_config->i_nb_pids * sizeof(uint16_t));
+         break;
+      case PSI_CACHE_SDT: {
+         bool b_epg = (p_config->i_config & OUTPUT_EPG) == OUTPUT_EPG;
+         KEY_PUT(&b_epg, sizeof(b_epg));
+         KEY_PUT(&p_output->i_tsid, sizeof(p_output->i_tsid));
+         KEY_PUT(&p_config->i_onid, sizeof(p_config->i_onid));
+         KEY_PUT(&p_config->provider_name.i, sizeof(p_config->provider_name.i));
+         KEY_PUT(p_config->provider_name.p, p_config->provider_name.i);
+         KEY_PUT(&p_config->service_name.i, sizeof(p_config->service_name.i));
+         KEY_PUT(p_config->service_name.p, p_config->service_name.i);
+         break;
+      }
+   }
+#undef KEY_PUT
+   return i;
+}
+
 void cLdvbdemux::NewPAT(output_t *p_output)
 {
    const uint8_t *p_program;
    uint8_t *p;
    uint8_t k = 0;
+   uint8_t p_key[CLDVB_PSI_KEY_MAX];
+   unsigned int i_key;
+   psi_cache_t *p_cache;
 
-   ::free(p_output->p_pat_section);
+   this->psi_CacheRelease(p_output->p_pat_cache);
+   p_output->p_pat_cache = (psi_cache_t *) 0;
    p_output->p_pat_section = NULL;
    p_output->i_pat_version++;
 
@@ -1174,6 +1716,20 @@ void cLdvbdemux::NewPAT(output_t *p_output)
    if (p_program == (const uint8_t *) 0)
       return;
 
+   /* share the section of an identical output, unless its version is
+    * the one this output sent last */
+   i_key = this->psi_Key(PSI_CACHE_PAT, p_output, p_key);
+   if (i_key && (p_cache = this->psi_CacheGet(PSI_CACHE_PAT, this->pi_psi_generation[PSI_CACHE_PAT], p_key, i_key)) != (psi_cache_t *) 0) {
+      if (psi_get_version(p_cache->p_section) != ((p_output->i_pat_version - 1) & 0x1f)) {
+         p_output->p_pat_cache = p_cache;
+         p_output->p_pat_section = p_cache->p_section;
+         p_output->i_pat_version = psi_get_version(p_cache->p_section);
+         return;
+      }
+      this->psi_CacheRelease(p_cache);
+      i_key = 0;
+   }
+
    p = p_output->p_pat_section = psi_allocate();
    pat_init(p);
    psi_set_length(p, PSI_MAX_SIZE);
@@ -1212,7 +1768,8 @@ void cLdvbdemux::NewPAT(output_t *p_output)
 
    p = pat_get_program(p_output->p_pat_section, k);
    pat_set_length(p_output->p_pat_section, p - p_output->p_pat_section - PAT_HEADER_SIZE);
-   psi_set_crc(p_output->p_pat_section);
+   cLdvbcrc::SetCRC(p_output->p_pat_section);
+   p_output->p_pat_cache = this->psi_CachePut(p_output->p_pat_section, PSI_CACHE_PAT, this->pi_psi_generation[PSI_CACHE_PAT], i_key ? p_key : (const uint8_t *) 0, i_key);
 }
 
 void cLdvbdemux::CopyDescriptors(uint8_t *p_descs, uint8_t *p_current_descs)
@@ -1254,8 +1811,12 @@ void cLdvbdemux::NewPMT(output_t *p_output)
    uint8_t *p;
    uint16_t j, k;
    uint16_t i_pcrpid;
+   uint8_t p_key[CLDVB_PSI_KEY_MAX];
+   unsigned int i_key;
+   psi_cache_t *p_cache;
 
-   ::free(p_output->p_pmt_section);
+   this->psi_CacheRelease(p_output->p_pmt_cache);
+   p_output->p_pmt_cache = (psi_cache_t *) 0;
    p_output->p_pmt_section = NULL;
    p_output->i_pmt_version++;
 
@@ -1270,6 +1831,19 @@ void cLdvbdemux::NewPMT(output_t *p_output)
       return;
    p_current_pmt = p_sid->p_current_pmt;
 
+   i_key = this->psi_Key(PSI_CACHE_PMT, p_output, p_key);
+   if (i_key && (p_cache = this->psi_CacheGet(PSI_CACHE_PMT, this->pi_psi_generation[PSI_CACHE_PMT], p_key, i_key)) != (psi_cache_t *) 0) {
+      if (psi_get_version(p_cache->p_section) != ((p_output->i_pmt_version - 1) & 0x1f)) {
+         p_output->p_pmt_cache = p_cache;
+         p_output->p_pmt_section = p_cache->p_section;
+         p_output->i_pmt_version = psi_get_version(p_cache->p_section);
+         this->init_pid_mapping(p_output);
+         return;
+      }
+      this->psi_CacheRelease(p_cache);
+      i_key = 0;
+   }
+
    p = p_output->p_pmt_section = psi_allocate();
    pmt_init(p);
    psi_set_length(p, PSI_MAX_SIZE);
@@ -1308,9 +1882,10 @@ void cLdvbdemux::NewPMT(output_t *p_output)
 
    /* Do the pcr pid after everything else as it may have been remapped */
    i_pcrpid = pmt_get_pcrpid(p_current_pmt);
-   if (p_output->pi_newpids[i_pcrpid] != UNUSED_PID) {
-      cLbugf(cL::dbg_dvb, "REMAP: The PCR PID was changed from 0x%x (%u) to 0x%x (%u)\n", i_pcrpid, i_pcrpid, p_output->pi_newpids[i_pcrpid], p_output->pi_newpids[i_pcrpid]);
-      i_pcrpid = p_output->pi_newpids[i_pcrpid];
+   uint16_t i_newpcrpid = cLdvboutput::output_RemapPID(p_output, i_pcrpid);
+   if (i_newpcrpid != UNUSED_PID) {
+      cLbugf(cL::dbg_dvb, "REMAP: The PCR PID was changed from 0x%x (%u) to 0x%x (%u)\n", i_pcrpid, i_pcrpid, i_newpcrpid, i_newpcrpid);
+      i_pcrpid = i_newpcrpid;
    } else {
       cLbugf(cL::dbg_dvb, "The PCR PID has kept its original value of 0x%x (%u)\n", i_pcrpid, i_pcrpid);
    }
@@ -1322,7 +1897,8 @@ void cLdvbdemux::NewPMT(output_t *p_output)
    } else {
       pmt_set_length(p, p_es - p - PMT_HEADER_SIZE);
    }
-   psi_set_crc(p);
+   cLdvbcrc::SetCRC(p);
+   p_output->p_pmt_cache = this->psi_CachePut(p, PSI_CACHE_PMT, this->pi_psi_generation[PSI_CACHE_PMT], i_key ? p_key : (const uint8_t *) 0, i_key);
 }
 
 void cLdvbdemux::NewNIT(output_t *p_output)
@@ -1331,7 +1907,8 @@ void cLdvbdemux::NewNIT(output_t *p_output)
    uint8_t *p_header2;
    uint8_t *p;
 
-   ::free(p_output->p_nit_section);
+   this->psi_CacheRelease(p_output->p_nit_cache);
+   p_output->p_nit_cache = (psi_cache_t *) 0;
    p_output->p_nit_section = NULL;
    p_output->i_nit_version++;
 
@@ -1379,15 +1956,20 @@ void cLdvbdemux::NewNIT(output_t *p_output)
    } else {
       nit_set_length(p, p_ts - p - NIT_HEADER_SIZE);
    }
-   psi_set_crc(p_output->p_nit_section);
+   cLdvbcrc::SetCRC(p_output->p_nit_section);
+   p_output->p_nit_cache = this->psi_CachePut(p_output->p_nit_section, PSI_CACHE_NIT, 0, (const uint8_t *) 0, 0);
 }
 
 void cLdvbdemux::NewSDT(output_t *p_output)
 {
    uint8_t *p_service, *p_current_service;
    uint8_t *p;
+   uint8_t p_key[CLDVB_PSI_KEY_MAX];
+   unsigned int i_key;
+   psi_cache_t *p_cache;
 
-   ::free(p_output->p_sdt_section);
+   this->psi_CacheRelease(p_output->p_sdt_cache);
+   p_output->p_sdt_cache = (psi_cache_t *) 0;
    p_output->p_sdt_section = NULL;
    p_output->i_sdt_version++;
 
@@ -1399,13 +1981,26 @@ void cLdvbdemux::NewSDT(output_t *p_output)
    if (p_current_service == (uint8_t *) 0) {
       if (p_output->p_pat_section != (uint8_t *) 0 && pat_get_program(p_output->p_pat_section, 0) == (uint8_t *) 0) {
          /* Empty PAT and no SDT anymore */
-         ::free(p_output->p_pat_section);
+         this->psi_CacheRelease(p_output->p_pat_cache);
+         p_output->p_pat_cache = (psi_cache_t *) 0;
          p_output->p_pat_section = NULL;
          p_output->i_pat_version++;
       }
       return;
    }
 
+   i_key = this->psi_Key(PSI_CACHE_SDT, p_output, p_key);
+   if (i_key && (p_cache = this->psi_CacheGet(PSI_CACHE_SDT, this->pi_psi_generation[PSI_CACHE_SDT], p_key, i_key)) != (psi_cache_t *) 0) {
+      if (psi_get_version(p_cache->p_section) != ((p_output->i_sdt_version - 1) & 0x1f)) {
+         p_output->p_sdt_cache = p_cache;
+         p_output->p_sdt_section = p_cache->p_section;
+         p_output->i_sdt_version = psi_get_version(p_cache->p_section);
+         return;
+      }
+      this->psi_CacheRelease(p_cache);
+      i_key = 0;
+   }
+
    p = p_output->p_sdt_section = psi_allocate();
    sdt_init(p, true);
    sdt_set_length(p, PSI_MAX_SIZE);
@@ -1495,15 +2090,19 @@ void cLdvbdemux::NewSDT(output_t *p_output)
    } else {
       sdt_set_length(p, p_service - p - SDT_HEADER_SIZE);
    }
-   psi_set_crc(p_output->p_sdt_section);
+   cLdvbcrc::SetCRC(p_output->p_sdt_section);
+   p_output->p_sdt_cache = this->psi_CachePut(p_output->p_sdt_section, PSI_CACHE_SDT, this->pi_psi_generation[PSI_CACHE_SDT], i_key ? p_key : (const uint8_t *) 0, i_key);
 }
 
+/* a new generation of the source table, outputs of the SID rebuild
+ * their section once per distinct config and share it */
 #define DECLARE_UPDATE_FUNC(table) \
       void cLdvbdemux::Update##table(uint16_t i_sid) \
       { \
-         for (int i = 0; i < this->i_nb_outputs; i++) { \
-            if ((this->pp_outputs[i]->config.i_config & OUTPUT_VALID) && this->pp_outputs[i]->config.i_sid == i_sid) \
-               New##table(this->pp_outputs[i]); \
+         this->pi_psi_generation[PSI_CACHE_##table]++; \
+         for (output_t *p_output = this->p_sid_index[i_sid].p_outputs; p_output != (output_t *) 0; p_output = p_output->p_sid_next) { \
+            if (p_output->config.i_config & OUTPUT_VALID) \
+               New##table(p_output); \
          } \
       }
 
@@ -1527,8 +2126,8 @@ void cLdvbdemux::UpdateTSID(void)
 
 bool cLdvbdemux::SIDIsSelected(uint16_t i_sid)
 {
-   for (int i = 0; i < this->i_nb_outputs; i++)
-      if ((this->pp_outputs[i]->config.i_config & OUTPUT_VALID) && this->pp_outputs[i]->config.i_sid == i_sid)
+   for (output_t *p_output = this->p_sid_index[i_sid].p_outputs; p_output != (output_t *) 0; p_output = p_output->p_sid_next)
+      if (p_output->config.i_config & OUTPUT_VALID)
          return true;
 
    return false;
@@ -1706,15 +2305,14 @@ void cLdvbdemux::DeleteProgram(uint16_t i_sid, uint16_t i_pid)
          }
       }
 
+      this->section_Forget(cLdvbdemux::section_Key(p_sid->i_pmt_pid, p_pmt));
       ::free(p_pmt);
       p_sid->p_current_pmt = (uint8_t *) 0;
    }
+   this->p_sid_index[p_sid->i_sid].p_sid = (sid_t *) 0;
    p_sid->i_sid = 0;
    p_sid->i_pmt_pid = 0;
-   for (uint8_t r = 0; r < MAX_EIT_TABLES; r++) {
-      psi_table_free(p_sid->eit_table[r].data);
-      psi_table_init(p_sid->eit_table[r].data);
-   }
+   this->eit_Clear(&p_sid->eit);
 }
 
 void cLdvbdemux::HandlePAT(mtime_t i_dts)
@@ -1783,9 +2381,7 @@ void cLdvbdemux::HandlePAT(mtime_t i_dts)
             if (p_sid == (sid_t *) 0) {
                p_sid = cLmalloc(sid_t, 1);
                p_sid->p_current_pmt = (uint8_t *) 0;
-               for (uint8_t r = 0; r < MAX_EIT_TABLES; r++) {
-                  psi_table_init(p_sid->eit_table[r].data);
-               }
+               memset(&p_sid->eit, 0, sizeof(eit_store_t));
                this->i_nb_sids++;
                this->pp_sids = (sid_t **)realloc(this->pp_sids, sizeof(sid_t *) * this->i_nb_sids);
                this->pp_sids[this->i_nb_sids - 1] = p_sid;
@@ -1793,6 +2389,7 @@ void cLdvbdemux::HandlePAT(mtime_t i_dts)
 
             p_sid->i_sid = i_sid;
             p_sid->i_pmt_pid = i_pid;
+            this->p_sid_index[i_sid].p_sid = p_sid;
 
             this->UpdatePAT(i_sid);
          }
@@ -1827,6 +2424,7 @@ void cLdvbdemux::HandlePAT(mtime_t i_dts)
    pat_table_print(this->pp_current_pat_sections, cLdvbdemux::debug_cb, this, PRINT_TEXT);
 
    out_pat:
+   this->section_AcceptTable(PAT_PID, this->pp_current_pat_sections);
    this->SendPAT(i_dts);
 }
 
@@ -1925,7 +2523,7 @@ void cLdvbdemux::HandleCAT(mtime_t i_dts)
    cat_table_print(this->pp_current_cat_sections, cLdvbdemux::debug_cb, this, PRINT_TEXT);
 
    out_cat:
-   return;
+   this->section_AcceptTable(CAT_PID, this->pp_current_cat_sections);
 }
 
 void cLdvbdemux::HandleCATSection(uint16_t i_pid, uint8_t *p_section, mtime_t i_dts)
@@ -2034,9 +2632,9 @@ void cLdvbdemux::HandlePMT(uint16_t i_pid, uint8_t *p_pmt, mtime_t i_dts)
    this->mark_pmt_pids(p_pmt, pid_map, 0x01);
 
    i_pcr_pid = pmt_get_pcrpid(p_pmt);
-   for (int i = 0; i < i_nb_outputs; i++) {
-      if ((pp_outputs[i]->config.i_config & OUTPUT_VALID) && pp_outputs[i]->config.i_sid == i_sid)
-          pp_outputs[i]->i_pcr_pid = 0;
+   for (output_t *p_output = this->p_sid_index[i_sid].p_outputs; p_output != (output_t *) 0; p_output = p_output->p_sid_next) {
+      if (p_output->config.i_config & OUTPUT_VALID)
+         p_output->i_pcr_pid = 0;
    }
 
    /* Start to stream PIDs */
@@ -2073,6 +2671,8 @@ void cLdvbdemux::HandlePMT(uint16_t i_pid, uint8_t *p_pmt, mtime_t i_dts)
    pmt_print(p_pmt, cLdvbdemux::debug_cb, this, cLdvboutput::iconv_cb, this, PRINT_TEXT);
 
 out_pmt:
+   if (p_sid->p_current_pmt != (uint8_t *) 0)
+      this->section_Accept(i_pid, p_sid->p_current_pmt);
    this->SendPMT(p_sid, i_dts);
 }
 
@@ -2100,7 +2700,7 @@ void cLdvbdemux::HandleNIT(mtime_t i_dts)
    nit_table_print(this->pp_current_nit_sections, cLdvbdemux::debug_cb, this, cLdvboutput::iconv_cb, this, PRINT_TEXT);
 
    out_nit:
-   ;
+   this->section_AcceptTable(NIT_PID, this->pp_current_nit_sections);
 }
 
 void cLdvbdemux::HandleNITSection(uint16_t i_pid, uint8_t *p_section, mtime_t i_dts)
@@ -2181,6 +2781,7 @@ void cLdvbdemux::HandleSDT(mtime_t i_dts)
    sdt_table_print(this->pp_current_sdt_sections, cLdvbdemux::debug_cb, this, cLdvboutput::iconv_cb, this, PRINT_TEXT);
 
    out_sdt:
+   this->section_AcceptTable(SDT_PID, this->pp_current_sdt_sections);
    this->SendSDT(i_dts);
 }
 
@@ -2286,7 +2887,7 @@ void cLdvbdemux::HandleATSCSection(uint16_t i_pid, uint8_t *p_section, mtime_t i
    } else {
       sdt_set_length(pv_sdt, p_service - pv_sdt - SDT_HEADER_SIZE);
    }
-   psi_set_crc(pv_sdt);
+   cLdvbcrc::SetCRC(pv_sdt);
    if (!psi_table_section(this->pp_next_sdt_sections, pv_sdt)) {
       ::free(pv_sdt);
       return;
@@ -2328,15 +2929,7 @@ void cLdvbdemux::HandleEIT(uint16_t i_pid, uint8_t *p_eit, mtime_t i_dts)
    eit_table_id = i_table_id - EIT_TABLE_ID_PF_ACTUAL;
    if (eit_table_id >= MAX_EIT_TABLES)
       goto out_eit;
-   if (p_sid->eit_table[eit_table_id].data[i_section] != NULL && psi_compare(p_sid->eit_table[eit_table_id].data[i_section], p_eit)) {
-       /* Identical section. Shortcut. */
-       ::free(p_sid->eit_table[eit_table_id].data[i_section]);
-       p_sid->eit_table[eit_table_id].data[i_section] = p_eit;
-       goto out_eit;
-   }
-
-   ::free(p_sid->eit_table[eit_table_id].data[i_section]);
-   p_sid->eit_table[eit_table_id].data[i_section] = p_eit;
+   this->eit_Store(p_sid, eit_table_id, i_section, p_eit);
 
    /*
    eit_print(p_eit, msg_Dbg, NULL, demux_Iconv, NULL, PRINT_TEXT);
@@ -2349,14 +2942,199 @@ void cLdvbdemux::HandleEIT(uint16_t i_pid, uint8_t *p_eit, mtime_t i_dts)
 
 out_eit:
    this->SendEIT(p_sid, i_dts, p_eit);
-   if (!b_epg)
-      ::free(p_eit);
+   ::free(p_eit);
+}
+
+/* copy a section in the arena of its service, unless the same one
+ * (by CRC) is already there */
+void cLdvbdemux::eit_Store(sid_t *p_sid, uint8_t i_table, uint8_t i_section, const uint8_t *p_eit)
+{
+   eit_store_t *p_store = &p_sid->eit;
+   int i_index = i_table * EIT_TABLE_SEGMENTS + i_section / CLDVB_EIT_SEGMENT_SECTIONS;
+   int j = i_section % CLDVB_EIT_SEGMENT_SECTIONS;
+   uint16_t i_length = psi_get_length(p_eit) + PSI_HEADER_SIZE;
+   const uint8_t *p_crc = p_eit + i_length - PSI_CRC_SIZE;
+   uint32_t i_crc = (p_crc[0] << 24) | (p_crc[1] << 16) | (p_crc[2] << 8) | p_crc[3];
+   eit_segment_t *p_segment = p_store->pp_segments[i_index];
+
+   if (p_segment == (eit_segment_t *) 0) {
+      p_segment = cLmalloc(eit_segment_t, 1);
+      memset(p_segment, 0, sizeof(eit_segment_t));
+      p_segment->p_store = p_store;
+      p_segment->i_index = i_index;
+      p_segment->i_sid = p_sid->i_sid;
+      p_store->pp_segments[i_index] = p_segment;
+      this->i_eit_memory += sizeof(eit_segment_t);
+      this->i_eit_segments++;
+   } else if (p_segment->pi_length[j] == i_length && p_segment->pi_crc[j] == i_crc) {
+      /* carousel repetition the section fingerprints didn't catch */
+      this->i_eit_unchanged++;
+      this->eit_Touch(p_segment);
+      this->section_Accept(EIT_PID, p_eit);
+      return;
+   } else if (p_segment->pi_length[j]) {
+      p_store->i_arena_dead += p_segment->pi_length[j];
+      this->i_eit_live -= p_segment->pi_length[j];
+      p_segment->pi_length[j] = 0;
+   }
+
+   if (p_store->i_arena_used + i_length > p_store->i_arena_size) {
+      uint32_t i_live = p_store->i_arena_used - p_store->i_arena_dead;
+      uint32_t i_size = p_store->i_arena_size ? p_store->i_arena_size : CLDVB_EIT_ARENA_MIN;
+      while (i_size < i_live + i_length)
+         i_size *= 2;
+      this->eit_Compact(p_store, i_size);
+   }
+
+   memcpy(p_store->p_arena + p_store->i_arena_used, p_eit, i_length);
+   p_segment->pi_offset[j] = p_store->i_arena_used;
+   p_segment->pi_length[j] = i_length;
+   p_segment->pi_crc[j] = i_crc;
+   p_store->i_arena_used += i_length;
+   this->i_eit_live += i_length;
+   this->i_eit_stored++;
+
+   this->eit_Touch(p_segment);
+   this->section_Accept(EIT_PID, p_eit);
+   if (this->i_eit_memory_max)
+      this->eit_Evict(p_segment);
+}
+
+/* a repetition skipped by the section fingerprints, its segment is
+ * still on air and moves to the front of the LRU; returns the stored
+ * copy of the section, which unlike the repetition passed the CRC check */
+const uint8_t *cLdvbdemux::eit_Refresh(sid_t *p_sid, const uint8_t *p_eit)
+{
+   uint8_t i_table = psi_get_tableid(p_eit) - EIT_TABLE_ID_PF_ACTUAL;
+   uint8_t i_section = psi_get_section(p_eit);
+   int j = i_section % CLDVB_EIT_SEGMENT_SECTIONS;
+
+   if (i_table >= MAX_EIT_TABLES)
+      return (const uint8_t *) 0;
+
+   eit_segment_t *p_segment = p_sid->eit.pp_segments[i_table * EIT_TABLE_SEGMENTS + i_section / CLDVB_EIT_SEGMENT_SECTIONS];
+   if (p_segment == (eit_segment_t *) 0 || p_segment->pi_length[j] != psi_get_length(p_eit) + PSI_HEADER_SIZE)
+      return (const uint8_t *) 0;
+
+   this->i_eit_unchanged++;
+   this->eit_Touch(p_segment);
+   return p_sid->eit.p_arena + p_segment->pi_offset[j];
+}
+
+void cLdvbdemux::eit_Unlink(eit_segment_t *p_segment)
+{
+   if (p_segment->p_lru_prev != (eit_segment_t *) 0)
+      p_segment->p_lru_prev->p_lru_next = p_segment->p_lru_next;
+   else if (this->p_eit_lru_first == p_segment)
+      this->p_eit_lru_first = p_segment->p_lru_next;
+   else
+      return; /* not linked */
+   if (p_segment->p_lru_next != (eit_segment_t *) 0)
+      p_segment->p_lru_next->p_lru_prev = p_segment->p_lru_prev;
+   else
+      this->p_eit_lru_last = p_segment->p_lru_prev;
+   p_segment->p_lru_prev = p_segment->p_lru_next = (eit_segment_t *) 0;
+}
+
+void cLdvbdemux::eit_Touch(eit_segment_t *p_segment)
+{
+   /* present/following is small and always kept */
+   if (p_segment->i_index < EIT_TABLE_SEGMENTS || this->p_eit_lru_first == p_segment)
+      return;
+
+   this->eit_Unlink(p_segment);
+   p_segment->p_lru_next = this->p_eit_lru_first;
+   if (this->p_eit_lru_first != (eit_segment_t *) 0)
+      this->p_eit_lru_first->p_lru_prev = p_segment;
+   else
+      this->p_eit_lru_last = p_segment;
+   this->p_eit_lru_first = p_segment;
+}
+
+void cLdvbdemux::eit_Drop(eit_segment_t *p_segment)
+{
+   eit_store_t *p_store = p_segment->p_store;
+
+   this->eit_Unlink(p_segment);
+   for (int j = 0; j < CLDVB_EIT_SEGMENT_SECTIONS; j++) {
+      if (!p_segment->pi_length[j])
+         continue;
+      /* so that the next repetition is stored again */
+      this->section_Forget(cLdvbdemux::section_Key(EIT_PID, p_store->p_arena + p_segment->pi_offset[j]));
+      p_store->i_arena_dead += p_segment->pi_length[j];
+      this->i_eit_live -= p_segment->pi_length[j];
+   }
+   p_store->pp_segments[p_segment->i_index] = (eit_segment_t *) 0;
+   ::free(p_segment);
+   this->i_eit_memory -= sizeof(eit_segment_t);
+   this->i_eit_segments--;
+}
+
+/* move the live sections to a new arena of i_size bytes, in table and
+ * section order, which is also the order they are packed in */
+void cLdvbdemux::eit_Compact(eit_store_t *p_store, uint32_t i_size)
+{
+   uint8_t *p_arena = (uint8_t *) 0;
+   uint32_t i_used = 0;
+
+   if (i_size)
+      p_arena = cLmalloc(uint8_t, i_size);
+   for (int i = 0; i < EIT_STORE_SEGMENTS; i++) {
+      eit_segment_t *p_segment = p_store->pp_segments[i];
+      if (p_segment == (eit_segment_t *) 0)
+         continue;
+      for (int j = 0; j < CLDVB_EIT_SEGMENT_SECTIONS; j++) {
+         if (!p_segment->pi_length[j])
+            continue;
+         memcpy(p_arena + i_used, p_store->p_arena + p_segment->pi_offset[j], p_segment->pi_length[j]);
+         p_segment->pi_offset[j] = i_used;
+         i_used += p_segment->pi_length[j];
+      }
+   }
+
+   ::free(p_store->p_arena);
+   this->i_eit_memory = this->i_eit_memory - p_store->i_arena_size + i_size;
+   p_store->p_arena = p_arena;
+   p_store->i_arena_size = i_size;
+   p_store->i_arena_used = i_used;
+   p_store->i_arena_dead = 0;
+}
+
+/* drop the least recently refreshed schedule segments until the store
+ * fits in --eit-memory again */
+void cLdvbdemux::eit_Evict(eit_segment_t *p_keep)
+{
+   while (this->i_eit_memory > this->i_eit_memory_max && this->p_eit_lru_last != (eit_segment_t *) 0 && this->p_eit_lru_last != p_keep) {
+      eit_store_t *p_store = this->p_eit_lru_last->p_store;
+
+      this->eit_Drop(this->p_eit_lru_last);
+      this->i_eit_evicted++;
+
+      uint32_t i_live = p_store->i_arena_used - p_store->i_arena_dead;
+      this->eit_Compact(p_store, (i_live + CLDVB_EIT_ARENA_MIN - 1) / CLDVB_EIT_ARENA_MIN * CLDVB_EIT_ARENA_MIN);
+   }
+}
+
+void cLdvbdemux::eit_Clear(eit_store_t *p_store)
+{
+   for (int i = 0; i < EIT_STORE_SEGMENTS; i++) {
+      if (p_store->pp_segments[i] != (eit_segment_t *) 0)
+         this->eit_Drop(p_store->pp_segments[i]);
+   }
+   this->eit_Compact(p_store, 0);
 }
 
 void cLdvbdemux::HandleSection(uint16_t i_pid, uint8_t *p_section, mtime_t i_dts)
 {
    uint8_t i_table_id = psi_get_tableid(p_section);
-   if (!psi_validate(p_section)) {
+
+   if (this->section_Seen(i_pid, p_section)) {
+      this->HandleRepeatedSection(i_pid, p_section, i_dts);
+      ::free(p_section);
+      return;
+   }
+
+   if (!cLdvbcrc::Validate(p_section)) {
       cLbugf(cL::dbg_dvb, "invalid section on PID %hu\n", i_pid);
       ::free(p_section);
       return;
@@ -2406,12 +3184,145 @@ void cLdvbdemux::HandleSection(uint16_t i_pid, uint8_t *p_section, mtime_t i_dts
    }
 }
 
+/* same header and CRC as the last accepted section: neither the CRC nor
+ * the table are checked again, only what the table handlers would have
+ * sent out for a repetition is */
+void cLdvbdemux::HandleRepeatedSection(uint16_t i_pid, uint8_t *p_section, mtime_t i_dts)
+{
+   uint8_t i_table_id = psi_get_tableid(p_section);
+   bool b_last = psi_get_section(p_section) == psi_get_lastsection(p_section);
+   sid_t *p_sid;
+
+   this->i_sections_skipped++;
+   switch (i_table_id) {
+      case PAT_TABLE_ID:
+         if (b_last)
+            this->SendPAT(i_dts);
+         break;
+
+      case PMT_TABLE_ID:
+         p_sid = this->FindSID(pmt_get_program(p_section));
+         if (p_sid != (sid_t *) 0 && p_sid->i_pmt_pid == i_pid)
+            this->SendPMT(p_sid, i_dts);
+         break;
+
+      case SDT_TABLE_ID_ACTUAL:
+         if (b_last)
+            this->SendSDT(i_dts);
+         break;
+
+      default:
+         if (this->handle_epg(i_table_id) && (p_sid = this->FindSID(eit_get_sid(p_section))) != (sid_t *) 0) {
+            /* only the header and CRC were compared, send the stored
+             * copy (SendEIT() rewrites its argument) or check it */
+            const uint8_t *p_stored = i_pid == EIT_PID ? this->eit_Refresh(p_sid, p_section) : (const uint8_t *) 0;
+            if (p_stored != (const uint8_t *) 0)
+               memcpy(p_section, p_stored, psi_get_length(p_section) + PSI_HEADER_SIZE);
+            else if (!cLdvbcrc::Validate(p_section))
+               break;
+            this->SendEIT(p_sid, i_dts, p_section);
+         }
+         break;
+   }
+}
+
+uint64_t cLdvbdemux::section_Key(uint16_t i_pid, const uint8_t *p_section)
+{
+   return (uint64_t)1 << 63 | (uint64_t)i_pid << 32 | (uint64_t)psi_get_tableid(p_section) << 24 | (uint64_t)psi_get_tableidext(p_section) << 8 | psi_get_section(p_section);
+}
+
+uint64_t cLdvbdemux::section_Print(const uint8_t *p_section)
+{
+   uint16_t i_length = psi_get_length(p_section);
+   const uint8_t *p_crc = p_section + PSI_HEADER_SIZE + i_length - PSI_CRC_SIZE;
+
+   /* byte 5 is version and current_next, byte 7 the last section */
+   return (uint64_t)i_length << 48 | (uint64_t)p_section[5] << 40 | (uint64_t)p_section[7] << 32
+         | (uint32_t)(p_crc[0] << 24 | p_crc[1] << 16 | p_crc[2] << 8 | p_crc[3]);
+}
+
+/* the entry holding i_key, or the free one ending its probe sequence */
+cLdvbdemux::section_print_t *cLdvbdemux::section_Find(uint64_t i_key)
+{
+   unsigned int i_mask = (1 << CLDVB_SECTION_PRINT_BITS) - 1;
+   unsigned int i = (i_key * 0x9e3779b97f4a7c15ULL) >> (64 - CLDVB_SECTION_PRINT_BITS);
+
+   while (this->p_section_prints[i].i_key && this->p_section_prints[i].i_key != i_key)
+      i = (i + 1) & i_mask;
+   return &this->p_section_prints[i];
+}
+
+bool cLdvbdemux::section_Seen(uint16_t i_pid, const uint8_t *p_section)
+{
+   if (!psi_get_syntax(p_section) || psi_get_length(p_section) < PSI_HEADER_SIZE_SYNTAX1 - PSI_HEADER_SIZE + PSI_CRC_SIZE)
+      return false;
+
+   section_print_t *p_entry = this->section_Find(cLdvbdemux::section_Key(i_pid, p_section));
+   return p_entry->i_key && p_entry->i_print == cLdvbdemux::section_Print(p_section);
+}
+
+void cLdvbdemux::section_Accept(uint16_t i_pid, const uint8_t *p_section)
+{
+   if (!psi_get_syntax(p_section) || psi_get_length(p_section) < PSI_HEADER_SIZE_SYNTAX1 - PSI_HEADER_SIZE + PSI_CRC_SIZE)
+      return;
+
+   uint64_t i_key = cLdvbdemux::section_Key(i_pid, p_section);
+   section_print_t *p_entry = this->section_Find(i_key);
+   if (!p_entry->i_key) {
+      /* keep probe sequences short, the rest is just checked every time */
+      if (this->i_nb_section_prints >= (3 << CLDVB_SECTION_PRINT_BITS) / 4)
+         return;
+      p_entry->i_key = i_key;
+      this->i_nb_section_prints++;
+   }
+   p_entry->i_print = cLdvbdemux::section_Print(p_section);
+}
+
+void cLdvbdemux::section_AcceptTable(uint16_t i_pid, uint8_t **pp_sections)
+{
+   if (!psi_table_validate(pp_sections))
+      return;
+
+   uint8_t i_last_section = psi_table_get_lastsection(pp_sections);
+   for (int i = 0; i <= i_last_section; i++) {
+      uint8_t *p_section = psi_table_get_section(pp_sections, i);
+      if (p_section != (uint8_t *) 0)
+         this->section_Accept(i_pid, p_section);
+   }
+}
+
+/* backward shift deletion, no tombstones */
+void cLdvbdemux::section_Forget(uint64_t i_key)
+{
+   unsigned int i_mask = (1 << CLDVB_SECTION_PRINT_BITS) - 1;
+   section_print_t *p_entry = this->section_Find(i_key);
+   unsigned int i = p_entry - this->p_section_prints, j = i;
+
+   if (!p_entry->i_key)
+      return;
+
+   for (;;) {
+      j = (j + 1) & i_mask;
+      if (!this->p_section_prints[j].i_key)
+         break;
+      unsigned int k = (this->p_section_prints[j].i_key * 0x9e3779b97f4a7c15ULL) >> (64 - CLDVB_SECTION_PRINT_BITS);
+      /* j may move to i only if its home slot isn't cyclically in (i, j] */
+      if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+         continue;
+      this->p_section_prints[i] = this->p_section_prints[j];
+      i = j;
+   }
+   this->p_section_prints[i].i_key = 0;
+   this->i_nb_section_prints--;
+}
+
 void cLdvbdemux::HandlePSIPacket(uint8_t *p_ts, mtime_t i_dts)
 {
    uint16_t i_pid = ts_get_pid(p_ts);
    ts_pid_t *p_pid = &this->p_pids[i_pid];
+   int8_t i_last_cc = this->p_pids_hot[i_pid].i_last_cc;
    uint8_t i_cc = ts_get_cc(p_ts);
-   if (ts_check_duplicate(i_cc, p_pid->i_last_cc) || !ts_has_payload(p_ts)) {
+   if (ts_check_duplicate(i_cc, i_last_cc) || !ts_has_payload(p_ts)) {
       cLbugf(cL::dbg_dvb, "PSI not processed on PID %hu\n", i_pid);
       return;
    }
@@ -2419,7 +3330,7 @@ void cLdvbdemux::HandlePSIPacket(uint8_t *p_ts, mtime_t i_dts)
    const uint8_t *p_payload;
    uint8_t i_length;
 
-   if (p_pid->i_last_cc != -1 && ts_check_discontinuity(i_cc, p_pid->i_last_cc))
+   if (i_last_cc != -1 && ts_check_discontinuity(i_cc, i_last_cc))
       psi_assemble_reset(&p_pid->p_psi_buffer, &p_pid->i_psi_buffer_used);
 
    p_payload = ts_section(p_ts);
@@ -2667,7 +3578,7 @@ uint8_t **cLdvbdemux::psi_unpack_sections(uint8_t *p_flat_sections, unsigned int
    for (i = 0; i < PSI_TABLE_MAX_SECTIONS; i++) {
       uint8_t *p_section = p_flat_sections + i_offset;
       uint16_t i_section_len = psi_get_length(p_section) + PSI_HEADER_SIZE;
-      if (!psi_validate(p_section)) {
+      if (!cLdvbcrc::Validate(p_section)) {
          cLbugf(cL::dbg_dvb, "%s: Invalid section %d\n", __func__, i);
          psi_table_free(pp_sections);
          return (uint8_t **) 0;
@@ -2731,13 +3642,12 @@ uint8_t *cLdvbdemux::demux_get_packed_EIT(uint16_t i_sid, uint8_t start_table, u
       uint8_t eit_table_idx = i - EIT_TABLE_ID_PF_ACTUAL;
       if (eit_table_idx >= MAX_EIT_TABLES)
          continue;
-      uint8_t **eit_sections = p_sid->eit_table[eit_table_idx].data;
-      for (int r = 0; r < PSI_TABLE_MAX_SECTIONS; r++) {
-         uint8_t *p_eit = eit_sections[r];
-         if (!p_eit)
+      eit_segment_t **pp_segments = p_sid->eit.pp_segments + eit_table_idx * EIT_TABLE_SEGMENTS;
+      for (int r = 0; r < EIT_TABLE_SEGMENTS; r++) {
+         if (pp_segments[r] == (eit_segment_t *) 0)
             continue;
-         uint16_t psi_length = psi_get_length(p_eit) + PSI_HEADER_SIZE;
-         *eit_size += psi_length;
+         for (int j = 0; j < CLDVB_EIT_SEGMENT_SECTIONS; j++)
+            *eit_size += pp_segments[r]->pi_length[j];
       }
    }
 
@@ -2751,15 +3661,16 @@ uint8_t *cLdvbdemux::demux_get_packed_EIT(uint16_t i_sid, uint8_t start_table, u
       uint8_t eit_table_idx = i - EIT_TABLE_ID_PF_ACTUAL;
       if (eit_table_idx >= MAX_EIT_TABLES)
          continue;
-      uint8_t **eit_sections = p_sid->eit_table[eit_table_idx].data;
-      for (int r = 0; r < PSI_TABLE_MAX_SECTIONS; r++) {
-         uint8_t *p_eit = eit_sections[r];
-         if (!p_eit)
+      eit_segment_t **pp_segments = p_sid->eit.pp_segments + eit_table_idx * EIT_TABLE_SEGMENTS;
+      for (int r = 0; r < EIT_TABLE_SEGMENTS; r++) {
+         eit_segment_t *p_segment = pp_segments[r];
+         if (p_segment == (eit_segment_t *) 0)
             continue;
-         uint16_t psi_length = psi_get_length(p_eit) + PSI_HEADER_SIZE;
-         memcpy(p_flat_section + i_pos, p_eit, psi_length);
-         i_pos += psi_length;
-         /* eit_print( p_eit, msg_Dbg, NULL, demux_Iconv, NULL, PRINT_TEXT ); */
+         for (int j = 0; j < CLDVB_EIT_SEGMENT_SECTIONS; j++) {
+            memcpy(p_flat_section + i_pos, p_sid->eit.p_arena + p_segment->pi_offset[j], p_segment->pi_length[j]);
+            i_pos += p_segment->pi_length[j];
+         }
+         this->eit_Touch(p_segment);
       }
    }
    return p_flat_section;
@@ -2786,7 +3697,11 @@ uint8_t *cLdvbdemux::demux_get_packed_PMT(uint16_t i_sid, unsigned int *pi_pack_
 void cLdvbdemux::demux_get_PID_info(uint16_t i_pid, uint8_t *p_data)
 {
    ts_pid_info_t *p_info = (ts_pid_info_t *)p_data;
+   const ts_pid_hot_t *p_hot = &this->p_pids_hot[i_pid];
    *p_info = this->p_pids[i_pid].info;
+   p_info->i_last_packet_ts = p_hot->i_last_packet_ts;
+   p_info->i_packets = p_hot->i_packets;
+   p_info->i_scrambling = p_hot->i_scrambling;
 }
 
 void cLdvbdemux::demux_get_PIDS_info(uint8_t *p_data)
@@ -2796,25 +3711,31 @@ void cLdvbdemux::demux_get_PIDS_info(uint8_t *p_data)
       this->demux_get_PID_info(i_pid, p_data + (i_pid * sizeof(ts_pid_info_t)));
 }
 
-void cLdvbdemux::config_ReadFile(void)
+/* read and resolve the config file, this doesn't touch the outputs and
+ * runs on config_thread for a reload */
+cLdvbdemux::config_file_t *cLdvbdemux::config_Parse(void)
 {
    FILE *p_file;
    char psz_line[2048];
-   int i;
+   int i_max_configs = 0;
+   uint64_t i_start = this->ndate();
 
    if (this->psz_conf_file == (const char *) 0) {
       cLbug(cL::dbg_dvb, "no config file\n");
-      return;
+      return (config_file_t *) 0;
    }
 
    if ((fopen(p_file, this->psz_conf_file, "r")) == (FILE *) 0) {
       cLbugf(cL::dbg_dvb, "can't fopen config file %s\n", this->psz_conf_file);
-      return;
+      return (config_file_t *) 0;
    }
 
+   config_file_t *p_config_file = cLmalloc(config_file_t, 1);
+   p_config_file->p_configs = (output_config_t *) 0;
+   p_config_file->i_nb_configs = 0;
+
    while (fgets(psz_line, sizeof(psz_line), p_file) != (char *) 0) {
       output_config_t config;
-      output_t *p_output;
       char *psz_token, *psz_parser;
 
       psz_parser = strchr(psz_line, '#');
@@ -2872,13 +3793,66 @@ void cLdvbdemux::config_ReadFile(void)
          }
       }
 
-      this->config_Print(&config);
+      if (p_config_file->i_nb_configs == i_max_configs) {
+         i_max_configs = i_max_configs ? 2 * i_max_configs : CLDVB_CONFIG_SLICE;
+         p_config_file->p_configs = cLrealloc(output_config_t, p_config_file->p_configs, i_max_configs);
+      }
+      p_config_file->p_configs[p_config_file->i_nb_configs++] = config;
+   }
+
+   fclose(p_file);
+   p_config_file->i_parse_ns = this->ndate() - i_start;
+   return p_config_file;
+}
+
+void cLdvbdemux::config_FileDelete(config_file_t *p_file)
+{
+   if (p_file == (config_file_t *) 0)
+      return;
+   for (int i = 0; i < p_file->i_nb_configs; i++)
+      cLdvboutput::config_Free(&p_file->p_configs[i]);
+   ::free(p_file->p_configs);
+   ::free(p_file);
+}
 
-      p_output = this->output_Find(&config);
+void cLdvbdemux::config_ApplyStart(config_file_t *p_file)
+{
+   memset(&this->config_reload, 0, sizeof(config_reload_t));
+   this->config_reload.p_file = p_file;
+   this->config_reload.i_start = this->ndate();
+}
+
+/* apply up to i_max added, changed or removed outputs of the reload in
+ * progress, returns true once it is complete */
+bool cLdvbdemux::config_Apply(int i_max)
+{
+   config_reload_t *p_reload = &this->config_reload;
+   const config_file_t *p_file = p_reload->p_file;
+   int i_done = 0;
+
+   this->outputs_Lock();
+   p_reload->i_slices++;
+
+   while (p_reload->i_next_config < p_file->i_nb_configs && i_done < i_max) {
+      /* the strings still belong to p_file */
+      output_config_t config = p_file->p_configs[p_reload->i_next_config++];
+      output_t *p_output = this->output_Find(&config);
+
+      if (p_output != (output_t *) 0 && this->config_Equal(&p_output->config, &config)) {
+         p_output->config.i_config |= OUTPUT_STILL_PRESENT;
+         p_reload->i_unchanged++;
+         continue;
+      }
+
+      this->config_Print(&config);
+      i_done++;
 
       if (p_output == (output_t *) 0) {
          p_output = this->output_Create(&config);
-      }
+         if (p_output != (output_t *) 0)
+            p_reload->i_added++;
+      } else
+         p_reload->i_changed++;
 
       if (p_output != (output_t *) 0) {
          ::free(p_output->config.psz_displayname);
@@ -2888,27 +3862,121 @@ void cLdvbdemux::config_ReadFile(void)
          this->output_Change(p_output, &config);
          demux_Change(p_output, &config);
       }
-
-      this->config_Free(&config);
    }
 
-   fclose(p_file);
-
-   for (i = 0; i < this->i_nb_outputs; i++) {
-      output_t *p_output = this->pp_outputs[i];
-      output_config_t config;
-
-      this->config_Init(&config);
+   while (p_reload->i_next_config == p_file->i_nb_configs && p_reload->i_next_output < this->i_nb_outputs && i_done < i_max) {
+      output_t *p_output = this->pp_outputs[p_reload->i_next_output++];
 
       if ((p_output->config.i_config & OUTPUT_VALID) && !(p_output->config.i_config & OUTPUT_STILL_PRESENT)) {
+         output_config_t config;
+         this->config_Init(&config);
          cLbugf(cL::dbg_dvb, "closing %s\n", p_output->config.psz_displayname);
          demux_Change(p_output, &config);
          this->output_Close(p_output);
+         this->config_Free(&config);
+         p_reload->i_removed++;
+         i_done++;
       }
 
       p_output->config.i_config &= ~OUTPUT_STILL_PRESENT;
-      this->config_Free(&config);
    }
+
+   bool b_done = p_reload->i_next_config == p_file->i_nb_configs && p_reload->i_next_output == this->i_nb_outputs;
+   this->UpdatePassthrough();
+   if (b_done)
+      this->outputs_Balance();
+   this->outputs_Unlock();
+
+   if (b_done)
+      cLbugf(cL::dbg_dvb, "config %s: %d added, %d changed, %d removed, %d unchanged, parsed in %"PRIu64" us, applied in %"PRIu64" us over %d iterations\n", this->psz_conf_file, p_reload->i_added, p_reload->i_changed, p_reload->i_removed, p_reload->i_unchanged, p_file->i_parse_ns / 1000, (this->ndate() - p_reload->i_start) / 1000, p_reload->i_slices);
+   return b_done;
+}
+
+/* synchronous, at startup before any packet is read */
+void cLdvbdemux::config_ReadFile(void)
+{
+   config_file_t *p_file = this->config_Parse();
+
+   if (p_file == (config_file_t *) 0)
+      return;
+   this->config_ApplyStart(p_file);
+   this->config_Apply(INT_MAX);
+   this->config_FileDelete(p_file);
+   this->config_reload.p_file = (config_file_t *) 0;
+}
+
+/* on request the file is parsed and resolved by config_thread, then
+ * applied CLDVB_CONFIG_SLICE outputs per loop iteration so the input
+ * keeps being read */
+void cLdvbdemux::config_Reload(void)
+{
+   if (this->b_config_parsing || this->config_reload.p_file != (config_file_t *) 0) {
+      cLbug(cL::dbg_dvb, "config reload already in progress, queued\n");
+      this->b_config_pending = true;
+      return;
+   }
+
+   this->b_config_pending = false;
+   this->p_config_parsed = (config_file_t *) 0;
+   this->config_watcher.data = this;
+   cLev_async_init(&this->config_watcher, cLdvbdemux::config_ParsedCb);
+   cLev_async_start(this->event_loop, &this->config_watcher);
+
+   if (pthread_create(&this->config_thread, (pthread_attr_t *) 0, cLdvbdemux::config_Thread, this)) {
+      cLbug(cL::dbg_dvb, "couldn't create config thread, reloading synchronously\n");
+      cLev_async_stop(this->event_loop, &this->config_watcher);
+      this->config_ReadFile();
+      return;
+   }
+   this->b_config_parsing = true;
+}
+
+void *cLdvbdemux::config_Thread(void *p)
+{
+   cLdvbdemux *pobj = (cLdvbdemux *) p;
+
+   pobj->p_config_parsed = pobj->config_Parse();
+   cLev_async_send(pobj->event_loop, &pobj->config_watcher);
+   return (void *) 0;
+}
+
+void cLdvbdemux::config_ParsedCb(void *loop, void *p, int revents)
+{
+   cLev_async *w = (cLev_async *) p;
+   cLdvbdemux *pobj = (cLdvbdemux *) w->data;
+
+   pthread_join(pobj->config_thread, (void **) 0);
+   cLev_async_stop(loop, w);
+   pobj->b_config_parsing = false;
+
+   if (pobj->p_config_parsed == (config_file_t *) 0) {
+      if (pobj->b_config_pending)
+         pobj->config_Reload();
+      return;
+   }
+
+   pobj->config_ApplyStart(pobj->p_config_parsed);
+   pobj->p_config_parsed = (config_file_t *) 0;
+   pobj->config_apply_watcher.data = pobj;
+   cLev_timer_init(&pobj->config_apply_watcher, cLdvbdemux::config_ApplyCb, 0., 0.);
+   cLev_timer_start(loop, &pobj->config_apply_watcher);
+}
+
+void cLdvbdemux::config_ApplyCb(void *loop, void *p, int revents)
+{
+   struct cLev_timer *w = (struct cLev_timer *) p;
+   cLdvbdemux *pobj = (cLdvbdemux *) w->data;
+
+   if (!pobj->config_Apply(CLDVB_CONFIG_SLICE)) {
+      cLev_timer_set(w, 0., 0.);
+      cLev_timer_start(loop, w);
+      return;
+   }
+
+   pobj->config_FileDelete(pobj->config_reload.p_file);
+   pobj->config_reload.p_file = (config_file_t *) 0;
+   if (pobj->b_config_pending)
+      pobj->config_Reload();
 }
 
 bool cLdvbdemux::set_pid_map(char *s)
@@ -31,6 +31,8 @@
 
 #include <cLdvbmrtgcnt.h>
 #include <cLdvben50221.h>
+#include <cLdvbcrc.h>
+#include <cLdvbstats.h>
 #include <bitstream/mpeg/psi.h>
 
 class cLdvbdemux : public cLdvben50221 {
@@ -54,44 +56,90 @@ class cLdvbdemux : public cLdvben50221 {
       } ts_pid_info_t;
 
    private:
+      /* state updated for every packet, kept out of ts_pid_t so that
+       * a packet only dirties one cache line (two PIDs per line) */
+      typedef struct ts_pid_hot_t {
+         mtime_t i_last_packet_ts;
+         mtime_t i_bytes_ts;
+         uint64_t i_packets;
+         uint32_t i_packets_passed;
+         int8_t i_last_cc;
+         uint8_t i_scrambling;
+         uint16_t i_reserved;
+      } ts_pid_hot_t;
+
       typedef struct ts_pid_t {
-         int i_refcount;
+         /* read for every packet */
+         output_t **pp_outputs; /* compact, no holes */
+         int i_nb_outputs;
          int i_psi_refcount;
          bool b_pes;
-         int8_t i_last_cc;
-         int i_demux_fd;
          /* b_emm is set to true when PID carries EMM packet
           and should be outputed in all services */
          bool b_emm;
+         int i_pes_status; /* pes + unscrambled */
 
-         /* PID info and stats */
-         mtime_t i_bytes_ts;
-         unsigned long i_packets_passed;
+         int i_refcount;
+         int i_demux_fd;
+
+         /* PID info and stats, see ts_pid_hot_t for the counters */
          ts_pid_info_t info;
 
          /* biTStream PSI section gathering */
          uint8_t *p_psi_buffer;
          uint16_t i_psi_buffer_used;
 
-         output_t **pp_outputs;
-         int i_nb_outputs;
+         /* last PCR (27 MHz) and its packet position, for --pcr-timing */
+         int64_t i_pcr;
+         uint64_t i_pcr_pos;
 
-         int i_pes_status; /* pes + unscrambled */
          struct cLev_timer timeout_watcher;
       } ts_pid_t;
 
-      struct eit_sections {
-         PSI_TABLE_DECLARE(data);
-      };
       /* EIT is carried in several separate tables, we need to track each table
-      separately, otherwise one table overwrites sections of another table */
+      separately, otherwise one table overwrites sections of another table.
+      The sections of a service are packed back to back in one arena and
+      indexed by schedule segment, the unit of LRU eviction */
+      struct eit_store_t;
+
+      typedef struct eit_segment_t {
+         struct eit_store_t *p_store;
+         struct eit_segment_t *p_lru_prev, *p_lru_next; /* schedule only */
+         uint32_t pi_offset[CLDVB_EIT_SEGMENT_SECTIONS]; /* in the arena */
+         uint32_t pi_crc[CLDVB_EIT_SEGMENT_SECTIONS];
+         uint16_t pi_length[CLDVB_EIT_SEGMENT_SECTIONS]; /* 0 if absent */
+         uint16_t i_index;                               /* in pp_segments */
+         uint16_t i_sid;
+      } eit_segment_t;
+
+      typedef struct eit_store_t {
+         uint8_t *p_arena;
+         uint32_t i_arena_size;
+         uint32_t i_arena_used;     /* appended so far */
+         uint32_t i_arena_dead;     /* replaced or evicted, until compaction */
+         eit_segment_t *pp_segments[EIT_STORE_SEGMENTS];
+      } eit_store_t;
 
       typedef struct sid_t {
          uint16_t i_sid, i_pmt_pid;
          uint8_t *p_current_pmt;
-         struct eit_sections eit_table[MAX_EIT_TABLES];
+         eit_store_t eit;
       } sid_t;
 
+      /* the program of a SID in the current PAT and the outputs
+       * selecting it, instead of scanning pp_sids and pp_outputs */
+      typedef struct sid_index_t {
+         sid_t *p_sid;
+         output_t *p_outputs;
+      } sid_index_t;
+
+      /* last accepted section per PID, table, extension and number:
+       * length, version, last section and CRC, open addressing */
+      typedef struct section_print_t {
+         uint64_t i_key;            /* 0 if free */
+         uint64_t i_print;
+      } section_print_t;
+
       PSI_TABLE_DECLARE(pp_current_pat_sections);
       PSI_TABLE_DECLARE(pp_next_pat_sections);
       PSI_TABLE_DECLARE(pp_current_cat_sections);
@@ -101,33 +149,111 @@ class cLdvbdemux : public cLdvben50221 {
       PSI_TABLE_DECLARE(pp_current_sdt_sections);
       PSI_TABLE_DECLARE(pp_next_sdt_sections);
       mtime_t i_last_dts;
+      /* PCR timing model: one reference PCR PID, its clock extrapolated
+       * to every packet and mapped to the wallclock */
+      bool b_pcr_timing;
+      uint16_t i_pcr_ref_pid;
+      uint64_t i_pcr_pos;           /* packets seen so far */
+      uint64_t i_pcr_ref_pos;
+      int64_t i_pcr_ref;            /* unwrapped 27 MHz since lock */
+      int64_t i_pcr_rate;           /* 27 MHz ticks per packet, 16.16 */
+      mtime_t i_pcr_ref_date;
+      mtime_t i_pcr_offset;         /* wallclock - PCR */
+      mtime_t i_pcr_lock_offset, i_pcr_lock_date;
+      mtime_t i_pcr_last_dts;
+      /* EIT store, most recently refreshed segment first */
+      eit_segment_t *p_eit_lru_first, *p_eit_lru_last;
+      size_t i_eit_memory_max;      /* 0 for no limit */
+      size_t i_eit_memory;          /* arenas and segments */
+      size_t i_eit_live;            /* bytes of stored sections */
+      int i_eit_segments;
+      uint64_t i_eit_stored, i_eit_unchanged, i_eit_evicted;
+      section_print_t *p_section_prints;
+      int i_nb_section_prints;
+      uint64_t i_sections_skipped;
       int i_demux_fd;
       uint64_t i_nb_packets;
       uint64_t i_nb_invalids;
       uint64_t i_nb_discontinuities;
       uint64_t i_nb_errors;
+      /* since start, the above are reset by the periodic print */
+      uint64_t i_total_packets;
+      uint64_t i_total_invalids;
+      uint64_t i_total_discontinuities;
+      uint64_t i_total_errors;
+      cLdvbstats *pstats;
+      const char *psz_stats_file;
+      uint64_t i_stats_last_packets;
+      mtime_t i_stats_last_date;
+      struct cLev_timer stats_watcher;
+      cLdvbmetrics *pmetrics;
+      const char *psz_metrics_addr;
       int i_tuner_errors;
       mtime_t i_last_error;
       mtime_t i_last_reset;
       struct cLev_timer print_watcher;
       struct cLev_timer quit_watcher;
       struct cLev_signal sigint_watcher, sigterm_watcher, sighup_watcher;
+      ts_pid_hot_t *p_pids_hot;
+      /* outputs receiving every packet (passthrough and duplication) */
+      output_t **pp_passthrough;
+      int i_nb_passthrough;
+
+      /* config file lines, parsed off the event loop and not modified
+       * while they are applied */
+      typedef struct config_file_t {
+            output_config_t *p_configs;
+            int i_nb_configs;
+            uint64_t i_parse_ns;
+      } config_file_t;
+
+      /* progress of a reload, applied a slice per loop iteration */
+      typedef struct config_reload_t {
+            config_file_t *p_file;
+            int i_next_config;
+            int i_next_output;           /* removal pass, once all lines are applied */
+            int i_added, i_changed, i_unchanged, i_removed;
+            int i_slices;
+            uint64_t i_start;
+      } config_reload_t;
+
+      pthread_t config_thread;
+      bool b_config_parsing;
+      bool b_config_pending;           /* reload requested meanwhile */
+      config_file_t *p_config_parsed;  /* handed over by config_thread */
+      config_reload_t config_reload;
+      struct cLev_async config_watcher;
+      struct cLev_timer config_apply_watcher;
 
       static void break_cb(void *loop, void *w, int revents);
       static void debug_cb(void *p, const char *fmt, ...);
       uint16_t map_es_pid(output_t * p_output, uint8_t *p_es, uint16_t i_pid);
       sid_t *FindSID(uint16_t i_sid);
+      void output_SetSID(output_t *p_output, uint16_t i_sid);
       static void PrintCb(void *loop, void *w, int revents);
+      static void StatsCb(void *loop, void *w, int revents);
+      void stats_Publish(void);
+      static void MetricsCb(cLdvbmetrics *pm, void *opaque);
+      void metrics_Render(cLdvbmetrics *pm);
       static void PrintESCb(void *loop, void *p, int revents);
       void PrintES(uint16_t i_pid);
-      void demux_Handle(block_t *p_ts);
+      void demux_Handle(block_t *p_ts, const cLdvbtsscan::ts_header_t *p_hdr);
       static bool IsIn(const uint16_t *pi_pids, int i_nb_pids, uint16_t i_pid);
       void SetDTS(block_t *p_list);
+      bool SetDTS_PCR(block_t *p_list);
       void SetPID(uint16_t i_pid);
       void SetPID_EMM(uint16_t i_pid);
       void UnsetPID(uint16_t i_pid);
       void StartPID(output_t *p_output, uint16_t i_pid);
       void StopPID(output_t *p_output, uint16_t i_pid);
+      void UpdatePassthrough(void);
+      config_file_t *config_Parse(void);
+      static void config_FileDelete(config_file_t *p_file);
+      void config_ApplyStart(config_file_t *p_file);
+      bool config_Apply(int i_max);
+      static void *config_Thread(void *p);
+      static void config_ParsedCb(void *loop, void *p, int revents);
+      static void config_ApplyCb(void *loop, void *p, int revents);
       void SelectPID(uint16_t i_sid, uint16_t i_pid, bool b_pcr);
       void UnselectPID(uint16_t i_sid, uint16_t i_pid);
       void SelectPMT(uint16_t i_sid, uint16_t i_pid);
@@ -143,10 +269,13 @@ class cLdvbdemux : public cLdvben50221 {
       void FlushEIT(output_t *p_output, mtime_t i_dts);
       void SendTDT(block_t *p_ts);
       void SendEMM(block_t *p_ts);
+      uint32_t pi_psi_generation[PSI_CACHE_KINDS];
+      unsigned int psi_Key(int i_kind, output_t *p_output, uint8_t *p_key);
+      void OutputPSICache(output_t *p_output, psi_cache_t *p_cache, uint16_t i_pid, uint8_t *pi_cc, mtime_t i_dts);
       void NewPAT(output_t *p_output);
       void CopyDescriptors(uint8_t *p_descs, uint8_t *p_current_descs);
       void NewPMT(output_t *p_output);
-      static void NewNIT(output_t *p_output);
+      void NewNIT(output_t *p_output);
       void NewSDT(output_t *p_output);
       void UpdatePAT(uint16_t i_sid);
       void UpdatePMT(uint16_t i_sid);
@@ -168,7 +297,23 @@ class cLdvbdemux : public cLdvben50221 {
       void HandleSDTSection(uint16_t i_pid, uint8_t *p_section, mtime_t i_dts);
       void HandleATSCSection(uint16_t i_pid, uint8_t *p_section, mtime_t i_dts);
       void HandleEIT(uint16_t i_pid, uint8_t *p_eit, mtime_t i_dts);
+      void eit_Store(sid_t *p_sid, uint8_t i_table, uint8_t i_section, const uint8_t *p_eit);
+      void eit_Touch(eit_segment_t *p_segment);
+      const uint8_t *eit_Refresh(sid_t *p_sid, const uint8_t *p_eit);
+      void eit_Unlink(eit_segment_t *p_segment);
+      void eit_Drop(eit_segment_t *p_segment);
+      void eit_Compact(eit_store_t *p_store, uint32_t i_size);
+      void eit_Evict(eit_segment_t *p_keep);
+      void eit_Clear(eit_store_t *p_store);
       void HandleSection(uint16_t i_pid, uint8_t *p_section, mtime_t i_dts);
+      void HandleRepeatedSection(uint16_t i_pid, uint8_t *p_section, mtime_t i_dts);
+      static uint64_t section_Key(uint16_t i_pid, const uint8_t *p_section);
+      static uint64_t section_Print(const uint8_t *p_section);
+      section_print_t *section_Find(uint64_t i_key);
+      bool section_Seen(uint16_t i_pid, const uint8_t *p_section);
+      void section_Accept(uint16_t i_pid, const uint8_t *p_section);
+      void section_AcceptTable(uint16_t i_pid, uint8_t **pp_sections);
+      void section_Forget(uint64_t i_key);
       void HandlePSIPacket(uint8_t *p_ts, mtime_t i_dts);
       static const char *h222_stream_type_desc(uint8_t i_stream_type);
       const char *get_pid_desc(uint16_t i_pid, uint16_t *i_sid);
@@ -177,6 +322,11 @@ class cLdvbdemux : public cLdvben50221 {
       static uint8_t **psi_unpack_sections(uint8_t *p_flat_sections, unsigned int i_size);
 
    protected:
+      /* demux_Run() timing, reset by the periodic print */
+      uint64_t i_demux_ns;
+      uint64_t i_scan_ns;           /* header decode and MRTG */
+      uint64_t i_demux_packets;
+
       mtime_t i_wallclock;
       cLdvbmrtgcnt *pmrtg;
       const char *psz_conf_file;
@@ -190,6 +340,7 @@ class cLdvbdemux : public cLdvben50221 {
       ts_pid_t p_pids[MAX_PIDS];
       sid_t **pp_sids;
       int i_nb_sids;
+      sid_index_t *p_sid_index;
       mtime_t i_quit_timeout_duration;
 
       bool SIDIsSelected(uint16_t i_sid);
@@ -215,6 +366,8 @@ class cLdvbdemux : public cLdvben50221 {
       virtual void dev_Reset() = 0;
       virtual int dev_SetFilter(uint16_t i_pid) = 0;
       virtual void dev_UnsetFilter(int i_fd, uint16_t i_pid) = 0;
+      /* input specific /metrics families (frontend), none by default */
+      virtual void dev_Metrics(cLdvbmetrics *pm) {};
 
    public:
       bool set_pid_map(char *s);
@@ -245,12 +398,25 @@ class cLdvbdemux : public cLdvben50221 {
       inline void set_es_timeout(mtime_t i) {
          this->i_es_timeout = i;
       }
+      inline void set_pcr_timing(bool b = true) {
+         this->b_pcr_timing = b;
+      }
+      inline void set_eit_memory(size_t i) {
+         this->i_eit_memory_max = i;
+      }
+      inline void set_stats_shm(const char *name) {
+         this->psz_stats_file = name;
+      }
+      inline void set_metrics(const char *addr) {
+         this->psz_metrics_addr = addr;
+      }
 
       bool demux_Setup(cLevCB sighandler = (cLevCB) 0, void *opaque = (void *) 0);
 
       void demux_Open();
       void demux_Close();
       void config_ReadFile();
+      void config_Reload();
 
       cLdvbdemux();
       virtual ~cLdvbdemux();
@@ -38,6 +38,7 @@ cLdvbdev::cLdvbdev()
    this->i_frontend = 0;
    this->i_dvr = 0;
    this->i_last_status = (enum fe_status) 0;
+   this->i_stats_valid = 0;
    this->p_freelist = (block_t *) 0;
 
    this->i_frequency = 0;
@@ -77,11 +78,7 @@ cLdvbdev::~cLdvbdev()
 
 int cLdvbdev::dev_PIDIsSelected(uint16_t i_pid)
 {
-   for (int i = 0; i < this->p_pids[i_pid].i_nb_outputs; i++)
-      if (this->p_pids[i_pid].pp_outputs[i] != (output_t *) 0)
-         return 1;
-
-   return 0;
+   return this->p_pids[i_pid].i_nb_outputs > 0;
 }
 
 void cLdvbdev::dev_ResendCAPMTs()
@@ -165,6 +162,15 @@ void cLdvbdev::DVRRead(void *loop, void *p, int revents)
    block_t *p_ts = pobj->p_freelist, **pp_current = &p_ts;
    struct iovec p_iov[DVB_MAX_READ_ONCE];
 
+   if (pobj->i_batch_size) {
+      if (pobj->block_ReadBatch(pobj->i_dvr, &p_ts) < 0 && errno != EAGAIN)
+         cLbugf(cL::dbg_dvb, "couldn't read from DVR device (%s)\n", strerror(errno));
+      if (p_ts != (block_t *) 0)
+         cLev_timer_again(loop, &pobj->mute_watcher);
+      pobj->demux_Run(p_ts);
+      return;
+   }
+
    for (i = 0; i < DVB_MAX_READ_ONCE; i++) {
       if ((*pp_current) == NULL) *pp_current = pobj->block_New();
       p_iov[i].iov_base = (*pp_current)->p_ts;
@@ -250,21 +256,64 @@ void cLdvbdev::dev_UnsetFilter(int i_fd, uint16_t i_pid)
 /*
  * Frontend
  */
+/* refresh the statistics cache, the metrics scrape only reads it */
+void cLdvbdev::FrontendStats(void)
+{
+   this->i_stats_valid = 0;
+   if (ioctl(this->i_frontend, FE_READ_BER, &this->i_stats_ber) >= 0)
+      this->i_stats_valid |= DVB_STATS_BER;
+   if (ioctl(this->i_frontend, FE_READ_SIGNAL_STRENGTH, &this->i_stats_strength) >= 0)
+      this->i_stats_valid |= DVB_STATS_STRENGTH;
+   if (ioctl(this->i_frontend, FE_READ_SNR, &this->i_stats_snr) >= 0)
+      this->i_stats_valid |= DVB_STATS_SNR;
+   if (ioctl(this->i_frontend, FE_READ_UNCORRECTED_BLOCKS, &this->i_stats_uncorrected) >= 0)
+      this->i_stats_valid |= DVB_STATS_UNCORRECTED;
+}
+
 void cLdvbdev::FrontendPrintCb(void *loop, void *p, int revents)
 {
    struct cLev_timer *w = (struct cLev_timer *) p;
    cLdvbdev *pobj = (cLdvbdev *) w->data;
 
-   uint32_t i_ber = 0;
-   uint16_t i_strength = 0, i_snr = 0;
-   uint32_t i_uncorrected = 0;
+   pobj->FrontendStats();
+   if (!pobj->i_print_period)
+      return;
 
-   ioctl(pobj->i_frontend, FE_READ_BER, &i_ber);
-   ioctl(pobj->i_frontend, FE_READ_SIGNAL_STRENGTH, &i_strength);
-   ioctl(pobj->i_frontend, FE_READ_SNR, &i_snr);
-   ioctl(pobj->i_frontend, FE_READ_UNCORRECTED_BLOCKS, &i_uncorrected);
+   cLbugf(cL::dbg_dvb, "frontend ber: %"PRIu32" strength: %"PRIu16" snr: %"PRIu16" uncorrected: %"PRIu32"\n",
+          (pobj->i_stats_valid & DVB_STATS_BER) ? pobj->i_stats_ber : 0,
+          (pobj->i_stats_valid & DVB_STATS_STRENGTH) ? pobj->i_stats_strength : 0,
+          (pobj->i_stats_valid & DVB_STATS_SNR) ? pobj->i_stats_snr : 0,
+          (pobj->i_stats_valid & DVB_STATS_UNCORRECTED) ? pobj->i_stats_uncorrected : 0);
+}
 
-   cLbugf(cL::dbg_dvb, "frontend ber: %"PRIu32" strength: %"PRIu16" snr: %"PRIu16" uncorrected: %"PRIu32"\n", i_ber, i_strength, i_snr, i_uncorrected);
+void cLdvbdev::dev_Metrics(cLdvbmetrics *pm)
+{
+   if (this->i_frontend == -1)
+      return;
+
+   pm->family("cldvb_frontend_lock", "gauge", "Frontend has lock");
+   pm->metricsf("cldvb_frontend_lock %d\n", (this->i_last_status & FE_HAS_LOCK) ? 1 : 0);
+   pm->family("cldvb_frontend_signal", "gauge", "Frontend has signal");
+   pm->metricsf("cldvb_frontend_signal %d\n", (this->i_last_status & FE_HAS_SIGNAL) ? 1 : 0);
+
+   /* driver units, as in the periodic print, cached by the frontend
+    * poll so a scrape never blocks on the driver */
+   if (this->i_stats_valid & DVB_STATS_SNR) {
+      pm->family("cldvb_frontend_snr", "gauge", "Frontend SNR (driver units)");
+      pm->metricsf("cldvb_frontend_snr %"PRIu16"\n", this->i_stats_snr);
+   }
+   if (this->i_stats_valid & DVB_STATS_STRENGTH) {
+      pm->family("cldvb_frontend_strength", "gauge", "Frontend signal strength (driver units)");
+      pm->metricsf("cldvb_frontend_strength %"PRIu16"\n", this->i_stats_strength);
+   }
+   if (this->i_stats_valid & DVB_STATS_BER) {
+      pm->family("cldvb_frontend_ber", "gauge", "Frontend bit error rate (driver units)");
+      pm->metricsf("cldvb_frontend_ber %"PRIu32"\n", this->i_stats_ber);
+   }
+   if (this->i_stats_valid & DVB_STATS_UNCORRECTED) {
+      pm->family("cldvb_frontend_uncorrected_blocks", "gauge", "Frontend uncorrected blocks (driver units)");
+      pm->metricsf("cldvb_frontend_uncorrected_blocks %"PRIu32"\n", this->i_stats_uncorrected);
+   }
 }
 
 #define IF_UP(x) } if (i_diff & (x)) { if (i_status & (x))
@@ -315,25 +364,25 @@ void cLdvbdev::FrontendRead(void  *loop, void *p, int revents)
 
       IF_UP(FE_HAS_LOCK)
       {
-         int32_t i_value = 0;
          cLbug(cL::dbg_dvb, "frontend has acquired lock\n");
 
          cLev_timer_stop(loop, &pobj->lock_watcher);
          cLev_timer_again(loop, &pobj->mute_watcher);
 
          /* Read some statistics */
-         if(ioctl(pobj->i_frontend, FE_READ_BER, &i_value) >= 0)
-            cLbugf(cL::dbg_dvb, "- Bit error rate: %d\n", i_value);
-         if(ioctl(pobj->i_frontend, FE_READ_SIGNAL_STRENGTH, &i_value) >= 0)
-            cLbugf(cL::dbg_dvb, "- Signal strength: %d\n", i_value);
-         if(ioctl(pobj->i_frontend, FE_READ_SNR, &i_value) >= 0)
-            cLbugf(cL::dbg_dvb, "- SNR: %d\n", i_value);
-
-         if (pobj->i_print_period) {
-            pobj->print_watcher.data = pobj;
-            cLev_timer_init(&pobj->print_watcher, cLdvbdev::FrontendPrintCb, pobj->i_print_period / 1000000., pobj->i_print_period / 1000000.);
-            cLev_timer_start(pobj->event_loop, &pobj->print_watcher);
-         }
+         pobj->FrontendStats();
+         if (pobj->i_stats_valid & DVB_STATS_BER)
+            cLbugf(cL::dbg_dvb, "- Bit error rate: %"PRIu32"\n", pobj->i_stats_ber);
+         if (pobj->i_stats_valid & DVB_STATS_STRENGTH)
+            cLbugf(cL::dbg_dvb, "- Signal strength: %"PRIu16"\n", pobj->i_stats_strength);
+         if (pobj->i_stats_valid & DVB_STATS_SNR)
+            cLbugf(cL::dbg_dvb, "- SNR: %"PRIu16"\n", pobj->i_stats_snr);
+
+         /* also keeps the metrics cache fresh when not printing */
+         mtime_t i_period = pobj->i_print_period ? pobj->i_print_period : DVB_FRONTEND_STATS_PERIOD;
+         pobj->print_watcher.data = pobj;
+         cLev_timer_init(&pobj->print_watcher, cLdvbdev::FrontendPrintCb, i_period / 1000000., i_period / 1000000.);
+         cLev_timer_start(pobj->event_loop, &pobj->print_watcher);
       } else {
          cLbug(cL::dbg_dvb, "frontend has lost lock\n");
 
@@ -342,8 +391,8 @@ void cLdvbdev::FrontendRead(void  *loop, void *p, int revents)
             cLev_timer_again(loop, &pobj->mute_watcher);
          }
 
-         if (pobj->i_print_period)
-            cLev_timer_stop(pobj->event_loop, &pobj->print_watcher);
+         cLev_timer_stop(pobj->event_loop, &pobj->print_watcher);
+         pobj->FrontendStats();
       }
 
       IF_UP(FE_REINIT)
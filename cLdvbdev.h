@@ -46,6 +46,13 @@
 #define DVB_DVR_READ_TIMEOUT     30000000 /* 30 s */
 #define DVB_MAX_READ_ONCE        50
 #define DVB_DVR_BUFFER_SIZE      40*188*1024 /* bytes */
+#define DVB_FRONTEND_STATS_PERIOD 1000000 /* 1 s, when not printing */
+
+/* frontend statistics read by the last poll */
+#define DVB_STATS_BER            0x1
+#define DVB_STATS_STRENGTH       0x2
+#define DVB_STATS_SNR            0x4
+#define DVB_STATS_UNCORRECTED    0x8
 
 class cLdvbdev : public cLdvbdemux {
 
@@ -54,6 +61,9 @@ class cLdvbdev : public cLdvbdemux {
       struct cLev_io frontend_watcher, dvr_watcher;
       struct cLev_timer lock_watcher, mute_watcher, print_watcher;
       fe_status_t i_last_status;
+      int i_stats_valid;
+      uint32_t i_stats_ber, i_stats_uncorrected;
+      uint16_t i_stats_strength, i_stats_snr;
       block_t *p_freelist;
 
       int i_frequency;
@@ -87,6 +97,7 @@ class cLdvbdev : public cLdvbdemux {
       static void DVRRead(void *loop, void *w, int revents);
       static void DVRMuteCb(void *loop, void *w, int revents);
       static void FrontendPrintCb(void *loop, void *w, int revents);
+      void FrontendStats(void);
       static void FrontendRead(void *loop, void *w, int revents);
       static void FrontendLockCb(void *loop, void *w, int revents);
       int FrontendDoDiseqc(void);
@@ -111,6 +122,7 @@ class cLdvbdev : public cLdvbdemux {
       virtual void dev_Reset();
       virtual int dev_SetFilter(uint16_t i_pid);
       virtual void dev_UnsetFilter(int i_fd, uint16_t i_pid);
+      virtual void dev_Metrics(cLdvbmetrics *pm);
 
    public:
       void set_dvb_buffer_size(int i);
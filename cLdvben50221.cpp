@@ -1788,6 +1788,23 @@ void cLdvben50221::en50221_Reset()
    }
 }
 
+void cLdvben50221::en50221_Metrics(cLdvbmetrics *pm)
+{
+   int i_sessions = 0;
+
+   if (this->i_ca_handle <= 0)
+      return;
+   for (int i = 0; i < MAX_SESSIONS; i++) {
+      if (this->p_sessions[i].i_resource_id)
+         i_sessions++;
+   }
+   pm->family("cldvb_cam_slot_active", "gauge", "CAM present and initialized in the CI slot");
+   for (int i_slot = 0; i_slot < this->i_nb_slots; i_slot++)
+      pm->metricsf("cldvb_cam_slot_active{slot=\"%d\"} %d\n", i_slot, this->p_slots[i_slot].b_active ? 1 : 0);
+   pm->family("cldvb_cam_sessions", "gauge", "Open EN 50221 sessions");
+   pm->metricsf("cldvb_cam_sessions %d\n", i_sessions);
+}
+
 
 void cLdvben50221::en50221_AddPMT(uint8_t *p_pmt)
 {
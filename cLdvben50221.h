@@ -29,6 +29,7 @@
 #define CLDVBEN50221_H_
 
 #include <cLdvboutput.h>
+#include <cLdvbmetrics.h>
 #include <stddef.h>
 #include <string.h>
 
@@ -266,6 +267,7 @@ class cLdvben50221 : public cLdvboutput {
 #ifdef HAVE_CLDVBHW
       void en50221_Init();
       void en50221_Reset();
+      void en50221_Metrics(cLdvbmetrics *pm);
       void en50221_AddPMT(uint8_t *p_pmt);
       void en50221_UpdatePMT(uint8_t *p_pmt);
       void en50221_DeletePMT(uint8_t *p_pmt);
@@ -287,6 +289,7 @@ class cLdvben50221 : public cLdvboutput {
       static inline void en50221_UpdatePMT(uint8_t *p_pmt) {};
       static inline void en50221_DeletePMT(uint8_t *p_pmt) {};
       static inline void en50221_Reset() {};
+      static inline void en50221_Metrics(cLdvbmetrics *pm) {};
 
 #endif //HAVE_CLDVBHW
 
@@ -29,6 +29,9 @@ typedef iofcLevCB iocLevCB;
 typedef void (*sigfcLevCB)(struct ev_loop *, struct ev_signal *, int);
 typedef sigfcLevCB sigcLevCB;
 
+typedef void (*asfcLevCB)(struct ev_loop *, struct ev_async *, int);
+typedef asfcLevCB ascLevCB;
+
 void cLev_timer_stop(void *pel, void *pet)
 {
    ev_timer_stop((struct ev_loop *)pel, (struct ev_timer *)pet);
@@ -98,3 +101,33 @@ void *cLev_default_loop(unsigned int flags)
 {
    return ev_default_loop(flags);
 }
+
+void *cLev_loop_new(unsigned int flags)
+{
+   return ev_loop_new(flags);
+}
+
+void cLev_loop_destroy(void *pel)
+{
+   ev_loop_destroy((struct ev_loop *)pel);
+}
+
+void cLev_async_init(void *pea, cLevCB cb)
+{
+   ev_async_init((struct ev_async *)pea, (ascLevCB)cb);
+}
+
+void cLev_async_start(void *pel, void *pea)
+{
+   ev_async_start((struct ev_loop *)pel, (struct ev_async *)pea);
+}
+
+void cLev_async_stop(void *pel, void *pea)
+{
+   ev_async_stop((struct ev_loop *)pel, (struct ev_async *)pea);
+}
+
+void cLev_async_send(void *pel, void *pea)
+{
+   ev_async_send((struct ev_loop *)pel, (struct ev_async *)pea);
+}
@@ -58,6 +58,15 @@ extern "C" {
          int signum;
    } cLev_signal;
 
+   typedef struct cLev_async {
+         int active;
+         int pending;
+         int priority;
+         void *data;
+         cLevCB cb;
+         volatile int sent;
+   } cLev_async;
+
    extern void cLev_timer_stop(void *pel, void *pet);
    extern void cLev_timer_set(void *pet, double after, double repeat);
    extern void cLev_timer_start(void *pel, void *pet);
@@ -72,6 +81,12 @@ extern "C" {
    extern void cLev_unref(void *pel);
    extern void cLev_run(void *pel, int flags);
    extern void *cLev_default_loop(unsigned int flags);
+   extern void *cLev_loop_new(unsigned int flags);
+   extern void cLev_loop_destroy(void *pel);
+   extern void cLev_async_init(void *pea, cLevCB cb);
+   extern void cLev_async_start(void *pel, void *pea);
+   extern void cLev_async_stop(void *pel, void *pea);
+   extern void cLev_async_send(void *pel, void *pea);
 
 #ifdef __cplusplus
 }
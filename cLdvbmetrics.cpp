@@ -0,0 +1,320 @@
+/*
+ * cLdvbmetrics.cpp
+ * Gokhan Poyraz <gokhan@kylone.com>
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include <cLdvbmetrics.h>
+
+#include <unistd.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <netdb.h>
+#include <sys/socket.h>
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+cLdvbmetrics::cLdvbmetrics()
+{
+   this->event_loop = (void *) 0;
+   this->i_fd = -1;
+   for (int i = 0; i < CLDVB_METRICS_MAX_CLIENTS; i++)
+      this->pp_clients[i] = (client_t *) 0;
+   this->pf_render = (render_t) 0;
+   this->p_opaque = (void *) 0;
+   this->p_buffer = (char *) 0;
+   this->i_buffer = 0;
+   this->i_buffer_size = 0;
+   this->i_requests = 0;
+   cLbug(cL::dbg_high, "cLdvbmetrics created\n");
+}
+
+cLdvbmetrics::~cLdvbmetrics()
+{
+   this->metricsClose();
+   cLbug(cL::dbg_high, "cLdvbmetrics deleted\n");
+}
+
+/* [host:]port or [v6 address]:port, host defaults to 127.0.0.1 */
+bool cLdvbmetrics::metricsOpen(void *loop, const char *psz_addr, render_t pf_render, void *opaque)
+{
+   char psz_host[256] = "127.0.0.1";
+   const char *psz_port = psz_addr;
+   const char *psz_colon = strrchr(psz_addr, ':');
+   struct addrinfo hints, *p_ai;
+   int i_one = 1, i_ret;
+
+   if (psz_colon != (char *) 0) {
+      const char *psz_start = psz_addr;
+      size_t i_len = psz_colon - psz_addr;
+      if (*psz_start == '[' && i_len >= 2 && psz_colon[-1] == ']') {
+         psz_start++;
+         i_len -= 2;
+      }
+      if (i_len >= sizeof(psz_host))
+         i_len = sizeof(psz_host) - 1;
+      if (i_len) {
+         memcpy(psz_host, psz_start, i_len);
+         psz_host[i_len] = '\0';
+      }
+      psz_port = psz_colon + 1;
+   }
+
+   memset(&hints, 0, sizeof(hints));
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+   hints.ai_flags = AI_PASSIVE;
+   if ((i_ret = getaddrinfo(psz_host, psz_port, &hints, &p_ai)) != 0) {
+      cLbugf(cL::dbg_dvb, "metrics: couldn't resolve %s (%s)\n", psz_addr, gai_strerror(i_ret));
+      return false;
+   }
+
+   if ((this->i_fd = socket(p_ai->ai_family, SOCK_STREAM, 0)) < 0
+         || setsockopt(this->i_fd, SOL_SOCKET, SO_REUSEADDR, &i_one, sizeof(i_one)) < 0
+         || fcntl(this->i_fd, F_SETFL, O_NONBLOCK) < 0
+         || bind(this->i_fd, p_ai->ai_addr, p_ai->ai_addrlen) < 0
+         || listen(this->i_fd, CLDVB_METRICS_MAX_CLIENTS) < 0) {
+      cLbugf(cL::dbg_dvb, "metrics: couldn't listen on %s (%s)\n", psz_addr, strerror(errno));
+      freeaddrinfo(p_ai);
+      if (this->i_fd >= 0)
+         close(this->i_fd);
+      this->i_fd = -1;
+      return false;
+   }
+   freeaddrinfo(p_ai);
+
+   this->event_loop = loop;
+   this->pf_render = pf_render;
+   this->p_opaque = opaque;
+   this->accept_watcher.data = this;
+   cLev_io_init(&this->accept_watcher, cLdvbmetrics::AcceptCb, this->i_fd, 1); //EV_READ
+   cLev_io_start(this->event_loop, &this->accept_watcher);
+
+   cLbugf(cL::dbg_dvb, "metrics: serving http://%s:%s/metrics\n", psz_host, psz_port);
+   return true;
+}
+
+void cLdvbmetrics::metricsClose()
+{
+   for (int i = 0; i < CLDVB_METRICS_MAX_CLIENTS; i++) {
+      if (this->pp_clients[i] != (client_t *) 0)
+         this->client_Close(this->pp_clients[i]);
+   }
+   if (this->i_fd >= 0) {
+      cLev_io_stop(this->event_loop, &this->accept_watcher);
+      close(this->i_fd);
+      this->i_fd = -1;
+   }
+   ::free(this->p_buffer);
+   this->p_buffer = (char *) 0;
+   this->i_buffer = this->i_buffer_size = 0;
+}
+
+void cLdvbmetrics::AcceptCb(void *loop, void *p, int revents)
+{
+   struct cLev_io *w = (struct cLev_io *)p;
+   cLdvbmetrics *pobj = (cLdvbmetrics *)w->data;
+
+   for (;;) {
+      int i_fd = accept(pobj->i_fd, (struct sockaddr *) 0, (socklen_t *) 0);
+      if (i_fd < 0) {
+         if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            cLbugf(cL::dbg_dvb, "metrics: accept failed (%s)\n", strerror(errno));
+         return;
+      }
+
+      int i;
+      for (i = 0; i < CLDVB_METRICS_MAX_CLIENTS; i++) {
+         if (pobj->pp_clients[i] == (client_t *) 0)
+            break;
+      }
+      if (i == CLDVB_METRICS_MAX_CLIENTS || fcntl(i_fd, F_SETFL, O_NONBLOCK) < 0) {
+         cLbug(cL::dbg_dvb, "metrics: too many scrapers, connection refused\n");
+         close(i_fd);
+         continue;
+      }
+#ifdef SO_NOSIGPIPE
+      int i_one = 1;
+      setsockopt(i_fd, SOL_SOCKET, SO_NOSIGPIPE, &i_one, sizeof(i_one));
+#endif
+
+      client_t *p_client = cLmalloc(client_t, 1);
+      p_client->pobj = pobj;
+      p_client->i_fd = i_fd;
+      p_client->i_request = 0;
+      p_client->p_response = (char *) 0;
+      p_client->i_response = p_client->i_sent = 0;
+      pobj->pp_clients[i] = p_client;
+
+      p_client->watcher.data = p_client;
+      cLev_io_init(&p_client->watcher, cLdvbmetrics::ReadCb, i_fd, 1); //EV_READ
+      cLev_io_start(loop, &p_client->watcher);
+      p_client->timeout_watcher.data = p_client;
+      cLev_timer_init(&p_client->timeout_watcher, cLdvbmetrics::TimeoutCb, CLDVB_METRICS_TIMEOUT, CLDVB_METRICS_TIMEOUT);
+      cLev_timer_start(loop, &p_client->timeout_watcher);
+   }
+}
+
+void cLdvbmetrics::ReadCb(void *loop, void *p, int revents)
+{
+   struct cLev_io *w = (struct cLev_io *)p;
+   client_t *p_client = (client_t *)w->data;
+   cLdvbmetrics *pobj = p_client->pobj;
+
+   ssize_t i_ret = recv(p_client->i_fd, p_client->p_request + p_client->i_request, sizeof(p_client->p_request) - 1 - p_client->i_request, 0);
+   if (i_ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+      return;
+   if (i_ret <= 0) {
+      pobj->client_Close(p_client);
+      return;
+   }
+   p_client->i_request += i_ret;
+   p_client->p_request[p_client->i_request] = '\0';
+   cLev_timer_again(loop, &p_client->timeout_watcher);
+
+   if (strstr(p_client->p_request, "\r\n\r\n") != (char *) 0 || strstr(p_client->p_request, "\n\n") != (char *) 0
+         || p_client->i_request == sizeof(p_client->p_request) - 1)
+      pobj->client_Respond(p_client);
+}
+
+void cLdvbmetrics::WriteCb(void *loop, void *p, int revents)
+{
+   struct cLev_io *w = (struct cLev_io *)p;
+   client_t *p_client = (client_t *)w->data;
+   cLdvbmetrics *pobj = p_client->pobj;
+
+   while (p_client->i_sent < p_client->i_response) {
+      ssize_t i_ret = send(p_client->i_fd, p_client->p_response + p_client->i_sent, p_client->i_response - p_client->i_sent, MSG_NOSIGNAL);
+      if (i_ret < 0) {
+         if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+            cLev_timer_again(loop, &p_client->timeout_watcher);
+            return;
+         }
+         break;
+      }
+      p_client->i_sent += i_ret;
+   }
+   pobj->client_Close(p_client);
+}
+
+void cLdvbmetrics::TimeoutCb(void *loop, void *p, int revents)
+{
+   struct cLev_timer *w = (struct cLev_timer *)p;
+   client_t *p_client = (client_t *)w->data;
+
+   cLbug(cL::dbg_dvb, "metrics: scraper timed out\n");
+   p_client->pobj->client_Close(p_client);
+}
+
+void cLdvbmetrics::client_Respond(client_t *p_client)
+{
+   const char *psz_status = "200 OK";
+   const char *psz_type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+   this->i_buffer = 0;
+   if (strncmp(p_client->p_request, "GET ", 4)) {
+      psz_status = "405 Method Not Allowed";
+      psz_type = "text/plain";
+      this->metricsf("only GET is supported\n");
+   } else
+   if (strncmp(p_client->p_request + 4, "/metrics", 8) || !strchr(" ?", p_client->p_request[12])) {
+      psz_status = "404 Not Found";
+      psz_type = "text/plain";
+      this->metricsf("try /metrics\n");
+   } else {
+      this->i_requests++;
+      this->pf_render(this, this->p_opaque);
+      this->family("cldvb_metrics_requests", "counter", "Scrapes served");
+      this->metricsf("cldvb_metrics_requests_total %"PRIu64"\n", this->i_requests);
+      this->metricsf("# EOF\n");
+   }
+
+   char psz_header[256];
+   int i_header = snprintf(psz_header, sizeof(psz_header), "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", psz_status, psz_type, this->i_buffer);
+   p_client->p_response = cLmalloc(char, i_header + this->i_buffer);
+   memcpy(p_client->p_response, psz_header, i_header);
+   memcpy(p_client->p_response + i_header, this->p_buffer, this->i_buffer);
+   p_client->i_response = i_header + this->i_buffer;
+   p_client->i_sent = 0;
+
+   /* the rest of the request is not needed, from now on we only write */
+   cLev_io_stop(this->event_loop, &p_client->watcher);
+   cLev_io_init(&p_client->watcher, cLdvbmetrics::WriteCb, p_client->i_fd, 2); //EV_WRITE
+   cLev_io_start(this->event_loop, &p_client->watcher);
+}
+
+void cLdvbmetrics::client_Close(client_t *p_client)
+{
+   for (int i = 0; i < CLDVB_METRICS_MAX_CLIENTS; i++) {
+      if (this->pp_clients[i] == p_client)
+         this->pp_clients[i] = (client_t *) 0;
+   }
+   cLev_io_stop(this->event_loop, &p_client->watcher);
+   cLev_timer_stop(this->event_loop, &p_client->timeout_watcher);
+   close(p_client->i_fd);
+   ::free(p_client->p_response);
+   ::free(p_client);
+}
+
+void cLdvbmetrics::metricsf(const char *psz_format, ...)
+{
+   va_list args;
+   int i_len;
+
+   for (;;) {
+      va_start(args, psz_format);
+      i_len = vsnprintf(this->p_buffer + this->i_buffer, this->i_buffer_size - this->i_buffer, psz_format, args);
+      va_end(args);
+      if (i_len < 0)
+         return;
+      if (this->i_buffer + i_len < this->i_buffer_size)
+         break;
+      this->i_buffer_size = (this->i_buffer + i_len + 1) * 2;
+      this->p_buffer = (char *)realloc(this->p_buffer, this->i_buffer_size);
+   }
+   this->i_buffer += i_len;
+}
+
+void cLdvbmetrics::family(const char *psz_name, const char *psz_type, const char *psz_help)
+{
+   this->metricsf("# TYPE %s %s\n# HELP %s %s\n", psz_name, psz_type, psz_name, psz_help);
+}
+
+/* copy of a label value with backslash, double quote and newline escaped
+ * as the text format requires, to be freed by the caller */
+char *cLdvbmetrics::label(const char *psz_value)
+{
+   char *psz_label = cLmalloc(char, 2 * strlen(psz_value) + 1);
+   char *p = psz_label;
+
+   if (psz_label == (char *) 0)
+      return (char *) 0;
+   for (; *psz_value; psz_value++) {
+      switch (*psz_value) {
+         case '\\': *p++ = '\\'; *p++ = '\\'; break;
+         case '"': *p++ = '\\'; *p++ = '"'; break;
+         case '\n': *p++ = '\\'; *p++ = 'n'; break;
+         default: *p++ = *psz_value; break;
+      }
+   }
+   *p = '\0';
+   return psz_label;
+}
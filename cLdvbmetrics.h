@@ -0,0 +1,80 @@
+/*
+ * cLdvbmetrics.h
+ * Gokhan Poyraz <gokhan@kylone.com>
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef CLDVB_METRICS_H_
+#define CLDVB_METRICS_H_
+
+#include <cLdvbev.h>
+#include <cLdvbcore.h>
+
+/*
+Minimal HTTP/1.0 listener on the event loop serving GET /metrics in the
+OpenMetrics text format. Every socket is non-blocking: a request is read
+as it arrives, the page is rendered once into a buffer by the owner's
+callback and written out whenever the socket accepts more, so a slow or
+stuck scraper only costs its buffer, never a wait in the event loop.
+ */
+class cLdvbmetrics {
+   public:
+      typedef void (*render_t)(cLdvbmetrics *pm, void *opaque);
+
+   private:
+      typedef struct client_t {
+            struct cLev_io watcher;
+            struct cLev_timer timeout_watcher;
+            cLdvbmetrics *pobj;
+            int i_fd;
+            char p_request[CLDVB_METRICS_REQUEST_SIZE];
+            size_t i_request;
+            char *p_response;
+            size_t i_response;
+            size_t i_sent;
+      } client_t;
+
+      void *event_loop;
+      int i_fd;
+      struct cLev_io accept_watcher;
+      client_t *pp_clients[CLDVB_METRICS_MAX_CLIENTS];
+      render_t pf_render;
+      void *p_opaque;
+      /* page being rendered */
+      char *p_buffer;
+      size_t i_buffer, i_buffer_size;
+      uint64_t i_requests;
+
+      static void AcceptCb(void *loop, void *p, int revents);
+      static void ReadCb(void *loop, void *p, int revents);
+      static void WriteCb(void *loop, void *p, int revents);
+      static void TimeoutCb(void *loop, void *p, int revents);
+      void client_Close(client_t *p_client);
+      void client_Respond(client_t *p_client);
+
+   public:
+      bool metricsOpen(void *loop, const char *psz_addr, render_t pf_render, void *opaque);
+      void metricsClose();
+      /* for the render callback */
+      void metricsf(const char *psz_format, ...) __attribute__((format(printf, 2, 3)));
+      void family(const char *psz_name, const char *psz_type, const char *psz_help);
+      static char *label(const char *psz_value);
+
+      cLdvbmetrics();
+      ~cLdvbmetrics();
+};
+
+#endif /*CLDVB_METRICS_H_*/
@@ -64,54 +64,49 @@ void cLdvbmrtgcnt::dumpCounts()
    }
 }
 
-// analyse the input block counting packets and errors
-// The input is a pointer to a cLdvboutput::block_t structure, which might be a linked list
+// analyse the input packets counting packets and errors
+// The input is the array of headers decoded by cLdvbtsscan for a batch
 // of blocks. Each block has one TS packet.
-void cLdvbmrtgcnt::mrtgAnalyse(cLdvboutput::block_t *p_ts)
+void cLdvbmrtgcnt::mrtgAnalyse(const cLdvbtsscan::ts_header_t *p_hdrs, int i_nb)
 {
    unsigned int i_pid;
-   cLdvboutput::block_t *p_block = p_ts;
 
    if (this->mrtg_fh == (FILE *) 0)
       return;
 
-   while (p_block != (cLdvboutput::block_t *) 0) {
-      uint8_t *ts_packet = p_block->p_ts;
+   for (int i = 0; i < i_nb; i++) {
+      uint8_t i_flags = p_hdrs[i].i_flags;
 
       char i_seq, i_last_seq;
       ++this->l_mrtg_packets;
 
-      if (ts_packet[0] != 0x47) {
+      if (!(i_flags & TS_HDR_SYNC)) {
          ++l_mrtg_error_packets;
-         p_block = p_block->p_next;
          continue;
       }
 
-      if (ts_packet[1] & 0x80) {
+      if (i_flags & TS_HDR_TRANSPORTERROR) {
          ++l_mrtg_error_packets;
-         p_block = p_block->p_next;
          continue;
       }
 
-      i_pid = (ts_packet[1] & 0x1f) << 8 | ts_packet[2];
+      i_pid = p_hdrs[i].i_pid;
 
       // Just count null packets - don't check the sequence numbering
-      if (i_pid == 0x1fff) {
-         p_block = p_block->p_next;
+      if (i_pid == 0x1fff)
          continue;
-      }
 
-      if (ts_packet[3] & 0xc0)
+      if (TS_HDR_SCRAMBLING(i_flags))
          ++l_mrtg_scram_packets;
 
       // Check the sequence numbering
-      i_seq = ts_packet[3] & 0xf;
+      i_seq = p_hdrs[i].i_cc;
       i_last_seq = i_pid_seq[i_pid];
 
       if (i_last_seq == -1) {
          // First packet - ignore the sequence
       } else
-      if (ts_packet[3] & 0x10) {
+      if (i_flags & TS_HDR_PAYLOAD) {
          // Packet contains payload - sequence should be up by one
          if (i_seq != ((i_last_seq + 1) & 0x0f))
             ++l_mrtg_seq_err_packets;
@@ -121,9 +116,6 @@ void cLdvbmrtgcnt::mrtgAnalyse(cLdvboutput::block_t *p_ts)
             ++l_mrtg_seq_err_packets;
       }
       i_pid_seq[i_pid] = i_seq;
-
-      // Look at next block
-      p_block = p_block->p_next;
    }
 
    // All blocks processed. See if we need to dump the stats
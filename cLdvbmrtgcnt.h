@@ -28,6 +28,7 @@
 #define CLDVB_MRTG_CNT_H_
 
 #include <cLdvboutput.h>
+#include <cLdvbtsscan.h>
 
 class cLdvbmrtgcnt {
    private:
@@ -48,7 +49,7 @@ class cLdvbmrtgcnt {
    public:
       int mrtgInit(const char *mrtg_file);
       void mrtgClose();
-      void mrtgAnalyse(cLdvboutput::block_t *p_ts);
+      void mrtgAnalyse(const cLdvbtsscan::ts_header_t *p_hdrs, int i_nb);
       cLdvbmrtgcnt();
       ~cLdvbmrtgcnt();
 };
@@ -37,14 +37,25 @@
 #include <bitstream/ietf/rtp.h>
 #include <bitstream/dvb/si/strings.h>
 #include <errno.h>
+#include <sched.h>
 #include <ctype.h> //isascii
 
 cLdvboutput::cLdvboutput()
 {
-   this->i_next_send = INT64_MAX;
-   this->i_wallclock = 0;
+   memset(&this->sched, 0, sizeof(output_sched_t));
+   this->sched.pobj = this;
+   this->sched.i_next_send = INT64_MAX;
+   this->p_shards = (output_shard_t *) 0;
+   this->i_nb_shards = 0;
+   this->i_nb_output_threads = 0;
    this->p_block_lifo = (cLdvboutput::block_t *) 0;
    this->i_block_count = 0;
+   this->i_block_pool_max = CLDVB_MAX_BLOCKS;
+   this->pp_block_slabs = (void **) 0;
+   this->i_nb_block_slabs = 0;
+   this->p_batch_lifo = (block_batch_t *) 0;
+   this->i_batch_carry = 0;
+   memset(&this->block_stats, 0, sizeof(block_stats_t));
    #ifdef HAVE_CLICONV
    this->conf_iconv = (iconv_t)-1;
    this->iconv_handle = (iconv_t)-1;
@@ -60,6 +71,10 @@ cLdvboutput::cLdvboutput()
    this->b_do_remap = false;
    this->pp_outputs = (output_t **) 0;
    this->i_nb_outputs = 0;
+   this->i_nb_free_outputs = 0;
+   this->pp_output_hash = (output_t **) 0;
+   this->i_output_hash_size = 0;
+   this->i_output_hash_count = 0;
    this->b_udp_global = false;
    this->b_dvb_global = false;
    this->b_epg_global = false;
@@ -72,6 +87,13 @@ cLdvboutput::cLdvboutput()
    this->psz_dup_config = (char *) 0;
    this->output_dup = new output_t;
    memset(this->output_dup, 0, sizeof(cLdvboutput::output_t));
+   this->b_send_mmsg = false;
+   this->b_null_outputs = false;
+   this->pp_psi_cache = (psi_cache_t **) 0;
+   this->i_nb_psi_cache = 0;
+   this->i_psi_built = 0;
+   this->i_psi_shared = 0;
+   this->i_batch_size = 0;
    cLbug(cL::dbg_high, "cLdvboutput created\n");
 }
 
@@ -81,26 +103,147 @@ cLdvboutput::~cLdvboutput()
    cLbug(cL::dbg_high, "cLdvboutput deleted\n");
 }
 
+/* carve CLDVB_BLOCK_SLAB_SIZE cache-aligned blocks from one allocation */
+void cLdvboutput::block_SlabNew(void)
+{
+   size_t i_stride = (sizeof(block_t) + CLDVB_CACHE_LINE - 1) & ~(CLDVB_CACHE_LINE - 1);
+   void *p_slab;
+
+   if (posix_memalign(&p_slab, CLDVB_CACHE_LINE, i_stride * CLDVB_BLOCK_SLAB_SIZE)) {
+      cLbug(cL::dbg_dvb, "couldn't allocate block slab\n");
+      return;
+   }
+   this->pp_block_slabs = cLrealloc(void *, this->pp_block_slabs, this->i_nb_block_slabs + 1);
+   this->pp_block_slabs[this->i_nb_block_slabs++] = p_slab;
+
+   for (int i = CLDVB_BLOCK_SLAB_SIZE - 1; i >= 0; i--) {
+      block_t *p_block = (block_t *)((uint8_t *)p_slab + i * i_stride);
+      p_block->b_pooled = true;
+      p_block->p_next = this->p_block_lifo;
+      this->p_block_lifo = p_block;
+   }
+   this->i_block_count += CLDVB_BLOCK_SLAB_SIZE;
+   this->block_stats.i_pooled += CLDVB_BLOCK_SLAB_SIZE;
+}
+
 cLdvboutput::block_t *cLdvboutput::block_New()
 {
    block_t *p_block;
 
+   this->block_stats.i_allocs++;
+   if (this->i_block_count) {
+      this->block_stats.i_hits++;
+   } else {
+      this->block_stats.i_misses++;
+      /* past the high-water mark, fall back to the heap */
+      if (this->block_stats.i_pooled < this->i_block_pool_max)
+         this->block_SlabNew();
+   }
+
    if (this->i_block_count) {
       p_block = this->p_block_lifo;
       this->p_block_lifo = p_block->p_next;
       this->i_block_count--;
    } else {
       p_block = cLmalloc(block_t, 1);
+      p_block->b_pooled = false;
    }
 
+   if (++this->block_stats.i_inflight > this->block_stats.i_peak)
+      this->block_stats.i_peak = this->block_stats.i_inflight;
+
+   p_block->p_ts = p_block->p_data;
+   p_block->p_buffer = (block_buffer_t *) 0;
    p_block->p_next = (block_t *) 0;
    p_block->i_refcount = 1;
    return p_block;
 }
 
+/* block referencing a TS packet in a shared buffer instead of copying it */
+cLdvboutput::block_t *cLdvboutput::block_NewView(block_buffer_t *p_buffer, uint8_t *p_ts)
+{
+   block_t *p_block = this->block_New();
+
+   p_block->p_ts = p_ts;
+   p_block->p_buffer = p_buffer;
+   p_buffer->i_refcount++;
+   return p_block;
+}
+
+cLdvboutput::block_batch_t *cLdvboutput::batch_New(void)
+{
+   block_batch_t *p_batch = this->p_batch_lifo;
+
+   if (p_batch != (block_batch_t *) 0) {
+      this->p_batch_lifo = p_batch->p_next;
+   } else {
+      p_batch = cLmalloc(block_batch_t, 1);
+      if (posix_memalign((void **)&p_batch->p_data, CLDVB_CACHE_LINE, this->i_batch_size)) {
+         ::free(p_batch);
+         return (block_batch_t *) 0;
+      }
+      p_batch->buffer.pf_release = cLdvboutput::batch_Release;
+      p_batch->buffer.p_opaque = this;
+      this->block_stats.i_batches++;
+   }
+   p_batch->buffer.i_refcount = 1; /* held by the reader */
+   p_batch->p_next = (block_batch_t *) 0;
+   return p_batch;
+}
+
+void cLdvboutput::batch_Release(void *p_opaque, block_buffer_t *p_buffer)
+{
+   cLdvboutput *pobj = (cLdvboutput *)p_opaque;
+   block_batch_t *p_batch = (block_batch_t *)p_buffer;
+
+   p_batch->p_next = pobj->p_batch_lifo;
+   pobj->p_batch_lifo = p_batch;
+}
+
+/* read as much as a batch buffer holds and return its TS packets as a
+ * chain of views, a trailing partial packet is kept for the next read */
+ssize_t cLdvboutput::block_ReadBatch(int i_fd, block_t **pp_chain)
+{
+   block_batch_t *p_batch = this->batch_New();
+   block_t **pp_current = pp_chain;
+   ssize_t i_ret;
+
+   *pp_chain = (block_t *) 0;
+   if (p_batch == (block_batch_t *) 0) {
+      errno = ENOMEM;
+      return -1;
+   }
+
+   memcpy(p_batch->p_data, this->p_batch_carry, this->i_batch_carry);
+   i_ret = read(i_fd, p_batch->p_data + this->i_batch_carry, this->i_batch_size - this->i_batch_carry);
+   if (i_ret > 0) {
+      size_t i_len = this->i_batch_carry + i_ret;
+      unsigned int i_nb = i_len / TS_SIZE;
+
+      this->i_batch_carry = i_len - i_nb * TS_SIZE;
+      memcpy(this->p_batch_carry, p_batch->p_data + i_nb * TS_SIZE, this->i_batch_carry);
+
+      for (unsigned int i = 0; i < i_nb; i++) {
+         *pp_current = this->block_NewView(&p_batch->buffer, p_batch->p_data + i * TS_SIZE);
+         pp_current = &(*pp_current)->p_next;
+      }
+   }
+
+   if (!--p_batch->buffer.i_refcount)
+      cLdvboutput::batch_Release(this, &p_batch->buffer);
+   return i_ret;
+}
+
 void cLdvboutput::block_Delete(block_t *p_block)
 {
-   if (this->i_block_count >= CLDVB_MAX_BLOCKS) {
+   if (p_block->p_buffer != (block_buffer_t *) 0) {
+      block_buffer_t *p_buffer = p_block->p_buffer;
+      if (!--p_buffer->i_refcount)
+         p_buffer->pf_release(p_buffer->p_opaque, p_buffer);
+      p_block->p_buffer = (block_buffer_t *) 0;
+   }
+   this->block_stats.i_inflight--;
+   if (!p_block->b_pooled) {
       ::free(p_block);
       return;
    }
@@ -120,11 +263,20 @@ void cLdvboutput::block_DeleteChain(block_t *p_block)
 
 void cLdvboutput::block_Vacuum()
 {
-   while (this->i_block_count) {
-      block_t *p_block = this->p_block_lifo;
-      this->p_block_lifo = p_block->p_next;
-      ::free(p_block);
-      this->i_block_count--;
+   for (int i = 0; i < this->i_nb_block_slabs; i++)
+      ::free(this->pp_block_slabs[i]);
+   ::free(this->pp_block_slabs);
+   this->pp_block_slabs = (void **) 0;
+   this->i_nb_block_slabs = 0;
+   this->p_block_lifo = (block_t *) 0;
+   this->i_block_count = 0;
+   this->block_stats.i_pooled = 0;
+
+   while (this->p_batch_lifo != (block_batch_t *) 0) {
+      block_batch_t *p_batch = this->p_batch_lifo;
+      this->p_batch_lifo = p_batch->p_next;
+      ::free(p_batch->p_data);
+      ::free(p_batch);
    }
 }
 
@@ -281,6 +433,31 @@ void cLdvboutput::config_Print(output_config_t *p_config)
    cLbugf(cL::dbg_dvb, psz_format, p_config->psz_displayname, p_config->i_config, p_config->i_sid, p_config->i_nb_pids);
 }
 
+/* same settings, the identity being compared by output_Find() */
+bool cLdvboutput::config_Equal(const output_config_t *p_1, const output_config_t *p_2)
+{
+   uint64_t i_mask = ~(uint64_t)(OUTPUT_VALID | OUTPUT_STILL_PRESENT);
+
+   /* the raw header settings aren't kept in the output config */
+   if ((p_1->i_config | p_2->i_config) & OUTPUT_RAW)
+      return false;
+   if ((p_1->i_config ^ p_2->i_config) & i_mask)
+      return false;
+   if (strcmp(p_1->psz_displayname, p_2->psz_displayname))
+      return false;
+   if (p_1->i_network_id != p_2->i_network_id || cLdvboutput::dvb_string_cmp(&p_1->network_name, &p_2->network_name) || cLdvboutput::dvb_string_cmp(&p_1->service_name, &p_2->service_name) || cLdvboutput::dvb_string_cmp(&p_1->provider_name, &p_2->provider_name))
+      return false;
+   if (memcmp(p_1->pi_ssrc, p_2->pi_ssrc, 4 * sizeof(uint8_t)) || p_1->i_output_latency != p_2->i_output_latency || p_1->i_max_retention != p_2->i_max_retention)
+      return false;
+   if (p_1->i_ttl != p_2->i_ttl || p_1->i_tos != p_2->i_tos || p_1->i_mtu != p_2->i_mtu || p_1->i_pace_burst != p_2->i_pace_burst)
+      return false;
+   if (p_1->i_tsid != p_2->i_tsid || p_1->i_sid != p_2->i_sid || p_1->i_new_sid != p_2->i_new_sid || p_1->i_onid != p_2->i_onid || p_1->b_passthrough != p_2->b_passthrough)
+      return false;
+   if (p_1->i_nb_pids != p_2->i_nb_pids || (p_1->i_nb_pids && memcmp(p_1->pi_pids, p_2->pi_pids, p_1->i_nb_pids * sizeof(uint16_t))))
+      return false;
+   return p_1->b_do_remap == p_2->b_do_remap && !memcmp(p_1->pi_confpids, p_2->pi_confpids, sizeof(uint16_t) * CLDVB_N_MAP_PIDS);
+}
+
 void cLdvboutput::config_Defaults(output_config_t *p_config)
 {
    this->config_Init(p_config);
@@ -288,6 +465,7 @@ void cLdvboutput::config_Defaults(output_config_t *p_config)
    p_config->i_config = (this->b_udp_global ? OUTPUT_UDP : 0) | (this->b_dvb_global ? OUTPUT_DVB : 0) | (this->b_epg_global ? OUTPUT_EPG : 0);
    p_config->i_max_retention = this->i_retention_global;
    p_config->i_output_latency = this->i_latency_global;
+   p_config->i_pace_burst = CLDVB_PACE_BURST;
    p_config->i_tsid = -1;
    p_config->i_ttl = this->i_ttl_global;
    memcpy(p_config->pi_ssrc, this->pi_ssrc_global, 4 * sizeof(uint8_t));
@@ -426,6 +604,14 @@ bool cLdvboutput::config_ParseHost(output_config_t *p_config, char *psz_string)
       if (IS_OPTION("latency=")) {
          p_config->i_output_latency = strtoll((const char *)ARG_OPTION("latency="), (char **) 0, 0) * 1000;
       } else
+      if (IS_OPTION("pace")) {
+         p_config->i_config |= OUTPUT_PACE;
+      } else
+      if (IS_OPTION("burst=")) {
+         p_config->i_pace_burst = strtol((const char *)ARG_OPTION("burst="), (char **) 0, 0);
+         if (p_config->i_pace_burst < 1)
+            p_config->i_pace_burst = 1;
+      } else
       if (IS_OPTION("ttl=")) {
          p_config->i_ttl = strtol((const char *)ARG_OPTION("ttl="), (char **) 0, 0);
       } else
@@ -567,7 +753,9 @@ cLdvboutput::packet_t *cLdvboutput::output_PacketNew(output_t *p_output)
       p_output->p_packet_lifo = p_packet->p_next;
       p_output->i_packet_count--;
    } else {
-      p_packet = (packet_t *)malloc(sizeof(packet_t) + cLdvboutput::output_BlockCount(p_output) * sizeof(block_t *));
+      int i_block_cnt = cLdvboutput::output_BlockCount(p_output);
+      p_packet = (packet_t *)malloc(sizeof(packet_t) + i_block_cnt * (sizeof(block_t *) + sizeof(uint16_t)));
+      p_packet->pi_remap_pids = (uint16_t *)(p_packet->pp_blocks + i_block_cnt);
    }
 
    p_packet->i_depth = 0;
@@ -597,13 +785,55 @@ void cLdvboutput::output_PacketVacuum(output_t *p_output)
    }
 }
 
-/* Init the mapped pids to unused */
+/* Init the mapped pids to unused, the table is kept for the next PMT */
 void cLdvboutput::init_pid_mapping(output_t *p_output)
 {
-   for (unsigned int i = 0; i < MAX_PIDS; i++) {
-      p_output->pi_newpids[i]  = UNUSED_PID;
-      p_output->pi_freepids[i] = UNUSED_PID;
+   p_output->i_nb_remaps = 0;
+}
+
+/* new PID of i_pid on this output, UNUSED_PID if it isn't remapped */
+uint16_t cLdvboutput::output_RemapPID(const output_t *p_output, uint16_t i_pid)
+{
+   int i_low = 0, i_high = p_output->i_nb_remaps;
+
+   while (i_low < i_high) {
+      int i_mid = (i_low + i_high) / 2;
+      if (p_output->p_remaps[i_mid].i_pid < i_pid)
+         i_low = i_mid + 1;
+      else
+         i_high = i_mid;
+   }
+   if (i_low < p_output->i_nb_remaps && p_output->p_remaps[i_low].i_pid == i_pid)
+      return p_output->p_remaps[i_low].i_newpid;
+   return UNUSED_PID;
+}
+
+bool cLdvboutput::output_RemapUsed(const output_t *p_output, uint16_t i_newpid)
+{
+   for (int i = 0; i < p_output->i_nb_remaps; i++) {
+      if (p_output->p_remaps[i].i_newpid == i_newpid)
+         return true;
    }
+   return false;
+}
+
+void cLdvboutput::output_RemapAdd(output_t *p_output, uint16_t i_pid, uint16_t i_newpid)
+{
+   int i;
+
+   for (i = 0; i < p_output->i_nb_remaps && p_output->p_remaps[i].i_pid < i_pid; i++);
+   if (i < p_output->i_nb_remaps && p_output->p_remaps[i].i_pid == i_pid) {
+      p_output->p_remaps[i].i_newpid = i_newpid;
+      return;
+   }
+   if (p_output->i_nb_remaps == p_output->i_max_remaps) {
+      p_output->i_max_remaps = p_output->i_max_remaps ? p_output->i_max_remaps * 2 : 8;
+      p_output->p_remaps = (pid_remap_t *)realloc(p_output->p_remaps, p_output->i_max_remaps * sizeof(pid_remap_t));
+   }
+   memmove(&p_output->p_remaps[i + 1], &p_output->p_remaps[i], (p_output->i_nb_remaps - i) * sizeof(pid_remap_t));
+   p_output->p_remaps[i].i_pid = i_pid;
+   p_output->p_remaps[i].i_newpid = i_newpid;
+   p_output->i_nb_remaps++;
 }
 
 /* set up the output initial config */
@@ -632,13 +862,13 @@ int cLdvboutput::output_Init(output_t *p_output, const output_config_t *p_config
    p_output->p_pmt_section = (uint8_t *) 0;
    p_output->p_nit_section = (uint8_t *) 0;
    p_output->p_sdt_section = (uint8_t *) 0;
+   p_output->p_pat_cache = p_output->p_pmt_cache = p_output->p_nit_cache = p_output->p_sdt_cache = (psi_cache_t *) 0;
    p_output->p_eit_ts_buffer = (block_t *) 0;
    if (this->b_random_tsid)
       p_output->i_tsid = rand() & 0xffff;
    p_output->i_pcr_pid = 0;
-
-   /* Init the mapped pids to unused */
-   this->init_pid_mapping(p_output);
+   p_output->p_remaps = (pid_remap_t *) 0;
+   p_output->i_nb_remaps = p_output->i_max_remaps = 0;
 
    /* Init socket-related fields */
    p_output->config.i_family = p_config->i_family;
@@ -699,12 +929,13 @@ int cLdvboutput::output_Init(output_t *p_output, const output_config_t *p_config
 /* create and insert the output_t structure */
 cLdvboutput::output_t *cLdvboutput::output_Create(const output_config_t *p_config)
 {
-   int i;
    output_t *p_output = (output_t *) 0;
 
-   for (i = 0; i < this->i_nb_outputs; i++) {
+   /* only look for a closed slot when there is one */
+   for (int i = 0; this->i_nb_free_outputs && i < this->i_nb_outputs; i++) {
       if (!(this->pp_outputs[i]->config.i_config & OUTPUT_VALID)) {
          p_output = this->pp_outputs[i];
+         this->i_nb_free_outputs--;
          break;
       }
    }
@@ -713,24 +944,29 @@ cLdvboutput::output_t *cLdvboutput::output_Create(const output_config_t *p_confi
       p_output = cLmalloc(output_t, 1);
       this->i_nb_outputs++;
       this->pp_outputs = (output_t **)realloc(this->pp_outputs, this->i_nb_outputs * sizeof(output_t *));
-      this->pp_outputs[i] = p_output;
+      this->pp_outputs[this->i_nb_outputs - 1] = p_output;
    }
 
-   if (this->output_Init(p_output, p_config) < 0)
+   if (this->output_Init(p_output, p_config) < 0) {
+      this->i_nb_free_outputs++;
       return (output_t *) 0;
+   }
 
+   this->output_HashInsert(p_output);
    return p_output;
 }
 
 void cLdvboutput::output_Close(output_t *p_output)
 {
    packet_t *p_packet = p_output->p_packets;
+
+   /* output_dup isn't indexed */
+   if (this->output_HashRemove(p_output))
+      this->i_nb_free_outputs++;
+
    while (p_packet != (packet_t *) 0) {
-      for (int i = 0; i < p_packet->i_depth; i++) {
-         p_packet->pp_blocks[i]->i_refcount--;
-         if (!p_packet->pp_blocks[i]->i_refcount)
-            this->block_Delete(p_packet->pp_blocks[i]);
-      }
+      for (int i = 0; i < p_packet->i_depth; i++)
+         this->block_Release(&this->sched, p_packet->pp_blocks[i]);
       p_output->p_packets = p_packet->p_next;
       this->output_PacketDelete(p_output, p_packet);
       p_packet = p_output->p_packets;
@@ -738,23 +974,33 @@ void cLdvboutput::output_Close(output_t *p_output)
    this->output_PacketVacuum(p_output);
 
    p_output->p_packets = p_output->p_last_packet = (packet_t *) 0;
-   ::free(p_output->p_pat_section);
-   ::free(p_output->p_pmt_section);
-   ::free(p_output->p_nit_section);
-   ::free(p_output->p_sdt_section);
-   ::free(p_output->p_eit_ts_buffer);
+   p_output->i_stat_queued = 0;
+   this->psi_CacheRelease(p_output->p_pat_cache);
+   this->psi_CacheRelease(p_output->p_pmt_cache);
+   this->psi_CacheRelease(p_output->p_nit_cache);
+   this->psi_CacheRelease(p_output->p_sdt_cache);
+   p_output->p_pat_section = p_output->p_pmt_section = p_output->p_nit_section = p_output->p_sdt_section = (uint8_t *) 0;
+   p_output->p_pat_cache = p_output->p_pmt_cache = p_output->p_nit_cache = p_output->p_sdt_cache = (psi_cache_t *) 0;
+   if (p_output->p_eit_ts_buffer != (block_t *) 0)
+      this->block_Delete(p_output->p_eit_ts_buffer);
    p_output->config.i_config &= ~OUTPUT_VALID;
+   if (p_output->p_shard != (output_shard_t *) 0) {
+      p_output->p_shard->i_nb_outputs--;
+      p_output->p_shard = (output_shard_t *) 0;
+   }
+
+   ::free(p_output->p_remaps);
+   p_output->p_remaps = (pid_remap_t *) 0;
+   p_output->i_nb_remaps = p_output->i_max_remaps = 0;
 
    close(p_output->i_handle);
    this->config_Free(&p_output->config);
 }
 
-void cLdvboutput::output_Flush(output_t *p_output)
+/* build the datagram of a packet, return the number of iovec entries */
+int cLdvboutput::output_Iov(output_t *p_output, packet_t *p_packet, struct iovec *p_iov, uint8_t *p_rtp_hdr, uint8_t *p_ts_hdrs, mtime_t i_wallclock)
 {
-   packet_t *p_packet = p_output->p_packets;
    int i_block_cnt = this->output_BlockCount(p_output);
-   struct iovec p_iov[i_block_cnt + 2];
-   uint8_t p_rtp_hdr[RTP_HEADER_SIZE];
    int i_iov = 0;
 
    if ((p_output->config.i_config & OUTPUT_RAW)) {
@@ -765,41 +1011,40 @@ void cLdvboutput::output_Flush(output_t *p_output)
 
    if (!(p_output->config.i_config & OUTPUT_UDP)) {
       p_iov[i_iov].iov_base = p_rtp_hdr;
-      p_iov[i_iov].iov_len = sizeof(p_rtp_hdr);
+      p_iov[i_iov].iov_len = RTP_HEADER_SIZE;
 
       rtp_set_hdr(p_rtp_hdr);
       rtp_set_type(p_rtp_hdr, RTP_TYPE_TS);
       rtp_set_seqnum(p_rtp_hdr, p_output->i_seqnum++);
       /* New timestamp based only on local time when sent */
       /* 90 kHz clock = 90000 counts per second */
-      rtp_set_timestamp(p_rtp_hdr, this->i_wallclock * 9 / 100);
+      rtp_set_timestamp(p_rtp_hdr, i_wallclock * 9 / 100);
       rtp_set_ssrc(p_rtp_hdr, p_output->config.pi_ssrc);
 
       i_iov++;
    }
 
+   /* blocks are shared between outputs and threads, a remapped PID is
+    * sent from a private copy of the TS header followed by the
+    * untouched payload */
    int i_block;
    for (i_block = 0; i_block < p_packet->i_depth; i_block++) {
-      /* Do pid mapping here if needed.
-       * save the original pid in the block.
-       * set the pid to the new pid
-       * later we re-instate the old pid for the next output
-       */
-      if (this->b_do_remap || p_output->config.b_do_remap) {
-         block_t *p_block = p_packet->pp_blocks[i_block];
-         uint16_t i_pid = ts_get_pid(p_block->p_ts);
-         p_block->tmp_pid = UNUSED_PID;
-         if (p_output->pi_newpids[i_pid] != UNUSED_PID) {
-            uint16_t i_newpid = p_output->pi_newpids[i_pid];
-            /* Need to map this pid to the new pid */
-            ts_set_pid(p_block->p_ts, i_newpid);
-            p_block->tmp_pid = i_pid;
-         }
+      uint8_t *p_ts = p_packet->pp_blocks[i_block]->p_ts;
+      uint16_t i_remap_pid = p_packet->pi_remap_pids[i_block];
+      if (i_remap_pid == UNUSED_PID) {
+         p_iov[i_iov].iov_base = p_ts;
+         p_iov[i_iov].iov_len = TS_SIZE;
+         i_iov++;
+         continue;
       }
-
-      p_iov[i_iov].iov_base = p_packet->pp_blocks[i_block]->p_ts;
-      p_iov[i_iov].iov_len = TS_SIZE;
-      i_iov++;
+      uint8_t *p_hdr = p_ts_hdrs + i_block * TS_HEADER_SIZE;
+      memcpy(p_hdr, p_ts, TS_HEADER_SIZE);
+      ts_set_pid(p_hdr, i_remap_pid);
+      p_iov[i_iov].iov_base = p_hdr;
+      p_iov[i_iov].iov_len = TS_HEADER_SIZE;
+      p_iov[i_iov + 1].iov_base = p_ts + TS_HEADER_SIZE;
+      p_iov[i_iov + 1].iov_len = TS_SIZE - TS_HEADER_SIZE;
+      i_iov += 2;
    }
 
    for (; i_block < i_block_cnt; i_block++) {
@@ -816,37 +1061,385 @@ void cLdvboutput::output_Flush(output_t *p_output)
       p_output->raw_pkt_header.udph.len = htons(sizeof(struct udpheader) + i_payload_len);
    }
 
-   if (writev(p_output->i_handle, p_iov, i_iov) < 0) {
+   return i_iov;
+}
+
+/* release the first packet of an output once it has been sent */
+void cLdvboutput::output_Pop(output_sched_t *p_sched, output_t *p_output)
+{
+   packet_t *p_packet = p_output->p_packets;
+
+   for (int i_block = 0; i_block < p_packet->i_depth; i_block++)
+      this->block_Release(p_sched, p_packet->pp_blocks[i_block]);
+   p_output->i_stat_datagrams++;
+   p_output->i_stat_bytes += p_packet->i_depth * TS_SIZE;
+   p_output->i_stat_queued--;
+   p_output->i_stat_latency = p_sched->i_wallclock - p_packet->i_dts;
+   cLdvboutput::period_Update(&p_output->stats_latency_max, p_output->i_stat_latency);
+   p_output->i_stat_latency_sum += p_output->i_stat_latency;
+   p_output->pi_stat_latency[cLdvboutput::latency_Bucket(p_output->i_stat_latency)]++;
+   if (p_output->i_stat_latency > p_output->config.i_output_latency + CLDVB_OUTPUT_LATE_SLACK)
+      p_output->i_stat_late++;
+
+   p_output->p_packets = p_packet->p_next;
+   this->output_PacketDelete(p_output, p_packet);
+   if (p_output->p_packets == (packet_t *) 0)
+      p_output->p_last_packet = (packet_t *) 0;
+}
+
+void cLdvboutput::output_Flush(output_sched_t *p_sched, output_t *p_output)
+{
+   int i_block_cnt = this->output_BlockCount(p_output);
+   struct iovec p_iov[2 * i_block_cnt + 2];
+   uint8_t p_rtp_hdr[RTP_HEADER_SIZE];
+   uint8_t p_ts_hdrs[i_block_cnt * TS_HEADER_SIZE];
+   int i_iov = this->output_Iov(p_output, p_output->p_packets, p_iov, p_rtp_hdr, p_ts_hdrs, p_sched->i_wallclock);
+
+   if (!this->b_null_outputs && writev(p_output->i_handle, p_iov, i_iov) < 0) {
       cLbugf(cL::dbg_dvb, "couldn't writev to %s (%s)\n", p_output->config.psz_displayname, strerror(errno));
+      p_output->i_stat_send_errors++;
    }
    /* Update the wallclock because writev() can take some time. */
-   this->i_wallclock = this->mdate();
+   p_sched->i_wallclock = this->mdate();
+   __sync_fetch_and_add(&p_sched->i_nb_datagrams, 1);
+   __sync_fetch_and_add(&p_sched->i_nb_send_calls, 1);
 
-   for (i_block = 0; i_block < p_packet->i_depth; i_block++) {
-      p_packet->pp_blocks[i_block]->i_refcount--;
-      if (!p_packet->pp_blocks[i_block]->i_refcount) {
-         this->block_Delete(p_packet->pp_blocks[i_block]);
-      } else
-      if (this->b_do_remap || p_output->config.b_do_remap) {
-         /* still referenced so re-instate the orignial pid if remapped */
-         block_t *p_block = p_packet->pp_blocks[i_block];
-         if (p_block->tmp_pid != UNUSED_PID)
-            ts_set_pid(p_block->p_ts, p_block->tmp_pid);
+   this->output_Pop(p_sched, p_output);
+}
+
+#ifdef HAVE_CLLINUX
+/* send every due packet of an output, up to CLDVB_OUTPUT_MAX_MMSG
+ * datagrams per sendmmsg() call */
+void cLdvboutput::output_FlushBatch(output_sched_t *p_sched, output_t *p_output)
+{
+   int i_block_cnt = this->output_BlockCount(p_output);
+   struct mmsghdr p_msgs[CLDVB_OUTPUT_MAX_MMSG];
+   struct iovec p_iov[CLDVB_OUTPUT_MAX_MMSG][2 * i_block_cnt + 2];
+   uint8_t p_rtp_hdr[CLDVB_OUTPUT_MAX_MMSG][RTP_HEADER_SIZE];
+   uint8_t p_ts_hdrs[CLDVB_OUTPUT_MAX_MMSG][i_block_cnt * TS_HEADER_SIZE];
+
+   while (p_output->p_packets != (packet_t *) 0 && p_output->p_packets->i_dts + p_output->config.i_output_latency <= p_sched->i_wallclock) {
+      packet_t *p_packet = p_output->p_packets;
+      int i_msgs = 0;
+
+      while (p_packet != (packet_t *) 0 && p_packet->i_dts + p_output->config.i_output_latency <= p_sched->i_wallclock && i_msgs < CLDVB_OUTPUT_MAX_MMSG) {
+         memset(&p_msgs[i_msgs], 0, sizeof(struct mmsghdr));
+         p_msgs[i_msgs].msg_hdr.msg_iov = p_iov[i_msgs];
+         p_msgs[i_msgs].msg_hdr.msg_iovlen = this->output_Iov(p_output, p_packet, p_iov[i_msgs], p_rtp_hdr[i_msgs], p_ts_hdrs[i_msgs], p_sched->i_wallclock);
+         p_packet = p_packet->p_next;
+         i_msgs++;
       }
+
+      /* sendmmsg() may stop early, resume until everything is out or
+       * the socket reports an error */
+      int i_sent = this->b_null_outputs ? i_msgs : 0;
+      while (i_sent < i_msgs) {
+         int i_ret = sendmmsg(p_output->i_handle, p_msgs + i_sent, i_msgs - i_sent, 0);
+         __sync_fetch_and_add(&p_sched->i_nb_send_calls, 1);
+         if (i_ret < 0) {
+            cLbugf(cL::dbg_dvb, "couldn't sendmmsg to %s (%s)\n", p_output->config.psz_displayname, strerror(errno));
+            p_output->i_stat_send_errors += i_msgs - i_sent;
+            break;
+         }
+         i_sent += i_ret;
+      }
+      /* Update the wallclock because sendmmsg() can take some time. */
+      p_sched->i_wallclock = this->mdate();
+      __sync_fetch_and_add(&p_sched->i_nb_datagrams, i_msgs);
+
+      for (int i = 0; i < i_msgs; i++)
+         this->output_Pop(p_sched, p_output);
+   }
+}
+#endif
+
+/* measure the bitrate of a paced output and refill its bucket, the
+ * rate gets some headroom so that the queue drains */
+void cLdvboutput::output_PaceRefill(output_t *p_output, mtime_t i_wallclock)
+{
+   if (!p_output->i_pace_window) {
+      p_output->i_pace_window = p_output->i_pace_refill = i_wallclock;
+      return;
+   }
+
+   if (i_wallclock - p_output->i_pace_window >= CLDVB_PACE_WINDOW) {
+      uint64_t i_rate = p_output->i_pace_bytes * 1000000 / (i_wallclock - p_output->i_pace_window);
+      uint64_t i_old = p_output->i_pace_rate;
+      p_output->i_pace_rate = i_old ? (i_old * 3 + i_rate) / 4 : i_rate;
+      p_output->i_pace_bytes = 0;
+      p_output->i_pace_window = i_wallclock;
+#if defined(HAVE_CLLINUX) && defined(SO_MAX_PACING_RATE)
+      /* let the fq qdisc pace as well, if it is there */
+      if (p_output->i_pace_rate > i_old + i_old / 16 || p_output->i_pace_rate < i_old - i_old / 16) {
+         uint32_t i_max_rate = p_output->i_pace_rate + p_output->i_pace_rate / 16;
+         setsockopt(p_output->i_handle, SOL_SOCKET, SO_MAX_PACING_RATE, &i_max_rate, sizeof(i_max_rate));
+      }
+#endif
+   }
+
+   int64_t i_max = (int64_t)p_output->config.i_pace_burst * this->output_BlockCount(p_output) * TS_SIZE * 1000000;
+   p_output->i_pace_credit += (i_wallclock - p_output->i_pace_refill) * (int64_t)(p_output->i_pace_rate + p_output->i_pace_rate / 32);
+   if (p_output->i_pace_credit > i_max)
+      p_output->i_pace_credit = i_max;
+   p_output->i_pace_refill = i_wallclock;
+}
+
+/* a paced packet leaves when the bucket holds its size, or at the latest
+ * at its latency deadline; the last packet waits until it is full */
+void cLdvboutput::output_Pace(output_sched_t *p_sched, output_t *p_output)
+{
+   int i_block_cnt = this->output_BlockCount(p_output);
+
+   this->output_PaceRefill(p_output, p_sched->i_wallclock);
+   while (p_output->p_packets != (packet_t *) 0) {
+      packet_t *p_packet = p_output->p_packets;
+      int64_t i_cost = (int64_t)p_packet->i_depth * TS_SIZE * 1000000;
+
+      if (p_packet->i_dts + p_output->config.i_output_latency > p_sched->i_wallclock) {
+         if (p_packet == p_output->p_last_packet && p_packet->i_depth < i_block_cnt)
+            break;
+         if (p_output->i_pace_credit < i_cost)
+            break;
+      }
+      /* forced sends may overdraw, down to one burst */
+      p_output->i_pace_credit -= i_cost;
+      if (p_output->i_pace_credit < -(int64_t)p_output->config.i_pace_burst * i_block_cnt * TS_SIZE * 1000000)
+         p_output->i_pace_credit = -(int64_t)p_output->config.i_pace_burst * i_block_cnt * TS_SIZE * 1000000;
+
+      /* jitter: departure gap against the one of the measured rate */
+      if (p_output->i_pace_rate && p_output->i_pace_last_send) {
+         mtime_t i_gap = p_sched->i_wallclock - p_output->i_pace_last_send;
+         mtime_t i_ideal = i_cost / p_output->i_pace_rate;
+         mtime_t i_jitter = i_gap > i_ideal ? i_gap - i_ideal : i_ideal - i_gap;
+         p_output->i_pace_jitter_sum += i_jitter;
+         cLdvboutput::period_Update(&p_output->pace_jitter_max, i_jitter);
+         p_output->i_pace_sends++;
+      }
+      p_output->i_pace_last_send = p_sched->i_wallclock;
+
+      this->output_Flush(p_sched, p_output);
+      this->output_PaceRefill(p_output, p_sched->i_wallclock);
+   }
+}
+
+/* date at which the first packet of an output can leave */
+cLdvboutput::mtime_t cLdvboutput::output_NextSend(output_sched_t *p_sched, output_t *p_output)
+{
+   packet_t *p_packet = p_output->p_packets;
+   mtime_t i_deadline = p_packet->i_dts + p_output->config.i_output_latency;
+
+   if (!(p_output->config.i_config & OUTPUT_PACE) || !p_output->i_pace_rate)
+      return i_deadline;
+   if (p_packet == p_output->p_last_packet && p_packet->i_depth < this->output_BlockCount(p_output))
+      return i_deadline;
+
+   int64_t i_missing = (int64_t)p_packet->i_depth * TS_SIZE * 1000000 - p_output->i_pace_credit;
+   mtime_t i_date = p_sched->i_wallclock;
+   if (i_missing > 0)
+      i_date += i_missing / (int64_t)(p_output->i_pace_rate + p_output->i_pace_rate / 32) + 1;
+   return i_date < i_deadline ? i_date : i_deadline;
+}
+
+/* take a reference on the section generated for the same key from the
+ * same source table, if there is one */
+cLdvboutput::psi_cache_t *cLdvboutput::psi_CacheGet(int i_kind, uint32_t i_generation, const uint8_t *p_key, unsigned int i_key_size)
+{
+   for (int i = 0; i < this->i_nb_psi_cache; i++) {
+      psi_cache_t *p_cache = this->pp_psi_cache[i];
+      if (p_cache->i_kind == i_kind && p_cache->i_generation == i_generation && p_cache->p_key != (uint8_t *) 0
+            && p_cache->i_key_size == i_key_size && !memcmp(p_cache->p_key, p_key, i_key_size)) {
+         p_cache->i_refcount++;
+         this->i_psi_shared++;
+         return p_cache;
+      }
+   }
+   return (psi_cache_t *) 0;
+}
+
+/* register a freshly built section, a null key keeps it private */
+cLdvboutput::psi_cache_t *cLdvboutput::psi_CachePut(uint8_t *p_section, int i_kind, uint32_t i_generation, const uint8_t *p_key, unsigned int i_key_size)
+{
+   psi_cache_t *p_cache = cLmalloc(psi_cache_t, 1);
+
+   p_cache->p_section = p_section;
+   p_cache->i_refcount = 1;
+   p_cache->p_packets = (uint8_t *) 0;
+   p_cache->i_nb_packets = 0;
+   p_cache->i_packets_pid = UNUSED_PID;
+   p_cache->i_kind = i_kind;
+   p_cache->i_generation = i_generation;
+   p_cache->p_key = (uint8_t *) 0;
+   p_cache->i_key_size = 0;
+   if (p_key != (const uint8_t *) 0) {
+      p_cache->p_key = cLmalloc(uint8_t, i_key_size);
+      memcpy(p_cache->p_key, p_key, i_key_size);
+      p_cache->i_key_size = i_key_size;
+   }
+   this->i_psi_built++;
+
+   this->pp_psi_cache = (psi_cache_t **)realloc(this->pp_psi_cache, sizeof(psi_cache_t *) * (this->i_nb_psi_cache + 1));
+   p_cache->i_index = this->i_nb_psi_cache;
+   this->pp_psi_cache[this->i_nb_psi_cache++] = p_cache;
+   return p_cache;
+}
+
+void cLdvboutput::psi_CacheRelease(psi_cache_t *p_cache)
+{
+   if (p_cache == (psi_cache_t *) 0 || --p_cache->i_refcount)
+      return;
+
+   psi_cache_t *p_last = this->pp_psi_cache[--this->i_nb_psi_cache];
+   this->pp_psi_cache[p_cache->i_index] = p_last;
+   p_last->i_index = p_cache->i_index;
+   ::free(p_cache->p_section);
+   ::free(p_cache->p_packets);
+   ::free(p_cache->p_key);
+   ::free(p_cache);
+}
+
+/* the section split in TS packets for a PID, built on first use */
+const uint8_t *cLdvboutput::psi_CachePackets(psi_cache_t *p_cache, uint16_t i_pid, int *pi_nb_packets)
+{
+   if (p_cache->p_packets == (uint8_t *) 0 || p_cache->i_packets_pid != i_pid) {
+      uint16_t i_section_length = psi_get_length(p_cache->p_section) + PSI_HEADER_SIZE;
+      uint16_t i_section_offset = 0;
+
+      p_cache->i_nb_packets = 0;
+      do {
+         uint8_t *p;
+         uint8_t i_ts_offset = 0;
+
+         p_cache->p_packets = (uint8_t *)realloc(p_cache->p_packets, (p_cache->i_nb_packets + 1) * TS_SIZE);
+         p = p_cache->p_packets + p_cache->i_nb_packets++ * TS_SIZE;
+         psi_split_section(p, &i_ts_offset, p_cache->p_section, &i_section_offset);
+         ts_set_pid(p, i_pid);
+         ts_set_cc(p, 0);
+         if (i_section_offset == i_section_length)
+            psi_split_end(p, &i_ts_offset);
+      } while (i_section_offset < i_section_length);
+      p_cache->i_packets_pid = i_pid;
+   }
+
+   *pi_nb_packets = p_cache->i_nb_packets;
+   return p_cache->p_packets;
+}
+
+void cLdvboutput::outputs_PrintPacing(void)
+{
+   for (int i = 0; i < this->i_nb_outputs; i++) {
+      output_t *p_output = this->pp_outputs[i];
+      if (!(p_output->config.i_config & OUTPUT_VALID) || !(p_output->config.i_config & OUTPUT_PACE))
+         continue;
+      /* written by the sending thread, only deltas are taken here */
+      uint64_t i_sum = p_output->i_pace_jitter_sum, i_sends = p_output->i_pace_sends;
+      uint64_t i_period_sends = i_sends - p_output->i_print_pace_sends;
+      mtime_t i_avg = i_period_sends ? (mtime_t)((i_sum - p_output->i_print_pace_jitter_sum) / i_period_sends) : (mtime_t)0;
+      p_output->i_print_pace_jitter_sum = i_sum;
+      p_output->i_print_pace_sends = i_sends;
+      cLbugf(cL::dbg_dvb, "pacing %s: %"PRIu64" bits/s, jitter %"PRId64" us avg, %"PRId64" us max\n", p_output->config.psz_displayname, p_output->i_pace_rate * 8, i_avg, cLdvboutput::period_Next(&p_output->pace_jitter_max));
+   }
+}
+
+/* per destination delay from input to send since the previous print,
+ * percentiles are the upper bound of their histogram bucket */
+void cLdvboutput::outputs_PrintLatency(void)
+{
+   for (int i = 0; i < this->i_nb_outputs; i++) {
+      output_t *p_output = this->pp_outputs[i];
+      uint64_t pi_hist[CLDVB_LATENCY_BUCKETS], i_total = 0;
+      int i_bucket, i_max = 0;
+
+      if (!(p_output->config.i_config & OUTPUT_VALID))
+         continue;
+      for (i_bucket = 0; i_bucket < CLDVB_LATENCY_BUCKETS; i_bucket++) {
+         uint64_t i_count = p_output->pi_stat_latency[i_bucket];
+         pi_hist[i_bucket] = i_count - p_output->pi_print_latency[i_bucket];
+         p_output->pi_print_latency[i_bucket] = i_count;
+         i_total += pi_hist[i_bucket];
+         if (pi_hist[i_bucket])
+            i_max = i_bucket;
+      }
+      uint64_t i_late = p_output->i_stat_late - p_output->i_print_late;
+      /* a queue that didn't grow during the period peaked where it is */
+      unsigned int i_queued = p_output->i_stat_queued;
+      unsigned int i_queued_max = cLdvboutput::period_Next(&p_output->print_queued_max);
+      if (i_queued > i_queued_max)
+         i_queued_max = i_queued;
+      p_output->i_print_late = p_output->i_stat_late;
+      if (!i_total)
+         continue;
+
+      mtime_t i_p50 = -1, i_p99 = 0;
+      uint64_t i_seen = 0;
+      for (i_bucket = 0; i_bucket < CLDVB_LATENCY_BUCKETS; i_bucket++) {
+         i_seen += pi_hist[i_bucket];
+         if (i_p50 < 0 && i_seen * 2 >= i_total)
+            i_p50 = cLdvboutput::latency_BucketMax(i_bucket);
+         if (i_seen * 100 >= i_total * 99) {
+            i_p99 = cLdvboutput::latency_BucketMax(i_bucket);
+            break;
+         }
+      }
+      cLbugf(cL::dbg_dvb, "latency %s: %"PRIu64" datagrams, p50 %"PRId64" us, p99 %"PRId64" us, max %"PRId64" us, %"PRIu64" late, queue max %u\n", p_output->config.psz_displayname, i_total, i_p50, i_p99, cLdvboutput::latency_BucketMax(i_max), i_late, i_queued_max);
+   }
+}
+
+/* send every due packet of an output */
+void cLdvboutput::output_Send(output_sched_t *p_sched, output_t *p_output)
+{
+   if (p_output->config.i_config & OUTPUT_PACE) {
+      this->output_Pace(p_sched, p_output);
+      return;
+   }
+#ifdef HAVE_CLLINUX
+   if (this->b_send_mmsg) {
+      this->output_FlushBatch(p_sched, p_output);
+      return;
+   }
+#endif
+   while (p_output->p_packets != (packet_t *) 0 && p_output->p_packets->i_dts + p_output->config.i_output_latency <= p_sched->i_wallclock)
+      this->output_Flush(p_sched, p_output);
+}
+
+/* drop a reference held by an output; the pool belongs to the main
+ * thread, so workers hand the last reference back through their queue */
+void cLdvboutput::block_Release(output_sched_t *p_sched, block_t *p_block)
+{
+   if (__sync_sub_and_fetch(&p_block->i_refcount, 1))
+      return;
+   if (p_sched->p_shard == (output_shard_t *) 0) {
+      this->block_Delete(p_block);
+      return;
+   }
+   shard_queue_t *p_queue = &p_sched->p_shard->back;
+   while (!this->queue_Push(p_queue, (output_t *) 0, p_block)) {
+      this->queue_Publish(p_queue);
+      sched_yield();
    }
-   p_output->p_packets = p_packet->p_next;
-   this->output_PacketDelete(p_output, p_packet);
-   if (p_output->p_packets == (packet_t *) 0)
-      p_output->p_last_packet = (packet_t *) 0;
 }
 
 void cLdvboutput::output_Put(output_t *p_output, block_t *p_block)
+{
+   /* the remap table belongs to the demux thread, resolve it here */
+   uint16_t i_remap_pid = UNUSED_PID;
+   if (p_output->i_nb_remaps)
+      i_remap_pid = cLdvboutput::output_RemapPID(p_output, ts_get_pid(p_block->p_ts));
+
+   __sync_fetch_and_add(&p_block->i_refcount, 1);
+
+   if (p_output->p_shard != (output_shard_t *) 0) {
+      this->shard_Push(p_output->p_shard, p_output, p_block, i_remap_pid);
+      return;
+   }
+   this->output_Enqueue(&this->sched, p_output, p_block, i_remap_pid);
+}
+
+/* append a referenced block to the packets of an output */
+void cLdvboutput::output_Enqueue(output_sched_t *p_sched, output_t *p_output, block_t *p_block, uint16_t i_remap_pid)
 {
    int i_block_cnt = this->output_BlockCount(p_output);
    packet_t *p_packet;
 
-   p_block->i_refcount++;
-
    if ((p_output->p_last_packet != (packet_t *) 0) && (p_output->p_last_packet->i_depth < i_block_cnt) && ((p_output->p_last_packet->i_dts + p_output->config.i_max_retention) > p_block->i_dts)) {
       p_packet = p_output->p_last_packet;
       if (ts_has_adaptation(p_block->p_ts) && ts_get_adaptation(p_block->p_ts) && tsaf_has_pcr(p_block->p_ts)) {
@@ -861,65 +1454,419 @@ void cLdvboutput::output_Put(output_t *p_output, block_t *p_block)
          p_output->p_packets = p_packet;
       }
       p_output->p_last_packet = p_packet;
+      if (++p_output->i_stat_queued > p_output->i_stat_queued_max)
+         p_output->i_stat_queued_max = p_output->i_stat_queued;
+      cLdvboutput::period_Update(&p_output->print_queued_max, p_output->i_stat_queued);
    }
 
    p_packet->pp_blocks[p_packet->i_depth] = p_block;
+   p_packet->pi_remap_pids[p_packet->i_depth] = i_remap_pid;
    p_packet->i_depth++;
 
-   if (this->i_next_send > p_packet->i_dts + p_output->config.i_output_latency) {
-      this->i_next_send = p_packet->i_dts + p_output->config.i_output_latency;
-      cLev_timer_stop(this->event_loop, &this->output_watcher);
-      cLev_timer_set(&this->output_watcher, (this->i_next_send - this->i_wallclock) / 1000000., 0);
-      cLev_timer_start(this->event_loop, &this->output_watcher);
+   mtime_t i_next_send = p_packet->i_dts + p_output->config.i_output_latency;
+   if (p_output->config.i_config & OUTPUT_PACE) {
+      p_output->i_pace_bytes += TS_SIZE;
+      i_next_send = this->output_NextSend(p_sched, p_output);
+   }
+   if (p_sched->i_next_send > i_next_send) {
+      p_sched->i_next_send = i_next_send;
+      /* workers re-arm their own timer once their queue is drained */
+      if (p_sched->p_shard == (output_shard_t *) 0) {
+         cLev_timer_stop(p_sched->loop, &p_sched->output_watcher);
+         cLev_timer_set(&p_sched->output_watcher, (p_sched->i_next_send - p_sched->i_wallclock) / 1000000., 0);
+         cLev_timer_start(p_sched->loop, &p_sched->output_watcher);
+      }
    }
 }
 
-void cLdvboutput::outputs_Send(void *loop, void *p, int revents)
+/* send the due packets of the outputs owned by a loop, and re-arm its timer */
+void cLdvboutput::outputs_Run(output_sched_t *p_sched)
 {
-   cLev_timer *w = (cLev_timer *)p;
-   cLdvboutput *pobj = (cLdvboutput *)w->data;
-   pobj->i_wallclock = cLdvbobj::mdate();
    do {
-      pobj->i_next_send = INT64_MAX;
-      if (pobj->output_dup->config.i_config & OUTPUT_VALID) {
-         while (pobj->output_dup->p_packets != (packet_t *) 0 && pobj->output_dup->p_packets->i_dts + pobj->output_dup->config.i_output_latency <= pobj->i_wallclock)
-            pobj->output_Flush(pobj->output_dup);
-         if (pobj->output_dup->p_packets != (packet_t *) 0)
-            pobj->i_next_send = pobj->output_dup->p_packets->i_dts + pobj->output_dup->config.i_output_latency;
+      p_sched->i_next_send = INT64_MAX;
+      if (p_sched->p_shard == (output_shard_t *) 0 && (this->output_dup->config.i_config & OUTPUT_VALID)) {
+         this->output_Send(p_sched, this->output_dup);
+         if (this->output_dup->p_packets != (packet_t *) 0)
+            p_sched->i_next_send = this->output_dup->p_packets->i_dts + this->output_dup->config.i_output_latency;
       }
 
-      for (int i = 0; i < pobj->i_nb_outputs; i++) {
-         output_t *p_output = pobj->pp_outputs[i];
-         if (!(p_output->config.i_config & OUTPUT_VALID))
+      for (int i = 0; i < this->i_nb_outputs; i++) {
+         output_t *p_output = this->pp_outputs[i];
+         if (!(p_output->config.i_config & OUTPUT_VALID) || p_output->p_shard != p_sched->p_shard)
             continue;
-         while (p_output->p_packets != (packet_t *) 0 && p_output->p_packets->i_dts + p_output->config.i_output_latency <= pobj->i_wallclock)
-            pobj->output_Flush(p_output);
-         if (p_output->p_packets != (packet_t *) 0 && (p_output->p_packets->i_dts + p_output->config.i_output_latency < pobj->i_next_send))
-            pobj->i_next_send = p_output->p_packets->i_dts + p_output->config.i_output_latency;
+         this->output_Send(p_sched, p_output);
+         if (p_output->p_packets != (packet_t *) 0) {
+            mtime_t i_next_send = this->output_NextSend(p_sched, p_output);
+            if (i_next_send < p_sched->i_next_send)
+               p_sched->i_next_send = i_next_send;
+         }
       }
    }
-   while (pobj->i_next_send <= pobj->i_wallclock);
-   if (pobj->i_next_send < INT64_MAX) {
-      cLev_timer_set(&pobj->output_watcher, (pobj->i_next_send - pobj->i_wallclock) / 1000000., 0);
-      cLev_timer_start(loop, &pobj->output_watcher);
+   while (p_sched->i_next_send <= p_sched->i_wallclock);
+   cLev_timer_stop(p_sched->loop, &p_sched->output_watcher);
+   if (p_sched->i_next_send < INT64_MAX) {
+      cLev_timer_set(&p_sched->output_watcher, (p_sched->i_next_send - p_sched->i_wallclock) / 1000000., 0);
+      cLev_timer_start(p_sched->loop, &p_sched->output_watcher);
    }
 }
 
+void cLdvboutput::outputs_Send(void *loop, void *p, int revents)
+{
+   cLev_timer *w = (cLev_timer *)p;
+   output_sched_t *p_sched = (output_sched_t *)w->data;
+   cLdvboutput *pobj = p_sched->pobj;
+   if (p_sched->p_shard != (output_shard_t *) 0) {
+      pobj->shard_Run(p_sched->p_shard);
+      return;
+   }
+   p_sched->i_wallclock = cLdvbobj::mdate();
+   pobj->outputs_Run(p_sched);
+}
+
 void cLdvboutput::outputs_Init(void)
 {
-   this->i_wallclock = this->mdate();
-   this->output_watcher.data = this;
-   cLev_timer_init(&this->output_watcher, cLdvboutput::outputs_Send, 0, 0);
+   this->sched.i_wallclock = this->mdate();
 }
 
-/* output_Find : find an existing output from a given output_config_t */
-cLdvboutput::output_t *cLdvboutput::output_Find(const output_config_t *p_config)
+void cLdvboutput::queue_Init(shard_queue_t *p_queue, unsigned int i_size)
 {
-   socklen_t i_sockaddr_len = (p_config->i_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+   memset(p_queue, 0, sizeof(shard_queue_t));
+   p_queue->p_msgs = cLmalloc(shard_msg_t, i_size);
+   p_queue->i_mask = i_size - 1;
+}
+
+/* producer side, the entry is only visible after queue_Publish() */
+bool cLdvboutput::queue_Push(shard_queue_t *p_queue, output_t *p_output, block_t *p_block, uint16_t i_remap_pid)
+{
+   if (p_queue->i_write - p_queue->i_tail > p_queue->i_mask)
+      return false;
+   shard_msg_t *p_msg = &p_queue->p_msgs[p_queue->i_write & p_queue->i_mask];
+   p_msg->p_output = p_output;
+   p_msg->p_block = p_block;
+   p_msg->i_remap_pid = i_remap_pid;
+   p_queue->i_write++;
+   return true;
+}
+
+void cLdvboutput::queue_Publish(shard_queue_t *p_queue)
+{
+   if (p_queue->i_head == p_queue->i_write)
+      return;
+   __sync_synchronize();
+   p_queue->i_head = p_queue->i_write;
+}
+
+void cLdvboutput::shard_Push(output_shard_t *p_shard, output_t *p_output, block_t *p_block, uint16_t i_remap_pid)
+{
+   if (!this->queue_Push(&p_shard->in, p_output, p_block, i_remap_pid)) {
+      /* the worker is late, drop rather than stall the demux */
+      p_shard->i_nb_drops++;
+      p_output->i_stat_drops++;
+      if (!__sync_sub_and_fetch(&p_block->i_refcount, 1))
+         this->block_Delete(p_block);
+   }
+}
+
+/* called with the shard lock held, by the worker or the main thread */
+void cLdvboutput::shard_Drain(output_shard_t *p_shard)
+{
+   shard_queue_t *p_queue = &p_shard->in;
+   unsigned int i_head = p_queue->i_head;
+   __sync_synchronize();
+
+   for (unsigned int i = p_queue->i_tail; i != i_head; i++) {
+      shard_msg_t *p_msg = &p_queue->p_msgs[i & p_queue->i_mask];
+      output_t *p_output = p_msg->p_output;
+      if ((p_output->config.i_config & OUTPUT_VALID) && p_output->p_shard == p_shard)
+         this->output_Enqueue(&p_shard->sched, p_output, p_msg->p_block, p_msg->i_remap_pid);
+      else
+         this->block_Release(&p_shard->sched, p_msg->p_block);
+   }
+   __sync_synchronize();
+   p_queue->i_tail = i_head;
+}
+
+void cLdvboutput::shard_Run(output_shard_t *p_shard)
+{
+   pthread_mutex_lock(&p_shard->lock);
+   this->shard_Drain(p_shard);
+   p_shard->sched.i_wallclock = this->mdate();
+   this->outputs_Run(&p_shard->sched);
+   this->queue_Publish(&p_shard->back);
+   pthread_mutex_unlock(&p_shard->lock);
+}
+
+void cLdvboutput::shard_Wakeup(void *loop, void *p, int revents)
+{
+   cLev_async *w = (cLev_async *)p;
+   output_shard_t *p_shard = (output_shard_t *)w->data;
+   if (p_shard->b_die) {
+      cLev_break(loop, 2); //EVBREAK_ALL
+      return;
+   }
+   p_shard->sched.pobj->shard_Run(p_shard);
+}
+
+void *cLdvboutput::shard_Thread(void *p)
+{
+   output_shard_t *p_shard = (output_shard_t *)p;
+   cLev_run(p_shard->sched.loop, 0);
+   return (void *) 0;
+}
+
+void cLdvboutput::outputs_StartShards(void)
+{
+   this->p_shards = cLmalloc(output_shard_t, this->i_nb_output_threads);
+
+   for (int i = 0; i < this->i_nb_output_threads; i++) {
+      output_shard_t *p_shard = &this->p_shards[i];
+      memset(p_shard, 0, sizeof(output_shard_t));
+      p_shard->sched.pobj = this;
+      p_shard->sched.p_shard = p_shard;
+      p_shard->sched.i_next_send = INT64_MAX;
+      p_shard->sched.loop = cLev_loop_new(0);
+      if (p_shard->sched.loop == (void *) 0) {
+         cLbug(cL::dbg_dvb, "couldn't create output loop\n");
+         break;
+      }
+      p_shard->sched.output_watcher.data = &p_shard->sched;
+      cLev_timer_init(&p_shard->sched.output_watcher, cLdvboutput::outputs_Send, 0, 0);
+      p_shard->wakeup_watcher.data = p_shard;
+      cLev_async_init(&p_shard->wakeup_watcher, cLdvboutput::shard_Wakeup);
+      cLev_async_start(p_shard->sched.loop, &p_shard->wakeup_watcher);
+      pthread_mutex_init(&p_shard->lock, (pthread_mutexattr_t *) 0);
+      this->queue_Init(&p_shard->in, CLDVB_OUTPUT_QUEUE_SIZE);
+      this->queue_Init(&p_shard->back, CLDVB_OUTPUT_QUEUE_SIZE);
+
+      if (pthread_create(&p_shard->thread, (pthread_attr_t *) 0, cLdvboutput::shard_Thread, p_shard)) {
+         cLbugf(cL::dbg_dvb, "couldn't create output thread (%s)\n", strerror(errno));
+         ::free(p_shard->in.p_msgs);
+         ::free(p_shard->back.p_msgs);
+         pthread_mutex_destroy(&p_shard->lock);
+         cLev_loop_destroy(p_shard->sched.loop);
+         break;
+      }
+      this->i_nb_shards++;
+   }
+   cLbugf(cL::dbg_dvb, "output: %d worker threads\n", this->i_nb_shards);
+}
+
+void cLdvboutput::outputs_StopShards(void)
+{
+   for (int i = 0; i < this->i_nb_shards; i++) {
+      output_shard_t *p_shard = &this->p_shards[i];
+      p_shard->b_die = true;
+      cLev_async_send(p_shard->sched.loop, &p_shard->wakeup_watcher);
+      pthread_join(p_shard->thread, (void **) 0);
+   }
+
+   /* the main thread owns everything again */
+   for (int i = 0; i < this->i_nb_shards; i++) {
+      output_shard_t *p_shard = &this->p_shards[i];
+      this->queue_Publish(&p_shard->in);
+      this->shard_Drain(p_shard);
+      this->queue_Publish(&p_shard->back);
+   }
+   this->outputs_Reclaim();
+
+   for (int i = 0; i < this->i_nb_outputs; i++)
+      this->pp_outputs[i]->p_shard = (output_shard_t *) 0;
+
+   for (int i = 0; i < this->i_nb_shards; i++) {
+      output_shard_t *p_shard = &this->p_shards[i];
+      cLev_timer_stop(p_shard->sched.loop, &p_shard->sched.output_watcher);
+      cLev_async_stop(p_shard->sched.loop, &p_shard->wakeup_watcher);
+      cLev_loop_destroy(p_shard->sched.loop);
+      pthread_mutex_destroy(&p_shard->lock);
+      ::free(p_shard->in.p_msgs);
+      ::free(p_shard->back.p_msgs);
+   }
+   ::free(this->p_shards);
+   this->p_shards = (output_shard_t *) 0;
+   this->i_nb_shards = 0;
+}
+
+/* pause the workers so that outputs can be changed, pending blocks are
+ * moved to the outputs they were queued for */
+void cLdvboutput::outputs_Lock(void)
+{
+   for (int i = 0; i < this->i_nb_shards; i++) {
+      output_shard_t *p_shard = &this->p_shards[i];
+      /* a worker may be waiting for us to empty its return queue */
+      while (pthread_mutex_trylock(&p_shard->lock)) {
+         this->outputs_Reclaim();
+         sched_yield();
+      }
+      this->queue_Publish(&p_shard->in);
+      this->shard_Drain(p_shard);
+   }
+}
+
+void cLdvboutput::outputs_Unlock(void)
+{
+   for (int i = 0; i < this->i_nb_shards; i++) {
+      output_shard_t *p_shard = &this->p_shards[i];
+      pthread_mutex_unlock(&p_shard->lock);
+      cLev_async_send(p_shard->sched.loop, &p_shard->wakeup_watcher);
+   }
+   /* outputs may have moved back to the main loop */
+   if (this->i_nb_shards) {
+      this->sched.i_wallclock = this->mdate();
+      this->outputs_Run(&this->sched);
+   }
+}
+
+/* spread the outputs over the workers, must be called locked */
+void cLdvboutput::outputs_Balance(void)
+{
+   bool b_shardable = this->i_nb_shards != 0;
+
    for (int i = 0; i < this->i_nb_outputs; i++) {
       output_t *p_output = this->pp_outputs[i];
+      output_shard_t *p_shard = (output_shard_t *) 0;
+
       if (!(p_output->config.i_config & OUTPUT_VALID))
          continue;
+      if (b_shardable) {
+         p_shard = p_output->p_shard;
+         if (p_shard == (output_shard_t *) 0) {
+            /* least loaded worker */
+            p_shard = &this->p_shards[0];
+            for (int j = 1; j < this->i_nb_shards; j++)
+               if (this->p_shards[j].i_nb_outputs < p_shard->i_nb_outputs)
+                  p_shard = &this->p_shards[j];
+         }
+      }
+      if (p_output->p_shard != p_shard) {
+         if (p_output->p_shard != (output_shard_t *) 0)
+            p_output->p_shard->i_nb_outputs--;
+         if (p_shard != (output_shard_t *) 0)
+            p_shard->i_nb_outputs++;
+         p_output->p_shard = p_shard;
+      }
+   }
+}
+
+/* make the blocks queued by the demux visible to the workers */
+void cLdvboutput::outputs_Publish(void)
+{
+   for (int i = 0; i < this->i_nb_shards; i++) {
+      output_shard_t *p_shard = &this->p_shards[i];
+      if (p_shard->in.i_write == p_shard->in.i_head)
+         continue;
+      this->queue_Publish(&p_shard->in);
+      cLev_async_send(p_shard->sched.loop, &p_shard->wakeup_watcher);
+   }
+}
+
+/* put the blocks released by the workers back into the pool */
+void cLdvboutput::outputs_Reclaim(void)
+{
+   for (int i = 0; i < this->i_nb_shards; i++) {
+      shard_queue_t *p_queue = &this->p_shards[i].back;
+      unsigned int i_head = p_queue->i_head;
+      __sync_synchronize();
+
+      for (unsigned int j = p_queue->i_tail; j != i_head; j++)
+         this->block_Delete(p_queue->p_msgs[j & p_queue->i_mask].p_block);
+      __sync_synchronize();
+      p_queue->i_tail = i_head;
+   }
+}
+
+void cLdvboutput::outputs_Stats(uint64_t *pi_datagrams, uint64_t *pi_send_calls, uint64_t *pi_drops)
+{
+   *pi_datagrams = __sync_lock_test_and_set(&this->sched.i_nb_datagrams, 0);
+   *pi_send_calls = __sync_lock_test_and_set(&this->sched.i_nb_send_calls, 0);
+   *pi_drops = 0;
+   for (int i = 0; i < this->i_nb_shards; i++) {
+      output_shard_t *p_shard = &this->p_shards[i];
+      *pi_datagrams += __sync_lock_test_and_set(&p_shard->sched.i_nb_datagrams, 0);
+      *pi_send_calls += __sync_lock_test_and_set(&p_shard->sched.i_nb_send_calls, 0);
+      *pi_drops += p_shard->i_nb_drops;
+      p_shard->i_nb_drops = 0;
+   }
+}
+
+/* FNV-1a of the identity compared by output_Find(): family, connect and
+ * bind addresses (port included) and the IPv6 interface */
+uint32_t cLdvboutput::output_Hash(const output_config_t *p_config)
+{
+   socklen_t i_sockaddr_len = (p_config->i_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+   const uint8_t *p_connect = (const uint8_t *)&p_config->connect_addr;
+   const uint8_t *p_bind = (const uint8_t *)&p_config->bind_addr;
+   uint32_t i_hash = 2166136261U;
+
+   i_hash = (i_hash ^ (uint8_t)p_config->i_family) * 16777619U;
+   for (socklen_t i = 0; i < i_sockaddr_len; i++)
+      i_hash = (i_hash ^ p_connect[i]) * 16777619U;
+   for (socklen_t i = 0; i < i_sockaddr_len; i++)
+      i_hash = (i_hash ^ p_bind[i]) * 16777619U;
+   if (p_config->i_family == AF_INET6)
+      i_hash = (i_hash ^ (uint32_t)p_config->i_if_index_v6) * 16777619U;
+   return i_hash;
+}
+
+void cLdvboutput::output_HashResize(unsigned int i_size)
+{
+   output_t **pp_hash = cLmalloc(output_t *, i_size);
+   memset(pp_hash, 0, i_size * sizeof(output_t *));
+
+   for (unsigned int i = 0; i < this->i_output_hash_size; i++) {
+      output_t *p_output = this->pp_output_hash[i];
+      while (p_output != (output_t *) 0) {
+         output_t *p_next = p_output->p_hash_next;
+         unsigned int i_bucket = cLdvboutput::output_Hash(&p_output->config) & (i_size - 1);
+         p_output->p_hash_next = pp_hash[i_bucket];
+         pp_hash[i_bucket] = p_output;
+         p_output = p_next;
+      }
+   }
+
+   ::free(this->pp_output_hash);
+   this->pp_output_hash = pp_hash;
+   this->i_output_hash_size = i_size;
+}
+
+void cLdvboutput::output_HashInsert(output_t *p_output)
+{
+   if (this->i_output_hash_count >= this->i_output_hash_size)
+      this->output_HashResize(this->i_output_hash_size ? 2 * this->i_output_hash_size : CLDVB_OUTPUT_HASH_MIN);
+
+   unsigned int i_bucket = cLdvboutput::output_Hash(&p_output->config) & (this->i_output_hash_size - 1);
+   p_output->p_hash_next = this->pp_output_hash[i_bucket];
+   this->pp_output_hash[i_bucket] = p_output;
+   this->i_output_hash_count++;
+}
+
+bool cLdvboutput::output_HashRemove(output_t *p_output)
+{
+   if (!this->i_output_hash_size)
+      return false;
+
+   output_t **pp_output = &this->pp_output_hash[cLdvboutput::output_Hash(&p_output->config) & (this->i_output_hash_size - 1)];
+   while (*pp_output != (output_t *) 0) {
+      if (*pp_output == p_output) {
+         *pp_output = p_output->p_hash_next;
+         p_output->p_hash_next = (output_t *) 0;
+         this->i_output_hash_count--;
+         return true;
+      }
+      pp_output = &(*pp_output)->p_hash_next;
+   }
+   return false;
+}
+
+/* output_Find : find an existing output from a given output_config_t */
+cLdvboutput::output_t *cLdvboutput::output_Find(const output_config_t *p_config)
+{
+   socklen_t i_sockaddr_len = (p_config->i_family == AF_INET) ? sizeof(struct sockaddr_in) : sizeof(struct sockaddr_in6);
+
+   if (!this->i_output_hash_size)
+      return (output_t *) 0;
+
+   output_t *p_output = this->pp_output_hash[cLdvboutput::output_Hash(p_config) & (this->i_output_hash_size - 1)];
+   for (; p_output != (output_t *) 0; p_output = p_output->p_hash_next) {
       if (p_config->i_family != p_output->config.i_family || memcmp(&p_config->connect_addr, &p_output->config.connect_addr, i_sockaddr_len) || memcmp(&p_config->bind_addr, &p_output->config.bind_addr, i_sockaddr_len))
          continue;
       if (p_config->i_family == AF_INET6 && p_config->i_if_index_v6 != p_output->config.i_if_index_v6)
@@ -939,6 +1886,26 @@ void cLdvboutput::output_Change(output_t *p_output, const output_config_t *p_con
    p_output->config.i_output_latency = p_config->i_output_latency;
    p_output->config.i_max_retention = p_config->i_max_retention;
 
+   /* pacing toggled by a reload starts again from scratch */
+   if ((p_output->config.i_config ^ p_config->i_config) & OUTPUT_PACE) {
+      p_output->i_pace_rate = p_output->i_pace_bytes = 0;
+      p_output->i_pace_window = p_output->i_pace_refill = p_output->i_pace_last_send = 0;
+      p_output->i_pace_credit = 0;
+      p_output->i_pace_jitter_sum = p_output->i_print_pace_jitter_sum = 0;
+      p_output->i_pace_sends = p_output->i_print_pace_sends = 0;
+      cLdvboutput::period_Next(&p_output->pace_jitter_max);
+#if defined(HAVE_CLLINUX) && defined(SO_MAX_PACING_RATE)
+      if (!(p_config->i_config & OUTPUT_PACE)) {
+         uint32_t i_max_rate = ~0U;
+         if (setsockopt(p_output->i_handle, SOL_SOCKET, SO_MAX_PACING_RATE, &i_max_rate, sizeof(i_max_rate)) < 0)
+            cLbugf(cL::dbg_dvb, "couldn't clear pacing rate (%s)\n", strerror(errno));
+      }
+#endif
+   }
+   p_output->config.i_config &= ~OUTPUT_PACE;
+   p_output->config.i_config |= p_config->i_config & OUTPUT_PACE;
+   p_output->config.i_pace_burst = p_config->i_pace_burst;
+
    if (p_output->config.i_ttl != p_config->i_ttl) {
       if (p_output->config.i_family == AF_INET6) {
          struct sockaddr_in6 *p_addr = (struct sockaddr_in6 *)&p_output->config.connect_addr;
@@ -987,18 +1954,29 @@ void cLdvboutput::output_Change(output_t *p_output, const output_config_t *p_con
 
 void cLdvboutput::outputs_Close(int i_num_outputs)
 {
+   this->outputs_StopShards();
+
    for (int i = 0; i < i_num_outputs; i++) {
       output_t *p_output = this->pp_outputs[i];
       if (p_output->config.i_config & OUTPUT_VALID) {
          cLbugf(cL::dbg_dvb, "removing %s\n", p_output->config.psz_displayname);
          if (p_output->p_packets)
-            this->output_Flush(p_output);
+            this->output_Flush(&this->sched, p_output);
          this->output_Close(p_output);
       }
       ::free(p_output);
    }
    ::free(this->pp_outputs);
    this->pp_outputs = (output_t **) 0;
+   this->i_nb_outputs = this->i_nb_free_outputs = 0;
+   ::free(this->pp_output_hash);
+   this->pp_output_hash = (output_t **) 0;
+   this->i_output_hash_size = this->i_output_hash_count = 0;
+
+   while (this->i_nb_psi_cache)
+      this->psi_CacheRelease(this->pp_psi_cache[0]);
+   ::free(this->pp_psi_cache);
+   this->pp_psi_cache = (psi_cache_t **) 0;
 
 #ifdef HAVE_CLICONV
    if (this->iconv_handle != (iconv_t) -1) {
@@ -1090,6 +2068,12 @@ bool cLdvboutput::output_Setup(const char *netname, const char *proname)
    this->config_strdvb(&this->network_name, netname, this->psz_native_charset);
    this->config_strdvb(&this->provider_name, proname, this->psz_native_charset);
 
+   this->sched.loop = this->event_loop;
+   this->sched.output_watcher.data = &this->sched;
+   cLev_timer_init(&this->sched.output_watcher, cLdvboutput::outputs_Send, 0, 0);
+   if (this->i_nb_output_threads > 0)
+      this->outputs_StartShards();
+
    bool rc = true;
 
    if (this->psz_dup_config != (char *) 0) {
@@ -34,6 +34,7 @@
 #include <netinet/ip.h>
 #endif
 #include <netdb.h>
+#include <pthread.h>
 #ifdef HAVE_CLICONV
 #include <iconv.h>
 #endif
@@ -41,6 +42,8 @@
 #include <bitstream/mpeg/psi.h>
 #include <bitstream/dvb/si.h>
 #define MAX_EIT_TABLES (EIT_TABLE_ID_SCHED_ACTUAL_LAST - EIT_TABLE_ID_PF_ACTUAL)
+#define EIT_TABLE_SEGMENTS (PSI_TABLE_MAX_SECTIONS / CLDVB_EIT_SEGMENT_SECTIONS)
+#define EIT_STORE_SEGMENTS (MAX_EIT_TABLES * EIT_TABLE_SEGMENTS)
 
 /*
 Output configuration flags (for output_t -> i_config) - bit values
@@ -52,6 +55,7 @@ Bit  4 : Set for file / FIFO output, unset for network (future use)
 Bit  5 : Set if DVB conformance tables are inserted
 Bit  6 : Set if DVB EIT schedule tables are forwarded
 Bit  7 : Set for RAW socket output
+Bit  8 : Set for token-bucket paced output
  */
 #define OUTPUT_WATCH                0x01
 #define OUTPUT_STILL_PRESENT        0x02
@@ -61,22 +65,61 @@ Bit  7 : Set for RAW socket output
 #define OUTPUT_DVB                  0x20
 #define OUTPUT_EPG                  0x40
 #define OUTPUT_RAW                  0x80
+#define OUTPUT_PACE                 0x100
+
+/* kinds of generated sections in the PSI cache */
+#define PSI_CACHE_PAT               0
+#define PSI_CACHE_PMT               1
+#define PSI_CACHE_SDT               2
+#define PSI_CACHE_KINDS             3
+#define PSI_CACHE_NIT               3 /* private, not looked up */
 
 class cLdvboutput : public cLdvbobj {
 
    public:
+      /* memory shared by several blocks (e.g. a capture ring),
+       * pf_release is called when the last block is deleted */
+      typedef struct block_buffer_t {
+         int i_refcount;
+         void (*pf_release)(void *p_opaque, struct block_buffer_t *p_buffer);
+         void *p_opaque;
+      } block_buffer_t;
+
       typedef struct block_t {
-         uint8_t p_ts[TS_SIZE];
+         uint8_t *p_ts; /* p_data, or a view on p_buffer */
          int i_refcount;
          mtime_t i_dts;
-         uint16_t tmp_pid;
          struct block_t *p_next;
+         block_buffer_t *p_buffer;
+         bool b_pooled; /* carved from a slab, otherwise malloc'ed */
+         uint8_t p_data[TS_SIZE];
       } block_t;
 
+      /* contiguous input buffer, its TS packets are handed to the
+       * demux as block views */
+      typedef struct block_batch_t {
+         block_buffer_t buffer;
+         struct block_batch_t *p_next;
+         uint8_t *p_data;
+      } block_batch_t;
+
+      typedef struct block_stats_t {
+         uint64_t i_allocs;
+         uint64_t i_hits;          /* served from the pool */
+         uint64_t i_misses;        /* needed a new slab or the heap */
+         unsigned int i_pooled;    /* blocks carved from slabs */
+         unsigned int i_inflight;
+         unsigned int i_peak;
+         unsigned int i_batches;   /* batch buffers allocated */
+      } block_stats_t;
+
       typedef struct packet_t {
             struct packet_t *p_next;
             mtime_t i_dts;
             int i_depth;
+            /* PID to send each block with, UNUSED_PID to send it as is;
+             * points after pp_blocks in the same allocation */
+            uint16_t *pi_remap_pids;
             block_t *pp_blocks[];
       } packet_t;
 
@@ -136,6 +179,7 @@ class cLdvboutput : public cLdvbobj {
             int i_ttl;
             uint8_t i_tos;
             int i_mtu;
+            int i_pace_burst; /* datagrams */
             char *psz_srcaddr; /* raw packets */
             int i_srcport;
             /* demux config */
@@ -151,8 +195,42 @@ class cLdvboutput : public cLdvbobj {
             uint16_t pi_confpids[CLDVB_N_MAP_PIDS];
       } output_config_t;
 
+      /* generated section, shared by the outputs with the same key,
+       * with its TS packets ready to be copied (CC left to the sender) */
+      typedef struct psi_cache_t {
+            uint8_t *p_section;
+            int i_refcount;
+            int i_index;               /* in pp_psi_cache */
+            int i_kind;
+            uint32_t i_generation;     /* of the source table */
+            uint8_t *p_key;            /* 0 if private to one output */
+            unsigned int i_key_size;
+            uint8_t *p_packets;
+            int i_nb_packets;
+            uint16_t i_packets_pid;
+      } psi_cache_t;
+
+      /* one remapped ES PID of an output */
+      typedef struct pid_remap_t {
+            uint16_t i_pid;
+            uint16_t i_newpid;
+      } pid_remap_t;
+
+      /* maximum over a period of the reader: only the sending thread
+       * writes i_max, the reader starts a new period by bumping
+       * i_period, which the sending thread notices on its next value */
+      typedef struct period_max_t {
+            volatile unsigned int i_period;   /* reader */
+            volatile unsigned int i_seen;     /* sending thread */
+            volatile mtime_t i_max;
+      } period_max_t;
+
+      struct output_shard_t;
+
       typedef struct output_t {
             output_config_t config;
+            /* next output in the same bucket of pp_output_hash */
+            struct output_t *p_hash_next;
             /* output */
             int i_handle;
             packet_t *p_packets, *p_last_packet;
@@ -160,6 +238,7 @@ class cLdvboutput : public cLdvbobj {
             unsigned int i_packet_count;
             uint16_t i_seqnum;
             /* demux */
+            struct output_t *p_sid_prev, *p_sid_next; /* same config.i_sid, kept by the demux */
             int i_nb_errors;
             mtime_t i_last_error;
             uint8_t *p_pat_section;
@@ -170,30 +249,120 @@ class cLdvboutput : public cLdvbobj {
             uint8_t i_nit_version, i_nit_cc;
             uint8_t *p_sdt_section;
             uint8_t i_sdt_version, i_sdt_cc;
+            /* cache entries holding the sections above */
+            psi_cache_t *p_pat_cache, *p_pmt_cache, *p_nit_cache, *p_sdt_cache;
             block_t *p_eit_ts_buffer;
             uint8_t i_eit_ts_buffer_offset, i_eit_cc;
             uint16_t i_tsid;
             /* incomplete PID (only PCR packets) */
             uint16_t i_pcr_pid;
-            // Arrays used for mapping pids.
-            // newpids is indexed using the original pid
-            uint16_t pi_newpids[MAX_PIDS];
-            uint16_t pi_freepids[MAX_PIDS];   // used where multiple streams of the same type are used
+            /* PID remapping, sorted by original PID, only allocated
+             * once the output maps a PID (the PMT has a handful of ES) */
+            pid_remap_t *p_remaps;
+            int i_nb_remaps, i_max_remaps;
+            /* pacing: token bucket refilled at the measured bitrate */
+            uint64_t i_pace_rate;       /* bytes/s */
+            uint64_t i_pace_bytes;      /* enqueued in the current window */
+            mtime_t i_pace_window;
+            int64_t i_pace_credit;      /* bytes * 1000000 */
+            mtime_t i_pace_refill;
+            mtime_t i_pace_last_send;
+            uint64_t i_pace_jitter_sum;
+            period_max_t pace_jitter_max;
+            uint64_t i_pace_sends;
+            /* the above when last printed */
+            uint64_t i_print_pace_jitter_sum;
+            uint64_t i_print_pace_sends;
+            /* cumulative counters, written by the sending thread */
+            uint64_t i_stat_datagrams;
+            uint64_t i_stat_bytes;
+            uint64_t i_stat_send_errors;
+            uint64_t i_stat_drops;
+            unsigned int i_stat_queued;   /* datagrams waiting */
+            mtime_t i_stat_latency;       /* input to send, last datagram */
+            period_max_t stats_latency_max; /* over the --stats-shm period */
+            mtime_t i_stat_latency_sum;
+            unsigned int i_stat_queued_max;
+            uint64_t i_stat_late;         /* sent past i_output_latency + slack */
+            uint64_t pi_stat_latency[CLDVB_LATENCY_BUCKETS];
+            /* depth peak over the print period */
+            period_max_t print_queued_max;
+            /* the above when last printed */
+            uint64_t pi_print_latency[CLDVB_LATENCY_BUCKETS];
+            uint64_t i_print_late;
+            /* worker thread sending this output, 0 for the main loop */
+            struct output_shard_t *p_shard;
             struct udprawpkt raw_pkt_header;
       } output_t;
 
+      typedef struct shard_msg_t {
+            output_t *p_output;
+            block_t *p_block;
+            uint16_t i_remap_pid;
+      } shard_msg_t;
+
+      /* lock-free single producer / single consumer ring,
+       * i_write is private to the producer and published to i_head */
+      typedef struct shard_queue_t {
+            shard_msg_t *p_msgs;
+            unsigned int i_mask;
+            unsigned int i_write;
+            uint8_t p_pad0[CLDVB_CACHE_LINE];
+            volatile unsigned int i_head;
+            uint8_t p_pad1[CLDVB_CACHE_LINE];
+            volatile unsigned int i_tail;
+            uint8_t p_pad2[CLDVB_CACHE_LINE];
+      } shard_queue_t;
+
+      /* send state of one event loop (main loop or worker thread) */
+      typedef struct output_sched_t {
+            cLdvboutput *pobj;
+            struct output_shard_t *p_shard; /* 0 for the main loop */
+            void *loop;
+            struct cLev_timer output_watcher;
+            mtime_t i_next_send;
+            mtime_t i_wallclock;
+            uint64_t i_nb_datagrams;
+            uint64_t i_nb_send_calls;
+      } output_sched_t;
+
+      /* worker thread owning a subset of the outputs; the lock is held
+       * while the worker runs and by the main thread to change outputs */
+      typedef struct output_shard_t {
+            output_sched_t sched;
+            pthread_t thread;
+            pthread_mutex_t lock;
+            struct cLev_async wakeup_watcher;
+            volatile bool b_die;
+            int i_nb_outputs;
+            uint64_t i_nb_drops;
+            shard_queue_t in;   /* main -> worker, blocks to send */
+            shard_queue_t back; /* worker -> main, blocks to recycle */
+      } output_shard_t;
+
    private:
-      struct cLev_timer output_watcher;
-      mtime_t i_next_send;
-      mtime_t i_wallclock;
+      output_sched_t sched;
+      output_shard_t *p_shards;
+      int i_nb_shards;
+      int i_nb_output_threads;
       cLdvboutput::block_t *p_block_lifo;
       unsigned int i_block_count;
+      unsigned int i_block_pool_max;
+      void **pp_block_slabs;
+      int i_nb_block_slabs;
       #ifdef HAVE_CLICONV
       iconv_t conf_iconv;
       iconv_t iconv_handle;
       #endif
       uint8_t p_pad_ts[TS_SIZE];
 
+      block_batch_t *p_batch_lifo;
+      uint8_t p_batch_carry[TS_SIZE];
+      unsigned int i_batch_carry;
+
+      void block_SlabNew(void);
+      block_batch_t *batch_New(void);
+      static void batch_Release(void *p_opaque, block_buffer_t *p_buffer);
       static void dvb_string_init(dvb_string_t *p_dvb_string);
       uint8_t *config_striconv(const char *psz_string, const char *psz_charset, size_t *pi_length);
 
@@ -202,9 +371,32 @@ class cLdvboutput : public cLdvbobj {
       static packet_t *output_PacketNew(output_t *p_output);
       static void output_PacketDelete(output_t *p_output, packet_t *p_packet);
       static void output_PacketVacuum(output_t *p_output);
-      void output_Flush(output_t *p_output);
+      void block_Release(output_sched_t *p_sched, block_t *p_block);
+      int output_Iov(output_t *p_output, packet_t *p_packet, struct iovec *p_iov, uint8_t *p_rtp_hdr, uint8_t *p_ts_hdrs, mtime_t i_wallclock);
+      void output_Pop(output_sched_t *p_sched, output_t *p_output);
+      void output_Flush(output_sched_t *p_sched, output_t *p_output);
+#ifdef HAVE_CLLINUX
+      void output_FlushBatch(output_sched_t *p_sched, output_t *p_output);
+#endif
+      void output_Send(output_sched_t *p_sched, output_t *p_output);
+      void output_Pace(output_sched_t *p_sched, output_t *p_output);
+      void output_PaceRefill(output_t *p_output, mtime_t i_wallclock);
+      mtime_t output_NextSend(output_sched_t *p_sched, output_t *p_output);
+      void output_Enqueue(output_sched_t *p_sched, output_t *p_output, block_t *p_block, uint16_t i_remap_pid);
+      void outputs_Run(output_sched_t *p_sched);
       static void outputs_Send(void *loop, void *w, int revents);
 
+      static void queue_Init(shard_queue_t *p_queue, unsigned int i_size);
+      static bool queue_Push(shard_queue_t *p_queue, output_t *p_output, block_t *p_block, uint16_t i_remap_pid = UNUSED_PID);
+      static void queue_Publish(shard_queue_t *p_queue);
+      void shard_Push(output_shard_t *p_shard, output_t *p_output, block_t *p_block, uint16_t i_remap_pid);
+      void shard_Drain(output_shard_t *p_shard);
+      void shard_Run(output_shard_t *p_shard);
+      static void shard_Wakeup(void *loop, void *w, int revents);
+      static void *shard_Thread(void *p);
+      void outputs_StartShards(void);
+      void outputs_StopShards(void);
+
       static char *iconv_append_null(const char *p_string, size_t i_length);
 
    protected:
@@ -213,6 +405,11 @@ class cLdvboutput : public cLdvbobj {
       bool b_do_remap;
       output_t **pp_outputs;
       int i_nb_outputs;
+      int i_nb_free_outputs;
+      /* valid outputs of pp_outputs chained by address, see output_Hash() */
+      output_t **pp_output_hash;
+      unsigned int i_output_hash_size;
+      unsigned int i_output_hash_count;
       bool b_udp_global;
       bool b_dvb_global;
       bool b_epg_global;
@@ -225,8 +422,16 @@ class cLdvboutput : public cLdvbobj {
       uint16_t i_network_id;
       char *psz_dup_config;
       output_t *output_dup;
+      block_stats_t block_stats;
+      psi_cache_t **pp_psi_cache;
+      int i_nb_psi_cache;
+      bool b_send_mmsg;
+      bool b_null_outputs;
+      unsigned int i_batch_size;
 
       block_t *block_New();
+      block_t *block_NewView(block_buffer_t *p_buffer, uint8_t *p_ts);
+      ssize_t block_ReadBatch(int i_fd, block_t **pp_chain);
       void block_Delete(block_t *p_block);
       void block_DeleteChain(block_t *p_block);
       void block_Vacuum(void);
@@ -239,22 +444,75 @@ class cLdvboutput : public cLdvbobj {
       void config_Init(output_config_t *p_config);
       static void config_Free(output_config_t *p_config);
       static void config_Print(output_config_t *p_config);
+      static bool config_Equal(const output_config_t *p_1, const output_config_t *p_2);
       void config_Defaults(output_config_t *p_config);
       static struct addrinfo *ParseNodeService(char *_psz_string, char **ppsz_end, uint16_t i_default_port);
       bool config_ParseHost(output_config_t *p_config, char *psz_string);
 
       static void init_pid_mapping(cLdvboutput::output_t *p_output);
+      static uint16_t output_RemapPID(const cLdvboutput::output_t *p_output, uint16_t i_pid);
+      static bool output_RemapUsed(const cLdvboutput::output_t *p_output, uint16_t i_newpid);
+      static void output_RemapAdd(cLdvboutput::output_t *p_output, uint16_t i_pid, uint16_t i_newpid);
       int output_Init(cLdvboutput::output_t *p_output, const cLdvboutput::output_config_t *p_config);
       output_t *output_Create(const output_config_t *p_config);
       void output_Close(cLdvboutput::output_t *p_output);
       void output_Put(cLdvboutput::output_t *p_output, cLdvboutput::block_t *p_block);
       void outputs_Init(void);
+      static uint32_t output_Hash(const cLdvboutput::output_config_t *p_config);
+      void output_HashResize(unsigned int i_size);
+      void output_HashInsert(cLdvboutput::output_t *p_output);
+      bool output_HashRemove(cLdvboutput::output_t *p_output);
       cLdvboutput::output_t *output_Find(const cLdvboutput::output_config_t *p_config);
       static void output_Change(cLdvboutput::output_t *p_output, const cLdvboutput::output_config_t *p_config);
       void outputs_Close(int i_num_outputs);
+      void outputs_Lock(void);
+      void outputs_Unlock(void);
+      void outputs_Balance(void);
+      void outputs_Publish(void);
+      void outputs_Reclaim(void);
+      void outputs_PrintPacing(void);
+      void outputs_PrintLatency(void);
+      psi_cache_t *psi_CacheGet(int i_kind, uint32_t i_generation, const uint8_t *p_key, unsigned int i_key_size);
+      psi_cache_t *psi_CachePut(uint8_t *p_section, int i_kind, uint32_t i_generation, const uint8_t *p_key, unsigned int i_key_size);
+      void psi_CacheRelease(psi_cache_t *p_cache);
+      const uint8_t *psi_CachePackets(psi_cache_t *p_cache, uint16_t i_pid, int *pi_nb_packets);
+      uint64_t i_psi_built, i_psi_shared;
+      void outputs_Stats(uint64_t *pi_datagrams, uint64_t *pi_send_calls, uint64_t *pi_drops);
 
       static char *iconv_cb(void *iconv_opaque, const char *psz_encoding, char *p_string, size_t i_length);
 
+      /* latency histogram bucket of a delay in us, and the largest delay
+       * a bucket holds: exact below 2^CLDVB_LATENCY_SUB_BITS, then
+       * 2^CLDVB_LATENCY_SUB_BITS buckets per power of two */
+      static inline int latency_Bucket(mtime_t i_delay) {
+         if (i_delay < (1 << CLDVB_LATENCY_SUB_BITS))
+            return i_delay < 0 ? 0 : (int)i_delay;
+         if (i_delay >= ((mtime_t)1 << CLDVB_LATENCY_MAX_BITS))
+            return CLDVB_LATENCY_BUCKETS - 1;
+         int i_exp = 63 - __builtin_clzll(i_delay);
+         return ((i_exp - CLDVB_LATENCY_SUB_BITS + 1) << CLDVB_LATENCY_SUB_BITS) + ((i_delay >> (i_exp - CLDVB_LATENCY_SUB_BITS)) & ((1 << CLDVB_LATENCY_SUB_BITS) - 1));
+      }
+      static inline mtime_t latency_BucketMax(int i_bucket) {
+         if (i_bucket < (1 << CLDVB_LATENCY_SUB_BITS))
+            return i_bucket;
+         int i_shift = (i_bucket >> CLDVB_LATENCY_SUB_BITS) - 1;
+         return ((mtime_t)((1 << CLDVB_LATENCY_SUB_BITS) + (i_bucket & ((1 << CLDVB_LATENCY_SUB_BITS) - 1)) + 1) << i_shift) - 1;
+      }
+
+      static inline void period_Update(period_max_t *p_max, mtime_t i_value) {
+         if (p_max->i_seen != p_max->i_period) {
+            p_max->i_max = i_value;
+            p_max->i_seen = p_max->i_period;
+         } else if (i_value > p_max->i_max)
+            p_max->i_max = i_value;
+      }
+      /* the maximum of the period ending, 0 if nothing was seen */
+      static inline mtime_t period_Next(period_max_t *p_max) {
+         mtime_t i_max = p_max->i_seen == p_max->i_period ? p_max->i_max : 0;
+         p_max->i_period++;
+         return i_max;
+      }
+
    public:
       inline void set_rawudp(bool b = true) {
          this->b_udp_global = b;
@@ -286,6 +544,24 @@ class cLdvboutput : public cLdvbobj {
       inline void set_dupconfig(char *s) {
          this->psz_dup_config = s;
       }
+      inline void set_block_pool(unsigned int i) {
+         this->i_block_pool_max = i;
+      }
+      inline void set_send_mmsg(bool b = true) {
+         this->b_send_mmsg = b;
+      }
+      inline void set_null_outputs(bool b = true) {
+         this->b_null_outputs = b;
+      }
+      inline void set_output_threads(int i) {
+         this->i_nb_output_threads = i;
+      }
+      inline void set_batch_ingest(unsigned long i) {
+         /* whole TS packets, at least a few of them and at most a few MiB */
+         if (i > CLDVB_BATCH_MAX_SIZE)
+            i = CLDVB_BATCH_MAX_SIZE;
+         this->i_batch_size = i < 7 * TS_SIZE ? (i ? 7 * TS_SIZE : 0) : i / TS_SIZE * TS_SIZE;
+      }
 
       bool set_rtpsrc(const char *s);
       bool output_Setup(const char *netname, const char *proname);
@@ -0,0 +1,176 @@
+/*
+ * cLdvbreplay.cpp
+ * Gokhan Poyraz <gokhan@kylone.com>
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include <cLdvbreplay.h>
+
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <errno.h>
+
+cLdvbreplay::cLdvbreplay()
+{
+   this->psz_replay_file = (const char *) 0;
+   this->p_replay_data = (uint8_t *) 0;
+   this->i_replay_packets = 0;
+   this->i_replay_offset = 0;
+   this->i_replay_loops = 1;
+   this->i_replay_loop = 0;
+   this->i_start_ns = 0;
+   this->i_ingest_ns = 0;
+   this->i_run_ns = 0;
+   this->i_run_scan_ns = 0;
+   this->i_run_demux_ns = 0;
+   this->i_run_packets = 0;
+   memset(&this->start_stats, 0, sizeof(block_stats_t));
+   cLbug(cL::dbg_high, "cLdvbreplay created\n");
+}
+
+cLdvbreplay::~cLdvbreplay()
+{
+   ::free(this->p_replay_data);
+   cLbug(cL::dbg_high, "cLdvbreplay deleted\n");
+}
+
+void cLdvbreplay::dev_Open(void)
+{
+   struct stat st;
+   int i_fd;
+
+   if ((i_fd = open(this->psz_replay_file, O_RDONLY)) < 0 || fstat(i_fd, &st) < 0) {
+      cLbugf(cL::dbg_dvb, "couldn't open %s (%s)\n", this->psz_replay_file, strerror(errno));
+      exit(EXIT_FAILURE);
+   }
+
+   this->i_replay_packets = st.st_size / TS_SIZE;
+   if (!this->i_replay_packets) {
+      cLbugf(cL::dbg_dvb, "%s holds no TS packet\n", this->psz_replay_file);
+      exit(EXIT_FAILURE);
+   }
+
+   size_t i_size = (size_t)this->i_replay_packets * TS_SIZE, i_read = 0;
+   if (posix_memalign((void **)&this->p_replay_data, CLDVB_CACHE_LINE, i_size)) {
+      cLbugf(cL::dbg_dvb, "couldn't allocate %zu bytes for %s\n", i_size, this->psz_replay_file);
+      exit(EXIT_FAILURE);
+   }
+   while (i_read < i_size) {
+      ssize_t i_ret = read(i_fd, this->p_replay_data + i_read, i_size - i_read);
+      if (i_ret <= 0) {
+         cLbugf(cL::dbg_dvb, "couldn't read %s (%s)\n", this->psz_replay_file, i_ret ? strerror(errno) : "short file");
+         exit(EXIT_FAILURE);
+      }
+      i_read += i_ret;
+   }
+   close(i_fd);
+
+   if (this->p_replay_data[0] != 0x47)
+      cLbugf(cL::dbg_dvb, "%s doesn't start with a TS sync byte\n", this->psz_replay_file);
+   cLbugf(cL::dbg_dvb, "replaying %s (%u packets, %d loops)\n", this->psz_replay_file, this->i_replay_packets, this->i_replay_loops);
+
+   this->replay_watcher.data = this;
+   cLev_timer_init(&this->replay_watcher, cLdvbreplay::replay_Cb, 0., 0.);
+   cLev_timer_start(this->event_loop, &this->replay_watcher);
+}
+
+/* one chunk per loop iteration, so output timers and signals still run */
+void cLdvbreplay::replay_Cb(void *loop, void *p, int revents)
+{
+   struct cLev_timer *w = (struct cLev_timer *) p;
+   cLdvbreplay *pobj = (cLdvbreplay *) w->data;
+   block_t *p_ts = (block_t *) 0, **pp_current = &p_ts;
+   unsigned int i_nb = pobj->i_replay_packets - pobj->i_replay_offset;
+
+   if (!pobj->i_start_ns) {
+      pobj->i_start_ns = pobj->ndate();
+      pobj->start_stats = pobj->block_stats;
+   }
+   if (i_nb > CLDVB_REPLAY_CHUNK)
+      i_nb = CLDVB_REPLAY_CHUNK;
+
+   /* copy, as a read() would, so in-place rewrites (PID remapping)
+    * don't leak into the next loop */
+   uint64_t i_start = pobj->ndate();
+   const uint8_t *p_src = pobj->p_replay_data + (size_t)pobj->i_replay_offset * TS_SIZE;
+   for (unsigned int i = 0; i < i_nb; i++) {
+      *pp_current = pobj->block_New();
+      memcpy((*pp_current)->p_ts, p_src + i * TS_SIZE, TS_SIZE);
+      pp_current = &(*pp_current)->p_next;
+   }
+
+   /* demux_Run() is synchronous, the periodic print can't reset the
+    * counters in between */
+   uint64_t i_demux_ns = pobj->i_demux_ns, i_scan_ns = pobj->i_scan_ns;
+   uint64_t i_run = pobj->ndate();
+   pobj->demux_Run(p_ts);
+   uint64_t i_end = pobj->ndate();
+
+   pobj->i_ingest_ns += i_run - i_start;
+   pobj->i_run_ns += i_end - i_run;
+   pobj->i_run_demux_ns += pobj->i_demux_ns - i_demux_ns;
+   pobj->i_run_scan_ns += pobj->i_scan_ns - i_scan_ns;
+   pobj->i_run_packets += i_nb;
+
+   pobj->i_replay_offset += i_nb;
+   if (pobj->i_replay_offset == pobj->i_replay_packets) {
+      pobj->i_replay_offset = 0;
+      if (++pobj->i_replay_loop >= pobj->i_replay_loops) {
+         pobj->replay_Report();
+         cLev_break(loop, 2); //EVBREAK_ALL
+         return;
+      }
+   }
+
+   cLev_timer_set(w, 0., 0.);
+   cLev_timer_start(loop, w);
+}
+
+void cLdvbreplay::replay_Report()
+{
+   uint64_t i_total_ns = this->ndate() - this->i_start_ns;
+   uint64_t i_packets = this->i_run_packets;
+   uint64_t i_datagrams, i_send_calls, i_drops;
+
+   if (!i_packets || !i_total_ns)
+      return;
+   this->outputs_Stats(&i_datagrams, &i_send_calls, &i_drops);
+
+   /* whatever isn't ingest or demux_Run() is spent in the event loop,
+    * which is where the outputs are sent from (unless threaded) */
+   uint64_t i_loop_ns = i_total_ns - this->i_ingest_ns - this->i_run_ns;
+   cLbugf(cL::dbg_dvb, "replay: %d loops, %"PRIu64" packets in %"PRIu64" ms\n", this->i_replay_loop, i_packets, i_total_ns / 1000000);
+   cLbugf(cL::dbg_dvb, "replay: %"PRIu64" packets/s, %"PRIu64" ns/packet, %"PRIu64" Mbit/s\n", i_packets * 1000000000 / i_total_ns, i_total_ns / i_packets, i_packets * TS_SIZE * 8 * 1000 / i_total_ns);
+   cLbugf(cL::dbg_dvb, "replay: ingest %"PRIu64" ns/packet, header scan %"PRIu64", demux %"PRIu64", demux_Run overhead %"PRIu64", event loop and outputs %"PRIu64"\n", this->i_ingest_ns / i_packets, this->i_run_scan_ns / i_packets, (this->i_run_demux_ns - this->i_run_scan_ns) / i_packets, (this->i_run_ns - this->i_run_demux_ns) / i_packets, i_loop_ns / i_packets);
+   cLbugf(cL::dbg_dvb, "replay: blocks %"PRIu64" allocs, %"PRIu64" misses, %u pooled, peak %u in flight\n", this->block_stats.i_allocs - this->start_stats.i_allocs, this->block_stats.i_misses - this->start_stats.i_misses, this->block_stats.i_pooled, this->block_stats.i_peak);
+   cLbugf(cL::dbg_dvb, "replay: outputs %"PRIu64" datagrams in %"PRIu64" send calls, %"PRIu64" blocks dropped\n", i_datagrams, i_send_calls, i_drops);
+}
+
+/* From now on these are just stubs */
+int cLdvbreplay::dev_SetFilter(uint16_t i_pid)
+{
+   return -1;
+}
+
+void cLdvbreplay::dev_UnsetFilter(int i_fd, uint16_t i_pid)
+{
+}
+
+void cLdvbreplay::dev_Reset(void)
+{
+}
@@ -0,0 +1,71 @@
+/*
+ * cLdvbreplay.h
+ * Gokhan Poyraz <gokhan@kylone.com>
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef CLDVBREPLAY_H_
+#define CLDVBREPLAY_H_
+
+#include <cLdvbdemux.h>
+
+/* benchmark input: a TS capture loaded in memory and fed to the demux
+ * as fast as the event loop allows */
+class cLdvbreplay : public cLdvbdemux {
+
+   private:
+      const char *psz_replay_file;
+      uint8_t *p_replay_data;
+      unsigned int i_replay_packets;
+      unsigned int i_replay_offset;
+      int i_replay_loops;
+      int i_replay_loop;
+      struct cLev_timer replay_watcher;
+      /* accumulated over the whole run */
+      uint64_t i_start_ns;
+      uint64_t i_ingest_ns;
+      uint64_t i_run_ns;
+      uint64_t i_run_scan_ns;
+      uint64_t i_run_demux_ns;
+      uint64_t i_run_packets;
+      block_stats_t start_stats;
+
+      void replay_Report();
+      static void replay_Cb(void *loop, void *w, int revents);
+
+   protected:
+#ifdef HAVE_CLDVBHW
+      virtual int dev_PIDIsSelected(uint16_t i_pid) { return -1; }
+      virtual void dev_ResendCAPMTs() {}
+#endif
+      virtual void dev_Open();
+      virtual void dev_Reset();
+      virtual int dev_SetFilter(uint16_t i_pid);
+      virtual void dev_UnsetFilter(int i_fd, uint16_t i_pid);
+
+   public:
+      inline void set_replay_file(const char *s) {
+         this->psz_replay_file = s;
+      }
+      inline void set_replay_loops(int i) {
+         this->i_replay_loops = i;
+      }
+
+      cLdvbreplay();
+      virtual ~cLdvbreplay();
+};
+
+#endif /*CLDVBREPLAY_H_*/
@@ -0,0 +1,107 @@
+/*
+ * cLdvbstats.cpp
+ * Gokhan Poyraz <gokhan@kylone.com>
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include <cLdvbstats.h>
+
+#include <unistd.h>
+#include <string.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+cLdvbstats::cLdvbstats()
+{
+   this->psz_file = (char *) 0;
+   this->i_fd = -1;
+   this->i_size = 0;
+   this->p_header = (header_t *) 0;
+   this->p_pids = (stats_pid_t *) 0;
+   this->p_outputs = (stats_output_t *) 0;
+   cLbug(cL::dbg_high, "cLdvbstats created\n");
+}
+
+cLdvbstats::~cLdvbstats()
+{
+   this->statsClose();
+   cLbug(cL::dbg_high, "cLdvbstats deleted\n");
+}
+
+/* a bare name goes to /dev/shm */
+bool cLdvbstats::statsOpen(const char *psz_name, int i_max_outputs)
+{
+   size_t i_pid_offset = (sizeof(header_t) + CLDVB_CACHE_LINE - 1) & ~(size_t)(CLDVB_CACHE_LINE - 1);
+   size_t i_output_offset = i_pid_offset + MAX_PIDS * sizeof(stats_pid_t);
+   struct timeval tv;
+
+   this->psz_file = cLmalloc(char, strlen(psz_name) + sizeof("/dev/shm/"));
+   sprintf(this->psz_file, "%s%s", strchr(psz_name, '/') != (char *) 0 ? "" : "/dev/shm/", psz_name);
+   this->i_size = i_output_offset + i_max_outputs * sizeof(stats_output_t);
+
+   if ((this->i_fd = open(this->psz_file, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0
+         || ftruncate(this->i_fd, this->i_size) < 0
+         || (this->p_header = (header_t *)mmap((void *) 0, this->i_size, PROT_READ | PROT_WRITE, MAP_SHARED, this->i_fd, 0)) == (header_t *)MAP_FAILED) {
+      cLbugf(cL::dbg_dvb, "couldn't map stats segment %s (%s)\n", this->psz_file, strerror(errno));
+      this->p_header = (header_t *) 0;
+      this->statsClose();
+      return false;
+   }
+
+   this->p_pids = (stats_pid_t *)((uint8_t *)this->p_header + i_pid_offset);
+   this->p_outputs = (stats_output_t *)((uint8_t *)this->p_header + i_output_offset);
+
+   /* the file is zeroed by ftruncate(), the magic goes last */
+   this->p_header->i_version = CLDVB_STATS_VERSION;
+   this->p_header->i_header_size = sizeof(header_t);
+   this->p_header->i_size = this->i_size;
+   this->p_header->i_pid_offset = i_pid_offset;
+   this->p_header->i_pid_size = sizeof(stats_pid_t);
+   this->p_header->i_nb_pids = MAX_PIDS;
+   this->p_header->i_output_offset = i_output_offset;
+   this->p_header->i_output_size = sizeof(stats_output_t);
+   this->p_header->i_max_outputs = i_max_outputs;
+   this->p_header->i_latency_buckets = CLDVB_LATENCY_BUCKETS;
+   this->p_header->i_latency_sub_bits = CLDVB_LATENCY_SUB_BITS;
+   this->p_header->i_pid = getpid();
+   gettimeofday(&tv, (struct timezone *) 0);
+   this->p_header->i_start_time = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+   __sync_synchronize();
+   this->p_header->i_magic = CLDVB_STATS_MAGIC;
+
+   cLbugf(cL::dbg_dvb, "stats segment %s, %zu bytes\n", this->psz_file, this->i_size);
+   return true;
+}
+
+void cLdvbstats::statsClose()
+{
+   if (this->p_header != (header_t *) 0) {
+      this->p_header->i_magic = 0;
+      munmap(this->p_header, this->i_size);
+   }
+   if (this->i_fd >= 0) {
+      close(this->i_fd);
+      unlink(this->psz_file);
+   }
+   ::free(this->psz_file);
+   this->psz_file = (char *) 0;
+   this->i_fd = -1;
+   this->p_header = (header_t *) 0;
+   this->p_pids = (stats_pid_t *) 0;
+   this->p_outputs = (stats_output_t *) 0;
+}
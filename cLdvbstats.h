@@ -0,0 +1,138 @@
+/*
+ * cLdvbstats.h
+ * Gokhan Poyraz <gokhan@kylone.com>
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef CLDVB_STATS_H_
+#define CLDVB_STATS_H_
+
+#include <cLdvbcore.h>
+
+#define CLDVB_STATS_MAGIC           0x53425644 /* "DVBS" */
+#define CLDVB_STATS_VERSION         2
+
+/*
+Shared memory statistics segment (--stats-shm), native endianness:
+   header_t
+   stats_pid_t    [i_nb_pids]     at i_pid_offset, indexed by PID
+   stats_output_t [i_max_outputs] at i_output_offset, i_nb_outputs in use
+
+Seqlock: the single writer makes i_seq odd, updates, then makes it even
+again. A reader copies what it needs between two reads of i_seq and
+retries if they differ or if the first one was odd. Readers must use
+the offsets and record sizes from the header, later versions only
+append fields.
+
+Version 2 appends the output latency histogram: i_latency_buckets
+counters, bucket b < 2^i_latency_sub_bits holds a delay of b us, above
+that each power of two is split in 2^i_latency_sub_bits equal buckets.
+ */
+class cLdvbstats {
+   public:
+      typedef struct header_t {
+            uint32_t i_magic;
+            uint16_t i_version;
+            uint16_t i_header_size;
+            uint32_t i_size;               /* of the whole segment */
+            volatile uint32_t i_seq;
+            uint32_t i_pid_offset;
+            uint32_t i_pid_size;
+            uint32_t i_nb_pids;
+            uint32_t i_output_offset;
+            uint32_t i_output_size;
+            uint32_t i_max_outputs;
+            uint32_t i_nb_outputs;
+            uint32_t i_pid;                /* of the writer process */
+            int64_t i_start_time;          /* us since the epoch */
+            int64_t i_update_time;
+            uint64_t i_updates;
+            /* input, since start */
+            uint64_t i_packets;
+            uint64_t i_invalids;
+            uint64_t i_discontinuities;
+            uint64_t i_errors;             /* transport_error_indicator */
+            uint64_t i_bitrate;            /* bits/s, last update interval */
+            /* outputs and buffers */
+            uint64_t i_drops;
+            uint64_t i_blocks_inflight;
+            uint64_t i_eit_memory;
+            /* version 2 */
+            uint32_t i_latency_buckets;
+            uint32_t i_latency_sub_bits;
+      } header_t;
+
+      typedef struct stats_pid_t {
+            uint64_t i_packets;
+            uint64_t i_cc_errors;
+            uint64_t i_transport_errors;
+            uint64_t i_bytes_per_sec;
+            int64_t i_first_packet_ts;     /* demux clock, us */
+            int64_t i_last_packet_ts;
+            uint8_t i_scrambling;
+            uint8_t b_pes;
+            uint16_t i_nb_outputs;
+            uint32_t i_reserved;
+      } stats_pid_t;
+
+      typedef struct stats_output_t {
+            char psz_name[64];
+            uint32_t i_config;
+            uint16_t i_sid;
+            uint16_t i_reserved;
+            uint64_t i_datagrams;
+            uint64_t i_bytes;              /* TS packets, without headers */
+            uint64_t i_send_errors;
+            uint64_t i_drops;              /* dropped before the output thread */
+            uint64_t i_queue_depth;        /* datagrams waiting */
+            int64_t i_latency;             /* input to send, last datagram, us */
+            int64_t i_latency_max;         /* since the previous update */
+            /* version 2 */
+            uint64_t i_queue_max;          /* deepest queue since start */
+            uint64_t i_late;               /* sent past the output latency */
+            int64_t i_latency_sum;         /* us, with pi_latency[] gives the mean */
+            uint64_t pi_latency[CLDVB_LATENCY_BUCKETS];
+      } stats_output_t;
+
+   private:
+      char *psz_file;
+      int i_fd;
+      size_t i_size;
+      header_t *p_header;
+
+   public:
+      stats_pid_t *p_pids;
+      stats_output_t *p_outputs;
+
+      bool statsOpen(const char *psz_name, int i_max_outputs);
+      void statsClose();
+      inline header_t *header() {
+         return this->p_header;
+      }
+      inline void statsBegin() {
+         this->p_header->i_seq++;
+         __sync_synchronize();
+      }
+      inline void statsEnd() {
+         __sync_synchronize();
+         this->p_header->i_seq++;
+      }
+
+      cLdvbstats();
+      ~cLdvbstats();
+};
+
+#endif /*CLDVB_STATS_H_*/
@@ -0,0 +1,120 @@
+/*
+ * cLdvbtsscan.cpp
+ * Gokhan Poyraz <gokhan@kylone.com>
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#include <cLdvbtsscan.h>
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+void cLdvbtsscan::DecodeScalar(uint8_t * const *pp_ts, ts_header_t *p_hdrs, int i_nb)
+{
+   for (int i = 0; i < i_nb; i++) {
+      const uint8_t *p_ts = pp_ts[i];
+      p_hdrs[i].i_pid = (p_ts[1] & 0x1f) << 8 | p_ts[2];
+      p_hdrs[i].i_cc = p_ts[3] & 0x0f;
+      p_hdrs[i].i_flags = (p_ts[3] & 0xf0) | ((p_ts[1] >> 5) & 0x06) | (p_ts[0] == 0x47 ? TS_HDR_SYNC : 0);
+   }
+}
+
+#ifdef __x86_64__
+/* w = b0 | b1 << 8 | b2 << 16 | b3 << 24, see DecodeScalar() */
+void cLdvbtsscan::DecodeSSE2(const uint32_t *pi_words, ts_header_t *p_hdrs, int i_nb)
+{
+   const __m128i pid_hi = _mm_set1_epi32(0x1f00);
+   const __m128i byte = _mm_set1_epi32(0xff);
+   const __m128i cc = _mm_set1_epi32(0x0f);
+   const __m128i flags_b3 = _mm_set1_epi32(0xf0);
+   const __m128i flags_b1 = _mm_set1_epi32(0x06);
+   const __m128i sync = _mm_set1_epi32(0x47);
+   const __m128i one = _mm_set1_epi32(TS_HDR_SYNC);
+   int i = 0;
+
+   for (; i + 4 <= i_nb; i += 4) {
+      __m128i w = _mm_loadu_si128((const __m128i *)(pi_words + i));
+      __m128i pid = _mm_or_si128(_mm_and_si128(w, pid_hi), _mm_and_si128(_mm_srli_epi32(w, 16), byte));
+      __m128i b3 = _mm_srli_epi32(w, 24);
+      __m128i flags = _mm_or_si128(_mm_and_si128(b3, flags_b3), _mm_and_si128(_mm_srli_epi32(w, 13), flags_b1));
+      flags = _mm_or_si128(flags, _mm_and_si128(_mm_cmpeq_epi32(_mm_and_si128(w, byte), sync), one));
+      __m128i out = _mm_or_si128(pid, _mm_or_si128(_mm_slli_epi32(_mm_and_si128(b3, cc), 16), _mm_slli_epi32(flags, 24)));
+      _mm_storeu_si128((__m128i *)(p_hdrs + i), out);
+   }
+   for (; i < i_nb; i++) {
+      uint32_t w = pi_words[i];
+      p_hdrs[i].i_pid = (w & 0x1f00) | ((w >> 16) & 0xff);
+      p_hdrs[i].i_cc = (w >> 24) & 0x0f;
+      p_hdrs[i].i_flags = ((w >> 24) & 0xf0) | ((w >> 13) & 0x06) | ((w & 0xff) == 0x47 ? TS_HDR_SYNC : 0);
+   }
+}
+
+__attribute__((target("avx2")))
+void cLdvbtsscan::DecodeAVX2(const uint32_t *pi_words, ts_header_t *p_hdrs, int i_nb)
+{
+   const __m256i pid_hi = _mm256_set1_epi32(0x1f00);
+   const __m256i byte = _mm256_set1_epi32(0xff);
+   const __m256i cc = _mm256_set1_epi32(0x0f);
+   const __m256i flags_b3 = _mm256_set1_epi32(0xf0);
+   const __m256i flags_b1 = _mm256_set1_epi32(0x06);
+   const __m256i sync = _mm256_set1_epi32(0x47);
+   const __m256i one = _mm256_set1_epi32(TS_HDR_SYNC);
+   int i = 0;
+
+   for (; i + 8 <= i_nb; i += 8) {
+      __m256i w = _mm256_loadu_si256((const __m256i *)(pi_words + i));
+      __m256i pid = _mm256_or_si256(_mm256_and_si256(w, pid_hi), _mm256_and_si256(_mm256_srli_epi32(w, 16), byte));
+      __m256i b3 = _mm256_srli_epi32(w, 24);
+      __m256i flags = _mm256_or_si256(_mm256_and_si256(b3, flags_b3), _mm256_and_si256(_mm256_srli_epi32(w, 13), flags_b1));
+      flags = _mm256_or_si256(flags, _mm256_and_si256(_mm256_cmpeq_epi32(_mm256_and_si256(w, byte), sync), one));
+      __m256i out = _mm256_or_si256(pid, _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(b3, cc), 16), _mm256_slli_epi32(flags, 24)));
+      _mm256_storeu_si256((__m256i *)(p_hdrs + i), out);
+   }
+   if (i < i_nb)
+      cLdvbtsscan::DecodeSSE2(pi_words + i, p_hdrs + i, i_nb - i);
+}
+#endif
+
+void cLdvbtsscan::Decode(uint8_t * const *pp_ts, ts_header_t *p_hdrs, int i_nb)
+{
+#ifdef __x86_64__
+   static int i_avx2 = -1;
+   uint32_t pi_words[i_nb];
+
+   /* packets aren't contiguous, gather the header words first */
+   for (int i = 0; i < i_nb; i++)
+      memcpy(&pi_words[i], pp_ts[i], sizeof(uint32_t));
+
+   if (i_avx2 == -1)
+      i_avx2 = __builtin_cpu_supports("avx2") ? 1 : 0;
+   if (i_avx2)
+      cLdvbtsscan::DecodeAVX2(pi_words, p_hdrs, i_nb);
+   else
+      cLdvbtsscan::DecodeSSE2(pi_words, p_hdrs, i_nb);
+#else
+   cLdvbtsscan::DecodeScalar(pp_ts, p_hdrs, i_nb);
+#endif
+}
+
+const char *cLdvbtsscan::Implementation(void)
+{
+#ifdef __x86_64__
+   return __builtin_cpu_supports("avx2") ? "avx2" : "sse2";
+#else
+   return "scalar";
+#endif
+}
@@ -0,0 +1,64 @@
+/*
+ * cLdvbtsscan.h
+ * Gokhan Poyraz <gokhan@kylone.com>
+ *****************************************************************************
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston MA 02110-1301, USA.
+ *****************************************************************************/
+
+#ifndef CLDVB_TSSCAN_H_
+#define CLDVB_TSSCAN_H_
+
+#include <cLdvbcore.h>
+
+/*
+Decoded header flags (for ts_header_t -> i_flags) - bit values
+Bit  0 : Set if the sync byte is valid
+Bit  1 : payload_unit_start_indicator
+Bit  2 : transport_error_indicator
+Bit  4 : payload present
+Bit  5 : adaptation field present
+Bit 6-7: transport_scrambling_control
+ */
+#define TS_HDR_SYNC                 0x01
+#define TS_HDR_UNITSTART            0x02
+#define TS_HDR_TRANSPORTERROR       0x04
+#define TS_HDR_PAYLOAD              0x10
+#define TS_HDR_ADAPTATION           0x20
+#define TS_HDR_SCRAMBLING(f)        ((f) >> 6)
+
+class cLdvbtsscan {
+   public:
+      /* the layout matches the word computed by the vector paths
+       * on little-endian hosts: pid | cc << 16 | flags << 24 */
+      typedef struct ts_header_t {
+         uint16_t i_pid;
+         uint8_t i_cc;
+         uint8_t i_flags;
+      } ts_header_t;
+
+   private:
+      static void DecodeScalar(uint8_t * const *pp_ts, ts_header_t *p_hdrs, int i_nb);
+#ifdef __x86_64__
+      static void DecodeSSE2(const uint32_t *pi_words, ts_header_t *p_hdrs, int i_nb);
+      static void DecodeAVX2(const uint32_t *pi_words, ts_header_t *p_hdrs, int i_nb);
+#endif
+
+   public:
+      /* decode the 4-byte headers of i_nb TS packets */
+      static void Decode(uint8_t * const *pp_ts, ts_header_t *p_hdrs, int i_nb);
+      static const char *Implementation(void);
+};
+
+#endif /*CLDVB_TSSCAN_H_*/
@@ -37,6 +37,12 @@
 #ifdef HAVE_CLMACOS
 #include <sys/uio.h>
 #endif
+#ifdef HAVE_CLLINUX
+#include <sys/mman.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#endif
 
 
 #define UDP_LOCK_TIMEOUT 5000000 /* 5 s */
@@ -52,6 +58,21 @@ cLdvbudp::cLdvbudp()
    this->i_last_print = 0;
    this->psz_udp_src = (char *) 0;
    this->piped = false;
+   this->i_mmsg_cnt = 1;
+   this->pp_ring = (block_t **) 0;
+#ifdef HAVE_CLLINUX
+   this->p_msgs = (struct mmsghdr *) 0;
+#endif
+   this->p_ring_iov = (struct iovec *) 0;
+   this->p_ring_rtp = (uint8_t *) 0;
+#ifdef HAVE_CLLINUX
+   this->b_pkt_ring = false;
+   this->i_pkt_handle = -1;
+   this->p_pkt_ring = (uint8_t *) 0;
+   this->i_pkt_block = 0;
+   this->i_pkt_saddr = this->i_pkt_daddr = INADDR_ANY;
+   this->i_pkt_dport = 0;
+#endif
    for (int i = 0; i < 4; i++)
       this->pi_ssrc[i] = 0;
    cLbug(cL::dbg_high, "cLdvbudp created\n");
@@ -59,6 +80,24 @@ cLdvbudp::cLdvbudp()
 
 cLdvbudp::~cLdvbudp()
 {
+   /* the ring keeps the blocks of the slots not yet handed over */
+   if (this->pp_ring != (block_t **) 0) {
+      for (int i = 0; i < this->i_mmsg_cnt * this->i_block_cnt; i++)
+         if (this->pp_ring[i] != (block_t *) 0)
+            this->block_Delete(this->pp_ring[i]);
+   }
+   ::free(this->pp_ring);
+#ifdef HAVE_CLLINUX
+   ::free(this->p_msgs);
+#endif
+   ::free(this->p_ring_iov);
+   ::free(this->p_ring_rtp);
+#ifdef HAVE_CLLINUX
+   if (this->p_pkt_ring != (uint8_t *) 0)
+      munmap(this->p_pkt_ring, CLDVB_UDP_RING_BLOCK_SIZE * CLDVB_UDP_RING_BLOCKS);
+   if (this->i_pkt_handle >= 0)
+      close(this->i_pkt_handle);
+#endif
    cLbug(cL::dbg_high, "cLdvbudp deleted\n");
 }
 
@@ -115,6 +154,16 @@ void cLdvbudp::dev_Open()
       if (IS_OPTION("mtu=")) {
          i_mtu = strtol((const char *)ARG_OPTION("mtu="), (char **) 0, 0);
       } else
+      if (IS_OPTION("ring")) {
+#ifdef HAVE_CLLINUX
+         this->b_pkt_ring = true;
+#else
+         cLbug(cL::dbg_dvb, "packet ring is unsupported, ignoring ring option\n");
+#endif
+      } else
+      if (IS_OPTION("mmsg=")) {
+         this->i_mmsg_cnt = strtol((const char *)ARG_OPTION("mmsg="), (char **) 0, 0);
+      } else
       if (IS_OPTION("ifindex=")) {
          i_if_index = strtol((const char *)ARG_OPTION("ifindex="), (char **) 0, 0);
       } else
@@ -134,6 +183,12 @@ void cLdvbudp::dev_Open()
 
    }
 
+#ifdef HAVE_CLLINUX
+   int i_pkt_if_index = i_if_index;
+   if (!i_pkt_if_index && psz_ifname != (char *) 0)
+      i_pkt_if_index = if_nametoindex(psz_ifname);
+#endif
+
    /* Do stuff. */
 
    if (this->piped) {
@@ -145,6 +200,32 @@ void cLdvbudp::dev_Open()
 
       this->i_block_cnt = (i_mtu - (this->b_udp ? 0 : RTP_HEADER_SIZE)) / TS_SIZE;
 
+      if (this->i_mmsg_cnt < 1)
+         this->i_mmsg_cnt = 1;
+      if (this->i_mmsg_cnt > CLDVB_UDP_MAX_MMSG) {
+         cLbugf(cL::dbg_dvb, "limiting mmsg to %d datagrams\n", CLDVB_UDP_MAX_MMSG);
+         this->i_mmsg_cnt = CLDVB_UDP_MAX_MMSG;
+      }
+#ifdef HAVE_CLLINUX
+      if (this->i_mmsg_cnt > 1) {
+         /* the blocks are allocated on the first read, and only the slots
+          * handed over to the demux are refilled on the next ones */
+         int i_iov_cnt = this->i_block_cnt + 1;
+         this->pp_ring = cLmalloc(block_t *, this->i_mmsg_cnt * this->i_block_cnt);
+         for (int j = 0; j < this->i_mmsg_cnt * this->i_block_cnt; j++)
+            this->pp_ring[j] = (block_t *) 0;
+         this->p_msgs = cLmalloc(struct mmsghdr, this->i_mmsg_cnt);
+         this->p_ring_iov = cLmalloc(struct iovec, this->i_mmsg_cnt * i_iov_cnt);
+         this->p_ring_rtp = cLmalloc(uint8_t, this->i_mmsg_cnt * RTP_HEADER_SIZE);
+         cLbugf(cL::dbg_dvb, "reading up to %d datagrams per recvmmsg()\n", this->i_mmsg_cnt);
+      }
+#else
+      if (this->i_mmsg_cnt > 1) {
+         cLbug(cL::dbg_dvb, "recvmmsg() is unsupported, ignoring mmsg option\n");
+         this->i_mmsg_cnt = 1;
+      }
+#endif
+
       if ((this->i_handle = socket(i_family, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
          cLbugf(cL::dbg_dvb, "couldn't create socket (%s)\n", strerror(errno));
          exit(EXIT_FAILURE);
@@ -245,6 +326,21 @@ void cLdvbudp::dev_Open()
          }
       }
 
+#ifdef HAVE_CLLINUX
+      if (this->b_pkt_ring) {
+         if (i_family != AF_INET) {
+            cLbug(cL::dbg_dvb, "packet ring is implemented for ipv4 only, using the socket\n");
+            this->b_pkt_ring = false;
+         } else
+         if (!i_pkt_if_index) {
+            cLbug(cL::dbg_dvb, "packet ring needs ifname= or ifindex=, using the socket\n");
+            this->b_pkt_ring = false;
+         } else {
+            this->b_pkt_ring = this->PktRingOpen(i_pkt_if_index, (struct sockaddr_in *)p_bind_ai->ai_addr, p_connect_ai != (addrinfo *) 0 ? (struct sockaddr_in *)p_connect_ai->ai_addr : (struct sockaddr_in *) 0);
+         }
+      }
+#endif
+
       if (p_bind_ai != (struct addrinfo *) 0) {
          freeaddrinfo(p_bind_ai);
       }
@@ -256,6 +352,13 @@ void cLdvbudp::dev_Open()
    }
 
    this->udp_watcher.data = this;
+#ifdef HAVE_CLLINUX
+   if (this->b_pkt_ring) {
+      cLev_io_init(&this->udp_watcher, cLdvbudp::PktRingRead, this->i_pkt_handle, 1); //EV_READ
+      this->pkt_watcher.data = this;
+      cLev_timer_init(&this->pkt_watcher, cLdvbudp::PktRingWait, CLDVB_UDP_RING_TIMEOUT / 1000., 0);
+   } else
+#endif
    cLev_io_init(&this->udp_watcher, cLdvbudp::udp_Read, this->i_handle, 1); //EV_READ
    cLev_io_start(this->event_loop, &this->udp_watcher);
 
@@ -313,6 +416,99 @@ int cLdvbudp::p_readv(int fd, void *p, int ni)
    return ts;
 }
 
+void cLdvbudp::udp_CheckRTP(const uint8_t *p_rtp_hdr)
+{
+   uint8_t pi_new_ssrc[4];
+
+   if (!rtp_check_hdr(p_rtp_hdr))
+      cLbug(cL::dbg_dvb, "invalid RTP packet received\n");
+   if (rtp_get_type(p_rtp_hdr) != RTP_TYPE_TS)
+      cLbug(cL::dbg_dvb, "non-TS RTP packet received\n");
+   rtp_get_ssrc(p_rtp_hdr, pi_new_ssrc);
+   if (!memcmp(this->pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t))) {
+      if (rtp_get_seqnum(p_rtp_hdr) != this->i_seqnum)
+         cLbug(cL::dbg_dvb, "RTP discontinuity\n");
+   } else {
+      struct in_addr addr;
+      memcpy(&addr.s_addr, pi_new_ssrc, 4 * sizeof(uint8_t));
+      cLbugf(cL::dbg_dvb, "new RTP source: %s\n", inet_ntoa(addr));
+      memcpy(this->pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t));
+      cLbugf(cL::dbg_dvb, "rtpsource: %s\n", inet_ntoa(addr));
+   }
+   this->i_seqnum = rtp_get_seqnum(p_rtp_hdr) + 1;
+}
+
+#ifdef HAVE_CLLINUX
+/* drain up to i_mmsg_cnt datagrams with one recvmmsg() call and hand all
+ * of their TS packets to the demux as a single chain */
+void cLdvbudp::udp_ReadBatch(void *loop)
+{
+   int i_iov_cnt = this->i_block_cnt + 1;
+   block_t *p_ts = (block_t *) 0, **pp_current = &p_ts;
+   int i_msgs, i_total = 0;
+
+   for (int i_msg = 0; i_msg < this->i_mmsg_cnt; i_msg++) {
+      struct iovec *p_iov = &this->p_ring_iov[i_msg * i_iov_cnt];
+      block_t **pp_blocks = &this->pp_ring[i_msg * this->i_block_cnt];
+      int i_iov = 0;
+
+      if (!this->b_udp) {
+         p_iov[i_iov].iov_base = &this->p_ring_rtp[i_msg * RTP_HEADER_SIZE];
+         p_iov[i_iov].iov_len = RTP_HEADER_SIZE;
+         i_iov++;
+      }
+      for (int i_block = 0; i_block < this->i_block_cnt; i_block++) {
+         if (pp_blocks[i_block] == (block_t *) 0)
+            pp_blocks[i_block] = this->block_New();
+         p_iov[i_iov].iov_base = pp_blocks[i_block]->p_ts;
+         p_iov[i_iov].iov_len = TS_SIZE;
+         i_iov++;
+      }
+
+      memset(&this->p_msgs[i_msg], 0, sizeof(struct mmsghdr));
+      this->p_msgs[i_msg].msg_hdr.msg_iov = p_iov;
+      this->p_msgs[i_msg].msg_hdr.msg_iovlen = i_iov;
+   }
+
+   if ((i_msgs = recvmmsg(this->i_handle, this->p_msgs, this->i_mmsg_cnt, MSG_DONTWAIT, (struct timespec *) 0)) < 0) {
+      if (errno != EAGAIN && errno != EINTR)
+         cLbugf(cL::dbg_dvb, "couldn't read from network (%s)\n", strerror(errno));
+      return;
+   }
+
+   for (int i_msg = 0; i_msg < i_msgs; i_msg++) {
+      block_t **pp_blocks = &this->pp_ring[i_msg * this->i_block_cnt];
+      ssize_t i_len = this->p_msgs[i_msg].msg_len;
+
+      if (!this->b_udp) {
+         this->udp_CheckRTP(&this->p_ring_rtp[i_msg * RTP_HEADER_SIZE]);
+         i_len -= RTP_HEADER_SIZE;
+      }
+      if (i_len < 0)
+         continue;
+
+      i_len /= TS_SIZE;
+      for (int i_block = 0; i_block < i_len; i_block++) {
+         *pp_current = pp_blocks[i_block];
+         pp_current = &(*pp_current)->p_next;
+         pp_blocks[i_block] = (block_t *) 0;
+         i_total++;
+      }
+   }
+   *pp_current = (block_t *) 0;
+
+   if (i_total) {
+      if (!this->b_sync) {
+         cLbug(cL::dbg_dvb, "frontend has acquired lock\n");
+         this->b_sync = true;
+      }
+      cLev_timer_again(loop, &this->mute_watcher);
+   }
+
+   this->demux_Run(p_ts);
+}
+#endif
+
 void cLdvbudp::udp_Read(void *loop, void *p, int revents)
 {
    struct cLev_io *w = (struct cLev_io *) p;
@@ -321,6 +517,37 @@ void cLdvbudp::udp_Read(void *loop, void *p, int revents)
    if (!pobj->piped)
       pobj->udp_Read_print_refactory();
 
+#ifdef HAVE_CLLINUX
+   if (pobj->pp_ring != (block_t **) 0) {
+      pobj->udp_ReadBatch(loop);
+      return;
+   }
+#endif
+
+   /* raw TS on stdin, read in large batches */
+   if (pobj->piped && pobj->b_udp && pobj->i_batch_size) {
+      block_t *p_ts;
+      ssize_t i_ret = pobj->block_ReadBatch(pobj->i_handle, &p_ts);
+      if (i_ret < 0 && errno != EAGAIN && errno != EINTR)
+         cLbugf(cL::dbg_dvb, "couldn't read from stdin (%s)\n", strerror(errno));
+      if (p_ts != (block_t *) 0) {
+         if (!pobj->b_sync) {
+            cLbug(cL::dbg_dvb, "frontend has acquired lock\n");
+            pobj->b_sync = true;
+         }
+         cLev_timer_again(loop, &pobj->mute_watcher);
+      }
+      pobj->demux_Run(p_ts);
+      /* unlike p_readv(), which retries a zero-byte read forever, stop
+       * at the end of the input */
+      if (i_ret == 0) {
+         cLbug(cL::dbg_dvb, "end of input\n");
+         cLev_io_stop(loop, w);
+         cLev_break(loop, 2); //EVBREAK_ALL
+      }
+      return;
+   }
+
    struct iovec p_iov[pobj->i_block_cnt + 1];
    block_t *p_ts, **pp_current = &p_ts;
    int i_iov, i_block;
@@ -358,24 +585,7 @@ void cLdvbudp::udp_Read(void *loop, void *p, int revents)
    }
 
    if (!pobj->b_udp) {
-      uint8_t pi_new_ssrc[4];
-
-      if (!rtp_check_hdr(p_rtp_hdr))
-         cLbug(cL::dbg_dvb, "invalid RTP packet received\n");
-      if (rtp_get_type(p_rtp_hdr) != RTP_TYPE_TS)
-         cLbug(cL::dbg_dvb, "non-TS RTP packet received\n");
-      rtp_get_ssrc(p_rtp_hdr, pi_new_ssrc);
-      if (!memcmp(pobj->pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t))) {
-         if (rtp_get_seqnum(p_rtp_hdr) != pobj->i_seqnum)
-            cLbug(cL::dbg_dvb, "RTP discontinuity\n");
-      } else {
-         struct in_addr addr;
-         memcpy(&addr.s_addr, pi_new_ssrc, 4 * sizeof(uint8_t));
-         cLbugf(cL::dbg_dvb, "new RTP source: %s\n", inet_ntoa(addr));
-         memcpy(pobj->pi_ssrc, pi_new_ssrc, 4 * sizeof(uint8_t));
-         cLbugf(cL::dbg_dvb, "rtpsource: %s\n", inet_ntoa(addr));
-      }
-      pobj->i_seqnum = rtp_get_seqnum(p_rtp_hdr) + 1;
+      pobj->udp_CheckRTP(p_rtp_hdr);
       i_len -= RTP_HEADER_SIZE;
    }
 
@@ -401,6 +611,201 @@ void cLdvbudp::udp_Read(void *loop, void *p, int revents)
    pobj->demux_Run(p_ts);
 }
 
+#ifdef HAVE_CLLINUX
+/* set up an AF_PACKET TPACKET_V3 ring on the interface, the TS packets are
+ * then handed to the demux as views on the ring blocks, without any copy */
+bool cLdvbudp::PktRingOpen(int i_if_index, const struct sockaddr_in *p_bind, const struct sockaddr_in *p_source)
+{
+   int i_version = TPACKET_V3;
+   size_t i_ring_size = CLDVB_UDP_RING_BLOCK_SIZE * CLDVB_UDP_RING_BLOCKS;
+   struct tpacket_req3 req;
+   struct sockaddr_ll addr;
+   struct sock_filter drop = BPF_STMT(BPF_RET | BPF_K, 0);
+   struct sock_fprog prog;
+   void *p_ring;
+
+   if ((this->i_pkt_handle = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP))) < 0) {
+      cLbugf(cL::dbg_dvb, "couldn't create packet socket (%s), using the socket\n", strerror(errno));
+      return false;
+   }
+
+   if (setsockopt(this->i_pkt_handle, SOL_PACKET, PACKET_VERSION, &i_version, sizeof(i_version)) < 0) {
+      cLbugf(cL::dbg_dvb, "TPACKET_V3 is unsupported (%s), using the socket\n", strerror(errno));
+      goto err;
+   }
+
+   memset(&req, 0, sizeof(req));
+   req.tp_block_size = CLDVB_UDP_RING_BLOCK_SIZE;
+   req.tp_block_nr = CLDVB_UDP_RING_BLOCKS;
+   req.tp_frame_size = CLDVB_UDP_RING_FRAME_SIZE;
+   req.tp_frame_nr = (CLDVB_UDP_RING_BLOCK_SIZE / CLDVB_UDP_RING_FRAME_SIZE) * CLDVB_UDP_RING_BLOCKS;
+   req.tp_retire_blk_tov = CLDVB_UDP_RING_TIMEOUT;
+   if (setsockopt(this->i_pkt_handle, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+      cLbugf(cL::dbg_dvb, "couldn't set up packet ring (%s), using the socket\n", strerror(errno));
+      goto err;
+   }
+
+   p_ring = mmap((void *) 0, i_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, this->i_pkt_handle, 0);
+   if (p_ring == MAP_FAILED) {
+      cLbugf(cL::dbg_dvb, "couldn't map packet ring (%s), using the socket\n", strerror(errno));
+      goto err;
+   }
+
+   memset(&addr, 0, sizeof(addr));
+   addr.sll_family = AF_PACKET;
+   addr.sll_protocol = htons(ETH_P_IP);
+   addr.sll_ifindex = i_if_index;
+   if (bind(this->i_pkt_handle, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+      cLbugf(cL::dbg_dvb, "couldn't bind packet socket (%s), using the socket\n", strerror(errno));
+      munmap(p_ring, i_ring_size);
+      goto err;
+   }
+
+   this->p_pkt_ring = (uint8_t *)p_ring;
+   this->i_pkt_block = 0;
+   for (int i = 0; i < CLDVB_UDP_RING_BLOCKS; i++) {
+      this->p_pkt_buffers[i].i_refcount = 0;
+      this->p_pkt_buffers[i].pf_release = cLdvbudp::PktRingRelease;
+      this->p_pkt_buffers[i].p_opaque = this;
+      this->pb_pkt_parsed[i] = false;
+   }
+   this->i_pkt_daddr = p_bind->sin_addr.s_addr;
+   this->i_pkt_dport = p_bind->sin_port;
+   this->i_pkt_saddr = p_source != (const struct sockaddr_in *) 0 ? p_source->sin_addr.s_addr : INADDR_ANY;
+
+   /* the socket is only kept for the multicast membership, have the
+    * kernel drop its copy of the datagrams */
+   prog.len = 1;
+   prog.filter = &drop;
+   if (setsockopt(this->i_handle, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0)
+      cLbugf(cL::dbg_dvb, "couldn't attach filter to the socket (%s)\n", strerror(errno));
+
+   cLbugf(cL::dbg_dvb, "reading from TPACKET_V3 ring on interface %d\n", i_if_index);
+   return true;
+
+   err:
+   close(this->i_pkt_handle);
+   this->i_pkt_handle = -1;
+   return false;
+}
+
+/* give a ring block back to the kernel once no block_t points into it */
+void cLdvbudp::PktRingRelease(void *p_opaque, block_buffer_t *p_buffer)
+{
+   cLdvbudp *pobj = (cLdvbudp *)p_opaque;
+   int i_block = p_buffer - pobj->p_pkt_buffers;
+   struct tpacket_block_desc *p_desc = (struct tpacket_block_desc *)(pobj->p_pkt_ring + i_block * CLDVB_UDP_RING_BLOCK_SIZE);
+
+   pobj->pb_pkt_parsed[i_block] = false;
+   __sync_synchronize();
+   p_desc->hdr.bh1.block_status = TP_STATUS_KERNEL;
+}
+
+/* parse the IPv4/UDP/RTP headers of a frame in place and chain a block
+ * for each TS packet of the payload */
+cLdvboutput::block_t **cLdvbudp::PktRingParse(struct tpacket3_hdr *p_hdr, block_buffer_t *p_buffer, block_t **pp_current)
+{
+   struct sockaddr_ll *p_ll = (struct sockaddr_ll *)((uint8_t *)p_hdr + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+   uint8_t *p_data = (uint8_t *)p_hdr + p_hdr->tp_mac;
+   int i_len = p_hdr->tp_snaplen;
+
+   if (p_ll->sll_pkttype == PACKET_OUTGOING || i_len < (int)sizeof(struct iphdr))
+      return pp_current;
+
+   struct iphdr *p_ip = (struct iphdr *)p_data;
+   int i_ihl = p_ip->ihl * 4;
+   if (p_ip->version != 4 || p_ip->ihl < 5 || p_ip->protocol != IPPROTO_UDP || (ntohs(p_ip->frag_off) & 0x3fff) || i_len < i_ihl + (int)sizeof(struct udpheader))
+      return pp_current;
+   if (this->i_pkt_daddr != INADDR_ANY && p_ip->daddr != this->i_pkt_daddr)
+      return pp_current;
+   if (this->i_pkt_saddr != INADDR_ANY && p_ip->saddr != this->i_pkt_saddr)
+      return pp_current;
+
+   struct udpheader *p_udp = (struct udpheader *)(p_data + i_ihl);
+   if (p_udp->dest != this->i_pkt_dport)
+      return pp_current;
+
+   uint8_t *p_payload = (uint8_t *)(p_udp + 1);
+   int i_payload = ntohs(p_udp->len) - sizeof(struct udpheader);
+   if (i_payload > i_len - i_ihl - (int)sizeof(struct udpheader))
+      i_payload = i_len - i_ihl - sizeof(struct udpheader);
+
+   if (!this->b_udp) {
+      if (i_payload < RTP_HEADER_SIZE)
+         return pp_current;
+      this->udp_CheckRTP(p_payload);
+      p_payload += RTP_HEADER_SIZE;
+      i_payload -= RTP_HEADER_SIZE;
+   }
+
+   for (; i_payload >= TS_SIZE; i_payload -= TS_SIZE, p_payload += TS_SIZE) {
+      *pp_current = this->block_NewView(p_buffer, p_payload);
+      pp_current = &(*pp_current)->p_next;
+   }
+   return pp_current;
+}
+
+void cLdvbudp::PktRingRead(void *loop, void *p, int revents)
+{
+   struct cLev_io *w = (struct cLev_io *) p;
+   cLdvbudp *pobj = (cLdvbudp *) w->data;
+   block_t *p_ts = (block_t *) 0, **pp_current = &p_ts;
+   int i_blocks = 0;
+
+   for (;;) {
+      unsigned int i_block = pobj->i_pkt_block;
+      struct tpacket_block_desc *p_desc = (struct tpacket_block_desc *)(pobj->p_pkt_ring + i_block * CLDVB_UDP_RING_BLOCK_SIZE);
+      block_buffer_t *p_buffer = &pobj->p_pkt_buffers[i_block];
+
+      if (pobj->pb_pkt_parsed[i_block] || !(p_desc->hdr.bh1.block_status & TP_STATUS_USER))
+         break;
+      __sync_synchronize();
+
+      pobj->pb_pkt_parsed[i_block] = true;
+      p_buffer->i_refcount = 1; /* held while parsing */
+
+      struct tpacket3_hdr *p_hdr = (struct tpacket3_hdr *)((uint8_t *)p_desc + p_desc->hdr.bh1.offset_to_first_pkt);
+      for (unsigned int i = 0; i < p_desc->hdr.bh1.num_pkts; i++) {
+         pp_current = pobj->PktRingParse(p_hdr, p_buffer, pp_current);
+         p_hdr = (struct tpacket3_hdr *)((uint8_t *)p_hdr + p_hdr->tp_next_offset);
+      }
+
+      if (!--p_buffer->i_refcount)
+         cLdvbudp::PktRingRelease(pobj, p_buffer);
+      pobj->i_pkt_block = (i_block + 1) % CLDVB_UDP_RING_BLOCKS;
+      i_blocks++;
+   }
+   *pp_current = (block_t *) 0;
+
+   if (!i_blocks) {
+      /* the kernel keeps signaling the ring as readable while we hold the
+       * previous block, so poll it from a timer until there is new data */
+      cLev_io_stop(loop, &pobj->udp_watcher);
+      cLev_timer_set(&pobj->pkt_watcher, CLDVB_UDP_RING_TIMEOUT / 1000., 0);
+      cLev_timer_start(loop, &pobj->pkt_watcher);
+      return;
+   }
+
+   if (p_ts != (block_t *) 0) {
+      if (!pobj->b_sync) {
+         cLbug(cL::dbg_dvb, "frontend has acquired lock\n");
+         pobj->b_sync = true;
+      }
+      cLev_timer_again(loop, &pobj->mute_watcher);
+   }
+
+   pobj->demux_Run(p_ts);
+}
+
+void cLdvbudp::PktRingWait(void *loop, void *p, int revents)
+{
+   struct cLev_timer *w = (struct cLev_timer *) p;
+   cLdvbudp *pobj = (cLdvbudp *) w->data;
+
+   cLev_io_start(loop, &pobj->udp_watcher);
+}
+#endif
+
 void cLdvbudp::udp_MuteCb(void *loop, void *p, int revents)
 {
    //struct cLev_timer *w = (struct cLev_timer *) p;
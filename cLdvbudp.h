@@ -44,7 +44,36 @@ class cLdvbudp : public cLdvbdemux {
       struct sockaddr_storage last_addr;
       char *psz_udp_src;
       bool piped;
+      /* recvmmsg() ring: i_mmsg_cnt datagrams of i_block_cnt blocks */
+      int i_mmsg_cnt;
+      block_t **pp_ring;
+#ifdef HAVE_CLLINUX
+      struct mmsghdr *p_msgs;
+#endif
+      struct iovec *p_ring_iov;
+      uint8_t *p_ring_rtp;
+#ifdef HAVE_CLLINUX
+      /* PACKET_MMAP (TPACKET_V3) capture ring */
+      bool b_pkt_ring;
+      int i_pkt_handle;
+      struct cLev_timer pkt_watcher;
+      uint8_t *p_pkt_ring;
+      unsigned int i_pkt_block;
+      block_buffer_t p_pkt_buffers[CLDVB_UDP_RING_BLOCKS];
+      bool pb_pkt_parsed[CLDVB_UDP_RING_BLOCKS];
+      in_addr_t i_pkt_saddr, i_pkt_daddr;
+      uint16_t i_pkt_dport;
+      bool PktRingOpen(int i_if_index, const struct sockaddr_in *p_bind, const struct sockaddr_in *p_source);
+      block_t **PktRingParse(struct tpacket3_hdr *p_hdr, block_buffer_t *p_buffer, block_t **pp_current);
+      static void PktRingRelease(void *p_opaque, block_buffer_t *p_buffer);
+      static void PktRingRead(void *loop, void *w, int revents);
+      static void PktRingWait(void *loop, void *w, int revents);
+#endif
       int p_readv(int fd, void *p, int ni);
+      void udp_CheckRTP(const uint8_t *p_rtp_hdr);
+#ifdef HAVE_CLLINUX
+      void udp_ReadBatch(void *loop);
+#endif
       static void udp_Read(void *loop, void *w, int revents);
       static void udp_MuteCb(void *loop, void *w, int revents);
 